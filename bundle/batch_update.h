@@ -0,0 +1,63 @@
+// Jacob Nelson
+//
+// This file defines the operations accepted by batchUpdate() in the bundled
+// data structures. A batch is applied atomically: every update in it takes
+// effect at a single linearization timestamp, so a range query observes either
+// all of the batch or none of it. The batch is sorted by key in place and ops
+// on the same key take effect in the order they were given. Each op records in
+// result what the corresponding single-key operation would have returned had
+// the ops been executed one at a time.
+
+#ifndef BUNDLE_BATCH_UPDATE_H
+#define BUNDLE_BATCH_UPDATE_H
+
+#include <algorithm>
+
+enum batch_op_type_t { BATCH_INSERT, BATCH_INSERT_IF_ABSENT, BATCH_ERASE };
+
+template <typename K, typename V>
+struct BatchOp {
+  batch_op_type_t type;
+  K key;
+  V val;     // Value to insert. Ignored by erases.
+  V result;  // Previous value of key, or NO_VALUE if it was absent.
+};
+
+// Sorts ops by key without reordering the ops on a single key.
+template <typename K, typename V>
+inline void batchSort(BatchOp<K, V> *const ops, const int n) {
+  std::stable_sort(ops, ops + n,
+                   [](const BatchOp<K, V> &a, const BatchOp<K, V> &b) {
+                     return a.key < b.key;
+                   });
+}
+
+// Returns the number of ops starting at ops[0] that share its key.
+template <typename K, typename V>
+inline int batchRunLength(const BatchOp<K, V> *const ops, const int n) {
+  int len = 1;
+  while (len < n && ops[len].key == ops[0].key) ++len;
+  return len;
+}
+
+// Applies the n ops of a run to the state of their key, given by whether it is
+// present and its value, and sets their results. Returns true if an insert
+// wrote a value.
+template <typename K, typename V>
+inline bool batchApply(BatchOp<K, V> *const ops, const int n,
+                       const V &NO_VALUE, bool *const present, V *const val) {
+  bool written = false;
+  for (int i = 0; i < n; ++i) {
+    ops[i].result = (*present ? *val : NO_VALUE);
+    if (ops[i].type == BATCH_ERASE) {
+      *present = false;
+    } else if (ops[i].type == BATCH_INSERT || !*present) {
+      *present = true;
+      *val = ops[i].val;
+      written = true;
+    }
+  }
+  return written;
+}
+
+#endif  // BUNDLE_BATCH_UPDATE_H
@@ -0,0 +1,259 @@
+// Jacob Nelson
+//
+// This file implements the telemetry of the bundle range query provider (see
+// rq_bundle.h), which is compiled in with BUNDLE_TELEMETRY. It is meant to be
+// left on in benchmark runs, so every thread only updates counters in its own
+// slot and the slots are summed when a report is requested. It tracks:
+//  - the number of records that bundles and value histories allocate from the
+//    record manager (entries, or rings for the circular bundle; those
+//    reclaimed or retired are already counted by the provider). An inline
+//    bundle only allocates when it spills an entry,
+//  - the length of every BUNDLE_TELEMETRY_SAMPLE-th bundle extended by an
+//    update, which costs a walk of that bundle,
+//  - the lag between the current timestamp and the oldest active range query,
+//    when every BUNDLE_TELEMETRY_SAMPLE-th range query of a thread starts,
+//    which costs a scan of the announcements,
+//  - the duration of each background cleanup pass.
+// Lengths and lags are kept in power-of-two histograms. reset() starts a new
+// measurement window without touching the slots, so it may be called while
+// other threads run. Sums are reported relative to the totals at the last
+// reset(). Maxima cannot be subtracted, so each slot tags its maxima with the
+// window they belong to and clears them when it first records in a new one.
+
+#ifndef BUNDLE_BUNDLE_TELEMETRY_H
+#define BUNDLE_BUNDLE_TELEMETRY_H
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "common_bundle.h"
+#include "plaf.h"
+
+#ifndef BUNDLE_TELEMETRY_SAMPLE
+#define BUNDLE_TELEMETRY_SAMPLE 64
+#endif
+#define BUNDLE_TELEMETRY_BUCKETS 64
+
+#ifdef BUNDLE_TELEMETRY
+
+class BundleTelemetry {
+ private:
+  struct counters {
+    long long window;  // Window of the maxima below.
+    long long allocated;
+    long long samples;  // Bundle extensions seen, of which every
+                        // BUNDLE_TELEMETRY_SAMPLE-th is measured.
+    long long rqs;      // Range queries started, sampled likewise.
+    long long lengths[BUNDLE_TELEMETRY_BUCKETS];
+    long long length_sum;
+    long long length_max;
+    long long lags[BUNDLE_TELEMETRY_BUCKETS];
+    long long lag_sum;
+    long long lag_max;
+    long long passes;
+    long long pass_ns;
+    long long pass_max_ns;
+  };
+
+  // Padded so that the counters of different threads never share a line.
+  union slot {
+    counters c;
+    volatile char bytes[sizeof(counters) + PREFETCH_SIZE_BYTES];
+  };
+
+  const int num_processes_;
+  slot *slots_;
+  std::atomic<long long> window_;
+  // Totals at the start of the current window.
+  counters base_;
+  long long base_reclaimed_;
+  std::chrono::steady_clock::time_point start_;
+
+  // Bucket i holds values in [2^(i-1), 2^i), and bucket 0 holds 0.
+  static inline int bucket(long long x) {
+    if (x <= 0) return 0;
+    const int b = 64 - __builtin_clzll((unsigned long long)x);
+    return (b < BUNDLE_TELEMETRY_BUCKETS ? b : BUNDLE_TELEMETRY_BUCKETS - 1);
+  }
+
+  // Returns the counters of tid, after clearing its maxima if they belong to an
+  // earlier window.
+  inline counters &current(const int tid) {
+    counters &c = slots_[tid].c;
+    const long long window = window_.load(std::memory_order_relaxed);
+    if (c.window != window) {
+      c.window = window;
+      c.length_max = 0;
+      c.lag_max = 0;
+      c.pass_max_ns = 0;
+    }
+    return c;
+  }
+
+  // Sums the counters of all threads. Only maxima of the current window count.
+  void sum(counters &t) const {
+    const long long window = window_.load(std::memory_order_relaxed);
+    t = counters();
+    t.window = window;
+    for (int i = 0; i < num_processes_; ++i) {
+      const counters &c = slots_[i].c;
+      t.allocated += c.allocated;
+      t.samples += c.samples;
+      t.rqs += c.rqs;
+      for (int b = 0; b < BUNDLE_TELEMETRY_BUCKETS; ++b) {
+        t.lengths[b] += c.lengths[b];
+        t.lags[b] += c.lags[b];
+      }
+      t.length_sum += c.length_sum;
+      t.lag_sum += c.lag_sum;
+      t.passes += c.passes;
+      t.pass_ns += c.pass_ns;
+      if (c.window != window) continue;
+      t.length_max = std::max(t.length_max, c.length_max);
+      t.lag_max = std::max(t.lag_max, c.lag_max);
+      t.pass_max_ns = std::max(t.pass_max_ns, c.pass_max_ns);
+    }
+  }
+
+  static void printHistogram(std::stringstream &ss, const char *name,
+                             const long long *now, const long long *base) {
+    ss << name;
+    for (int b = 0; b < BUNDLE_TELEMETRY_BUCKETS; ++b) {
+      const long long n = now[b] - base[b];
+      if (n == 0) continue;
+      ss << " [" << (b == 0 ? 0 : 1LL << (b - 1)) << "]=" << n;
+    }
+    ss << std::endl;
+  }
+
+ public:
+  explicit BundleTelemetry(const int num_processes)
+      : num_processes_(num_processes) {
+    slots_ = new slot[num_processes];
+    for (int i = 0; i < num_processes; ++i) slots_[i].c = counters();
+    window_.store(0, std::memory_order_relaxed);
+    base_ = counters();
+    base_reclaimed_ = 0;
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  ~BundleTelemetry() { delete[] slots_; }
+
+  inline void count_allocated(const int tid, const long long n) {
+    slots_[tid].c.allocated += n;
+  }
+
+  // Records the length of bundle if this is a sampled extension.
+  template <typename Bundle>
+  inline void sample_length(const int tid, Bundle *const bundle) {
+    if (++slots_[tid].c.samples % BUNDLE_TELEMETRY_SAMPLE != 0) return;
+    counters &c = current(tid);
+    const long long len = bundle->size();
+    ++c.lengths[bucket(len)];
+    c.length_sum += len;
+    if (len > c.length_max) c.length_max = len;
+  }
+
+  // Returns true if the range query that tid is starting should record its
+  // lag.
+  inline bool sample_rq(const int tid) {
+    return ++slots_[tid].c.rqs % BUNDLE_TELEMETRY_SAMPLE == 0;
+  }
+
+  inline void record_lag(const int tid, const timestamp_t lag) {
+    counters &c = current(tid);
+    ++c.lags[bucket(lag)];
+    c.lag_sum += lag;
+    if (lag > c.lag_max) c.lag_max = lag;
+  }
+
+  inline void record_pass(const int tid, const long long ns) {
+    counters &c = current(tid);
+    ++c.passes;
+    c.pass_ns += ns;
+    if (ns > c.pass_max_ns) c.pass_max_ns = ns;
+  }
+
+  // Starts a new window. reclaimed is the provider's current count of
+  // reclaimed entries.
+  void reset(const long long reclaimed) {
+    window_.fetch_add(1, std::memory_order_relaxed);
+    sum(base_);
+    base_reclaimed_ = reclaimed;
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  // Reports the current window. entry_bytes is the size of a bundle entry.
+  std::string toString(const long long reclaimed,
+                       const size_t entry_bytes) const {
+    counters t;
+    sum(t);
+    const double secs = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start_)
+                            .count();
+    const long long allocated = t.allocated - base_.allocated;
+    const long long freed = reclaimed - base_reclaimed_;
+    long long measured = 0;
+    for (int b = 0; b < BUNDLE_TELEMETRY_BUCKETS; ++b) {
+      measured += t.lengths[b] - base_.lengths[b];
+    }
+    long long scans = 0;
+    for (int b = 0; b < BUNDLE_TELEMETRY_BUCKETS; ++b) {
+      scans += t.lags[b] - base_.lags[b];
+    }
+    const long long passes = t.passes - base_.passes;
+    const double rate = (secs > 0 ? 1 / secs : 0);
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    ss << "bundle telemetry window seconds : " << secs << std::endl;
+    ss << "entries allocated per second    : " << allocated * rate << " ("
+       << allocated * entry_bytes * rate / 1e6 << " MB/s)" << std::endl;
+    ss << "entries reclaimed per second    : " << freed * rate << std::endl;
+    ss << "bundle length samples           : " << measured << " (1 in "
+       << BUNDLE_TELEMETRY_SAMPLE << " extensions)" << std::endl;
+    ss << "bundle length avg / max         : "
+       << (measured ? (double)(t.length_sum - base_.length_sum) / measured : 0)
+       << " / " << t.length_max << std::endl;
+    printHistogram(ss, "bundle length histogram         :", t.lengths,
+                   base_.lengths);
+    ss << "rq lag samples                  : " << scans << " (1 in "
+       << BUNDLE_TELEMETRY_SAMPLE << " range queries)" << std::endl;
+    ss << "rq lag avg / max                : "
+       << (scans ? (double)(t.lag_sum - base_.lag_sum) / scans : 0) << " / "
+       << t.lag_max << std::endl;
+    printHistogram(ss, "rq lag histogram                :", t.lags,
+                   base_.lags);
+    ss << "cleanup passes                  : " << passes << std::endl;
+    ss << "cleanup pass avg / max us       : "
+       << (passes ? (t.pass_ns - base_.pass_ns) / 1e3 / passes : 0) << " / "
+       << t.pass_max_ns / 1e3 << std::endl;
+    return ss.str();
+  }
+};
+
+#else
+
+// Compiled out. The provider calls these unconditionally.
+class BundleTelemetry {
+ public:
+  explicit BundleTelemetry(const int num_processes) {}
+  inline void count_allocated(const int tid, const long long n) {}
+  template <typename Bundle>
+  inline void sample_length(const int tid, Bundle *const bundle) {}
+  inline bool sample_rq(const int tid) { return false; }
+  inline void record_lag(const int tid, const timestamp_t lag) {}
+  inline void record_pass(const int tid, const long long ns) {}
+  void reset(const long long reclaimed) {}
+  std::string toString(const long long reclaimed,
+                       const size_t entry_bytes) const {
+    return "bundle telemetry disabled (define BUNDLE_TELEMETRY)\n";
+  }
+};
+
+#endif
+
+#endif  // BUNDLE_BUNDLE_TELEMETRY_H
@@ -0,0 +1,204 @@
+// Jacob Nelson
+//
+// This file implements the timestamp sources used by the bundle range query
+// provider. A source hands out update linearization timestamps and range query
+// snapshot timestamps such that a range query at ts observes exactly the
+// updates labeled with a timestamp no greater than ts. In every source an
+// update reads its timestamp only after its bundles have been made pending, and
+// a range query reads bundles only after taking its timestamp.
+//
+// The source is selected at compile time:
+//  - BUNDLE_TIMESTAMP_GLOBAL (default) increments a single shared counter on
+//    every update, with backoff to reduce contention.
+//  - BUNDLE_TIMESTAMP_TSC labels operations with the invariant timestamp
+//    counter of the executing core. Requires a TSC that is synchronized across
+//    sockets.
+//  - BUNDLE_TIMESTAMP_NUMA lets range queries advance an epoch that is
+//    replicated once per NUMA node. Updates only read the replica of their own
+//    node, so they never write a shared cache line.
+
+#ifndef BUNDLE_BUNDLE_TIMESTAMP_H
+#define BUNDLE_BUNDLE_TIMESTAMP_H
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+
+#include "common_bundle.h"
+#include "plaf.h"
+
+#if defined(BUNDLE_TIMESTAMP_TSC)
+#define BUNDLE_TIMESTAMP_DECL TscTimestamp
+#define BUNDLE_TIMESTAMP_NAME "tsc"
+#elif defined(BUNDLE_TIMESTAMP_NUMA)
+#define BUNDLE_TIMESTAMP_DECL NumaTimestamp
+#define BUNDLE_TIMESTAMP_NAME "numa"
+#else
+#ifndef BUNDLE_TIMESTAMP_GLOBAL
+#define BUNDLE_TIMESTAMP_GLOBAL
+#endif
+#define BUNDLE_TIMESTAMP_DECL GlobalTimestamp
+#define BUNDLE_TIMESTAMP_NAME "global"
+#endif
+
+// The alternative modes below manipulate the shared counter directly.
+#if (defined(BUNDLE_RQTS) || defined(BUNDLE_UNSAFE_BUNDLE)) && \
+    !defined(BUNDLE_TIMESTAMP_GLOBAL)
+#error BUNDLE_RQTS and BUNDLE_UNSAFE_BUNDLE require BUNDLE_TIMESTAMP_GLOBAL
+#endif
+
+// Successive updates to the same bundle receive strictly increasing timestamps.
+// Bundles rely on this to resolve a range query against the second entry while
+// the first one is still pending. Sources that let several updates share a
+// timestamp leave it undefined.
+#if defined(BUNDLE_TIMESTAMP_GLOBAL) && !defined(BUNDLE_RQTS)
+#define BUNDLE_TIMESTAMP_UNIQUE
+#elif defined(BUNDLE_TIMESTAMP_TSC)
+#define BUNDLE_TIMESTAMP_UNIQUE
+#endif
+#ifdef BUNDLE_TIMESTAMP_UNIQUE
+#define BUNDLE_TIMESTAMP_IS_UNIQUE true
+#else
+#define BUNDLE_TIMESTAMP_IS_UNIQUE false
+#endif
+
+#ifndef BUNDLE_TIMESTAMP_NUMA_NODES
+#define BUNDLE_TIMESTAMP_NUMA_NODES 8
+#endif
+
+static thread_local int backoff_amt = 0;
+
+class GlobalTimestamp {
+ private:
+  volatile char pad0[PREFETCH_SIZE_BYTES];
+  std::atomic<timestamp_t> curr_timestamp_;
+  volatile char pad1[PREFETCH_SIZE_BYTES];
+
+  inline void backoff(int amount) {
+    if (amount == 0) return;
+    volatile long long sum = 0;
+    int limit = amount;
+    for (int i = 0; i < limit; i++) sum += i;
+  }
+
+ public:
+  void init() { curr_timestamp_ = BUNDLE_MIN_TIMESTAMP; }
+
+  // Returns a timestamp that is no greater than that of any future range query.
+  inline timestamp_t current() {
+    return curr_timestamp_.load(std::memory_order_seq_cst);
+  }
+
+  // Increments the counter unless another thread did so while backing off.
+  // Either way, the returned timestamp is newer than any range query that
+  // started before the call.
+  inline timestamp_t next_update_ts(const int tid) {
+    timestamp_t ts = curr_timestamp_.load(std::memory_order_seq_cst);
+    backoff(backoff_amt);
+    if (ts == curr_timestamp_.load(std::memory_order_seq_cst)) {
+      if (curr_timestamp_.fetch_add(1, std::memory_order_release) == ts)
+        backoff_amt /= 2;
+      else
+        backoff_amt *= 2;
+    }
+    if (backoff_amt < 1) backoff_amt = 1;
+    if (backoff_amt > 512) backoff_amt = 512;
+    return ts + 1;
+  }
+
+  inline timestamp_t next_rq_ts(const int tid) { return current(); }
+
+  // Unconditionally advances the counter. Used by BUNDLE_TIMESTAMP_RELAXATION.
+  inline timestamp_t advance() { return curr_timestamp_.fetch_add(1) + 1; }
+};
+
+class TscTimestamp {
+ private:
+  // The fence drains pending bundle stores before the counter is read, and
+  // rdtscp/lfence keep later loads from being executed before the read.
+  static inline timestamp_t read() {
+#if defined(__x86_64__)
+    unsigned hi, lo;
+    __asm__ __volatile__("mfence\n\trdtscp\n\tlfence"
+                         : "=a"(lo), "=d"(hi)
+                         :
+                         : "rcx", "memory");
+    return (timestamp_t)(((uint64_t)lo) | (((uint64_t)hi) << 32));
+#else
+#error BUNDLE_TIMESTAMP_TSC requires x86_64
+#endif
+  }
+
+ public:
+  void init() {}
+
+  // Two cores may read the same counter value without either happening first,
+  // so range queries only observe updates that read a strictly smaller value.
+  inline timestamp_t current() { return read() - 1; }
+
+  inline timestamp_t next_update_ts(const int tid) { return read(); }
+
+  inline timestamp_t next_rq_ts(const int tid) { return current(); }
+};
+
+class NumaTimestamp {
+ private:
+  struct replica {
+    std::atomic<timestamp_t> ts;
+    volatile char pad[PREFETCH_SIZE_BYTES - sizeof(timestamp_t)];
+  };
+
+  volatile char pad0[PREFETCH_SIZE_BYTES];
+  // Authoritative epoch. Only written by range queries.
+  std::atomic<timestamp_t> epoch_;
+  volatile char pad1[PREFETCH_SIZE_BYTES];
+  replica replicas_[BUNDLE_TIMESTAMP_NUMA_NODES];
+
+  // The node is looked up once per thread. A thread that migrates afterwards
+  // still reads a valid, if remote, replica.
+  static inline int local_node() {
+    static thread_local int node = -1;
+    if (node < 0) {
+      unsigned cpu = 0, numa = 0;
+      if (syscall(SYS_getcpu, &cpu, &numa, nullptr) != 0) numa = 0;
+      node = numa % BUNDLE_TIMESTAMP_NUMA_NODES;
+    }
+    return node;
+  }
+
+ public:
+  void init() {
+    epoch_ = BUNDLE_MIN_TIMESTAMP;
+    for (int i = 0; i < BUNDLE_TIMESTAMP_NUMA_NODES; ++i) {
+      replicas_[i].ts = BUNDLE_MIN_TIMESTAMP;
+    }
+  }
+
+  inline timestamp_t current() {
+    return epoch_.load(std::memory_order_seq_cst);
+  }
+
+  // An update that reads a replica before a range query publishes the next
+  // epoch there is ordered before that range query, which will then observe
+  // its pending bundles. The fence orders the pending stores before the read.
+  inline timestamp_t next_update_ts(const int tid) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return replicas_[local_node()].ts.load(std::memory_order_seq_cst);
+  }
+
+  // Claims the current epoch and publishes its successor to every replica
+  // before the range query reads any bundle.
+  inline timestamp_t next_rq_ts(const int tid) {
+    timestamp_t ts = epoch_.fetch_add(1, std::memory_order_seq_cst);
+    for (int i = 0; i < BUNDLE_TIMESTAMP_NUMA_NODES; ++i) {
+      timestamp_t curr = replicas_[i].ts.load(std::memory_order_seq_cst);
+      while (curr <= ts &&
+             !replicas_[i].ts.compare_exchange_weak(curr, ts + 1)) {
+      }
+    }
+    return ts;
+  }
+};
+
+#endif  // BUNDLE_BUNDLE_TIMESTAMP_H
@@ -1,339 +1,403 @@
+// Jacob Nelson
+//
+// This file implements a bundle as a ring buffer of entries. Entries are stored
+// contiguously so that range queries which must walk back several versions
+// touch adjacent memory, and updates only allocate when the ring is full.
+//
+// A full ring is never resized in place, since concurrent range queries may be
+// reading it. Instead, a new ring is allocated and the full one is linked
+// behind it as an immutable history that is retired once cleanup no longer
+// needs it. Rings are records of the enclosing data structure's record
+// manager, so they are reclaimed safely with respect to concurrent readers.
+//
+// Like LinkedBundle (without BUNDLE_LOCKFREE), updates and cleanup of a bundle
+// must be serialized by the lock of the node that contains it.
+
 #ifndef BUNDLE_CIRCULAR_BUNDLE_H
 #define BUNDLE_CIRCULAR_BUNDLE_H
 
 #include <pthread.h>
 #include <sys/types.h>
+
 #include <atomic>
-#include <mutex>
 
+#include "bundle_timestamp.h"
+#include "common_bundle.h"
 #include "plaf.h"
 #include "rq_debugging.h"
 
+#ifndef CPU_RELAX
 #define CPU_RELAX asm volatile("pause\n" ::: "memory")
-#define BUNDLE_INIT_CAPACITY 5
-
-// Valid bundle states:
-// ----------------------
-// NORMAL_STATE -- No operations being performed on bundle.
-// PENDING_STATE -- An update is pending.
-// RECLAIM_STATE -- Bundle entries are being reclaimed.
-// RQ_STATE -- A range query is reading the bundle.
-// PENDING_STATE | RESIZE_STATE -- A pending update is resizing the bundle.
-// PENDING_STATE | RECLAIM_STATE -- An update and cleanup are concurrent.
-// PENDING_STATE | RQ_STATE -- An update and range query are concurrent.
-// PENDING_STATE | RECLAIM_STATE | RQ_STATE -- An update, cleanup and rangequery
-// are concurrent. RECLAIM_STATE | RQ_STATE -- Cleanup and a range query are
-// concurrent.
-
-#define NORMAL_STATE 0
-#define PENDING_STATE 1
-#define RESIZE_STATE 2
-#define RECLAIM_STATE 4
-#define RQ_STATE (~7)
-
-#define DEBUG_PRINT(str)                         \
-  if ((i + 1) % 10000 == 0) {                    \
-    std::cout << str << std::endl << std::flush; \
-  }                                              \
-  ++i;
-
-enum op { NOP, INSERT, REMOVE };
-// Stores pointers to nodes and associated timestamps.
+#endif
+#ifndef likely
+#define likely(x) __builtin_expect((x), 1)
+#endif
+#ifndef unlikely
+#define unlikely(x) __builtin_expect((x), 0)
+#endif
 
+// Number of entries per ring.
+#ifndef BUNDLE_CIRCULAR_CAPACITY
+#define BUNDLE_CIRCULAR_CAPACITY 8
+#endif
+
+// Stores a pointer to a node and the timestamp at which it became valid.
 template <typename NodeType>
-class BundleEntry : public BundleEntryBase<NodeType> {};
+class CircularBundleSlot {
+ public:
+  std::atomic<timestamp_t> ts_;
+  std::atomic<NodeType *> ptr_;
+
+  // Reads a consistent (pointer, timestamp) pair. Fails if the slot is being
+  // written, which is only possible for the pending entry or if the reader is
+  // holding a stale index into a recycled slot.
+  inline bool read(NodeType **ptr, timestamp_t *ts) {
+    timestamp_t curr_ts = ts_.load(std::memory_order_acquire);
+    if (curr_ts == BUNDLE_PENDING_TIMESTAMP) return false;
+    NodeType *curr_ptr = ptr_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (ts_.load(std::memory_order_relaxed) != curr_ts) return false;
+    *ptr = curr_ptr;
+    *ts = curr_ts;
+    return true;
+  }
+
+  inline void write(NodeType *ptr) {
+    ts_.store(BUNDLE_PENDING_TIMESTAMP, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    ptr_.store(ptr, std::memory_order_relaxed);
+  }
+};
 
+// A ring of bundle entries. Live entries occupy the indices from base_ to
+// curr_ (inclusive, modulo the capacity).
 template <typename NodeType>
-class Bundle : public Bundle<NodeType> {
- private:
-  // The lower three bits are reserved for marking an ongoing update, resize or
-  // reclaimer. The remaining bits are devoted to keeping track of the number of
-  // concurrent range queries.
-  std::atomic<unsigned int> state_;
-  int volatile base_;      // Index of oldest entry.
-  int volatile curr_;      // Index of newest entry.
-  int volatile capacity_;  // Maximum number of entries.
-  // Entry array and metadata.
-  BundleEntry<NodeType> *volatile entries_;  // Bundle entry array
-
-#ifdef BUNDLE_DEBUG
-  int its_;
-  int last_base_;
-  int updates_;
-#endif
+class CircularBundleBuffer {
+ public:
+  std::atomic<int> base_;  // Index of oldest live entry.
+  std::atomic<int> curr_;  // Index of newest entry.
+  // The ring that was full when this one was allocated.
+  std::atomic<CircularBundleBuffer *> older_;
+  CircularBundleSlot<NodeType> slots_[BUNDLE_CIRCULAR_CAPACITY];
+
+  // Buffers are allocated by the record manager, which does not run
+  // constructors.
+  inline void init(CircularBundleBuffer *older) {
+    base_.store(0, std::memory_order_relaxed);
+    curr_.store(0, std::memory_order_relaxed);
+    older_.store(older, std::memory_order_relaxed);
+  }
 
-  inline void start_rq() {
-    unsigned int expected_state, upper, lower, new_state;
-    while (true) {
-      expected_state = state_ & ~RESIZE_STATE;
-      upper = expected_state >> 3;             // Get the upper bits of state.
-      lower = expected_state & 7;              // Get lower bits.
-      new_state = ((upper + 1) << 3) | lower;  // Increment number of rqs.
-      if (state_.compare_exchange_weak(expected_state, new_state)) {
-        assert(state_ & RQ_STATE && state_ & ~RESIZE_STATE);
-        break;
-      }
-    }
+  inline int size() {
+    return ((curr_ - base_ + BUNDLE_CIRCULAR_CAPACITY) %
+            BUNDLE_CIRCULAR_CAPACITY) +
+           1;
   }
 
-  inline void end_rq() {
-    unsigned int expected_state, upper, lower, new_state;
-    while (true) {
-      expected_state = state_ & ~RESIZE_STATE;
-      assert(state_ & RQ_STATE);
-      upper = expected_state >> 3;             // Get the upper bits of state.
-      lower = expected_state & 7;              // Get lower bits.
-      new_state = ((upper - 1) << 3) | lower;  // Increment number of rqs.
-      if (state_.compare_exchange_weak(expected_state, new_state)) {
-        break;
-      }
+  inline bool full() { return size() == BUNDLE_CIRCULAR_CAPACITY; }
+};
+
+template <typename NodeType>
+class CircularBundle {
+ private:
+  // Newest ring, or nullptr if the bundle has no entries.
+  std::atomic<CircularBundleBuffer<NodeType> *> buffer_;
+
+  // Moves (buf, idx) to the next older entry. Returns false if there is none.
+  static inline bool older(CircularBundleBuffer<NodeType> **buf, int *idx) {
+    if (*idx == (*buf)->base_.load(std::memory_order_acquire)) {
+      *buf = (*buf)->older_.load(std::memory_order_acquire);
+      if (*buf == nullptr) return false;
+      *idx = (*buf)->curr_.load(std::memory_order_acquire);
+    } else {
+      *idx = (*idx - 1 + BUNDLE_CIRCULAR_CAPACITY) % BUNDLE_CIRCULAR_CAPACITY;
     }
+    return true;
   }
 
-  // Doubles the capacity of the bundle. Only called when a new entry is added,
-  // meaning no updates will be lost although some cleanup may be missed.
-  void grow() {
-    unsigned int expected;
+  // Walks entries starting at (buf, idx) until one satisfies ts. Returns 1 on
+  // success, 0 if no entry satisfies ts and -1 if a recycled slot was read.
+  inline int getOlderPtrByTimestamp(int tid, CircularBundleBuffer<NodeType> *buf,
+                                    int idx, timestamp_t ts, NodeType **next) {
+    long long traversals = 0;
+    NodeType *ptr;
+    timestamp_t curr_ts;
     while (true) {
-      while (state_ & (RECLAIM_STATE | RQ_STATE))
-        ;  // Wait for a concurrent reclaimer or rq.
-      // Move state from pending to pending and resizing to block reclaimers and
-      // range queries.
-      expected = PENDING_STATE;
-      if (state_.compare_exchange_weak(expected, expected | RESIZE_STATE)) {
-        break;
-      }
+      if (!buf->slots_[idx].read(&ptr, &curr_ts)) return -1;
+      if (curr_ts <= ts) break;
+      if (!older(&buf, &idx)) return 0;
+      ++traversals;
     }
-    assert(state_ & (PENDING_STATE | RESIZE_STATE));
-
-    BundleEntry<NodeType> *new_entries =
-        new BundleEntry<NodeType>[capacity_ * 2];
-    int i = base_;
-    int end = curr_;
-    if (i > end) {
-      // Buffer wraps so take into account.
-      end = capacity_ + end;
-    }
-    for (; i <= end; ++i) {
-      // Copy entries to new array.
-      new_entries[i] = entries_[i % capacity_];
-      if (i >= capacity_) {
-        new_entries[i % capacity_] = entries_[i % capacity_];
+#ifdef __HANDLE_STATS
+    GSTATS_APPEND(tid, bundle_traversals, traversals);
+#endif
+    *next = ptr;
+    return 1;
+  }
+
+ public:
+  // Rings are owned by the record manager of the enclosing data structure and
+  // are returned through retireEntries() or deallocateEntries().
+  ~CircularBundle() {}
+
+  void init() { buffer_.store(nullptr, std::memory_order_relaxed); }
+
+  // Adds a pending entry at the head of the bundle, allocating a new ring only
+  // if the current one is full. Returns the number of rings allocated.
+  template <typename RecordManager>
+  inline int prepare(const int tid, NodeType *const ptr,
+                      RecordManager *const recmgr) {
+    CircularBundleBuffer<NodeType> *buf =
+        buffer_.load(std::memory_order_relaxed);
+    if (buf == nullptr || buf->full()) {
+      CircularBundleBuffer<NodeType> *new_buf =
+          recmgr->template allocate<CircularBundleBuffer<NodeType>>(tid);
+      if (new_buf == nullptr) {
+        std::cerr << "ERROR: out of memory" << std::endl;
+        exit(-1);
       }
+      new_buf->init(buf);
+      new_buf->slots_[0].write(ptr);
+      buffer_.store(new_buf, std::memory_order_release);
+      return 1;
     }
+    int idx = (buf->curr_.load(std::memory_order_relaxed) + 1) %
+              BUNDLE_CIRCULAR_CAPACITY;
+    buf->slots_[idx].write(ptr);
+    buf->curr_.store(idx, std::memory_order_release);
+    return 0;
+  }
 
-    // Finish the resize.
-    capacity_ = capacity_ * 2;
-    curr_ = end;
-    SOFTWARE_BARRIER;
-    BundleEntry<NodeType> *old_entries = entries_;  // Swap entry arrays.
-    entries_ = new_entries;
-    delete[] old_entries;
+  // Removes the pending entry. It was never visible to any range query, so a
+  // ring that only holds the pending entry is freed immediately.
+  template <typename RecordManager>
+  inline void abort(const int tid, RecordManager *const recmgr) {
+    CircularBundleBuffer<NodeType> *buf = buffer_;
+    int idx = buf->curr_;
+    assert(buf->slots_[idx].ts_ == BUNDLE_PENDING_TIMESTAMP);
+    if (idx == buf->base_) {
+      buffer_ = buf->older_.load();
+      recmgr->deallocate(tid, buf);
+      return;
+    }
+    buf->curr_ = (idx - 1 + BUNDLE_CIRCULAR_CAPACITY) % BUNDLE_CIRCULAR_CAPACITY;
+  }
 
-    state_.fetch_and(~RESIZE_STATE);
+  // Labels the pending entry to make it visible to range queries.
+  inline void finalize(timestamp_t ts) {
+    assert(ts != BUNDLE_PENDING_TIMESTAMP);
+    CircularBundleBuffer<NodeType> *buf = buffer_;
+    assert(buf->slots_[buf->curr_].ts_ == BUNDLE_PENDING_TIMESTAMP);
+    buf->slots_[buf->curr_].ts_.store(ts, std::memory_order_release);
   }
 
-  void shrink() {
-    // TODO: If the capacity is much larger than the number of valid entries, we
-    // may want to reduce the size.
+  inline bool getPtr(int tid, NodeType **next) {
+    NodeType *ptr;
+    timestamp_t ts;
+    bool first = true;
+    while (true) {
+      CircularBundleBuffer<NodeType> *buf =
+          buffer_.load(std::memory_order_acquire);
+      if (buf == nullptr) return false;
+      int idx = buf->curr_.load(std::memory_order_acquire);
+      if (buf->slots_[idx].read(&ptr, &ts)) break;
+      first = false;
+      CPU_RELAX;
+    }
+#ifdef __HANDLE_STATS
+    if (first) GSTATS_ADD(tid, bundle_first, 1);
+#endif
+    *next = ptr;
+    return true;
   }
 
- public:
-  ~Bundle() { delete[] entries_; }
-
-  void init() {
-    state_ = NORMAL_STATE;
-    base_ = 0;
-    curr_ = -1;
-    capacity_ = BUNDLE_INIT_CAPACITY;
-    entries_ = new BundleEntry<NodeType>[BUNDLE_INIT_CAPACITY];
+  // Returns a reference to the node that immediately followed at timestamp ts.
+  inline bool getPtrByTimestamp(int tid, timestamp_t ts, NodeType **next) {
+    long long retries = 0;
+    bool found = findPtrByTimestamp(tid, ts, next, &retries);
+#ifdef __HANDLE_STATS
+    if (retries > 0) GSTATS_APPEND(tid, bundle_retries, retries);
+#endif
+    return found;
   }
 
-  // Returns a reference to the node that satisfies the snapshot at the given
-  // timestamp. If all
-  inline NodeType *getPtrByTimestamp(timestamp_t ts) override {
-    // NOTE: Range queries may continuously block updaters from resizing, but
-    // this is expected to be common.
-    start_rq();
-
-    int i = curr_;
-    int end = base_;  // NOTE: We don't have to worry about the base changing
-                      // because we will always find our entry before the base,
-                      // or the base will not be changed.
-
-    // Locate first entry that satisfies snapshot, starting from newest.
-    NodeType *ptr = nullptr;
-    if (i != -1) {
-      // If an entry exists in this bundle.
-      if (end > i) {
-        // Buffer wraps so take into account.
-        i = capacity_ + i;
+  // Implements getPtrByTimestamp, counting the spins on a pending entry.
+  inline bool findPtrByTimestamp(int tid, timestamp_t ts, NodeType **next,
+                                 long long *retries) {
+    NodeType *ptr;
+    timestamp_t curr_ts;
+    int found;
+    while (true) {
+      CircularBundleBuffer<NodeType> *buf =
+          buffer_.load(std::memory_order_acquire);
+      if (buf == nullptr) return false;
+      int idx = buf->curr_.load(std::memory_order_acquire);
+
+      // Check if the newest entry satisfies the timestamp.
+      if (buf->slots_[idx].read(&ptr, &curr_ts)) {
+        if (curr_ts <= ts) {
+#ifdef __HANDLE_STATS
+          GSTATS_ADD(tid, bundle_first, 1);
+#endif
+          *next = ptr;
+          return true;
+        }
+        if (!older(&buf, &idx)) return false;
+        found = getOlderPtrByTimestamp(tid, buf, idx, ts, next);
+        if (found >= 0) return found;
+        continue;  // Read a recycled slot, so start over.
       }
-      for (; i >= end; --i) {
-        if (entries_[i % capacity_].ts_ <= ts) {
-          ptr = entries_[i % capacity_].ptr_;
-          break;
+
+      // The newest entry is pending. Its timestamp will be no smaller than the
+      // second entry's, so it can be skipped if that is already too new.
+      if (buf->slots_[idx].ts_.load(std::memory_order_acquire) ==
+              BUNDLE_PENDING_TIMESTAMP &&
+          older(&buf, &idx) && buf->slots_[idx].read(&ptr, &curr_ts)) {
+        if (BUNDLE_TIMESTAMP_IS_UNIQUE && curr_ts == ts) {
+#ifdef __HANDLE_STATS
+          GSTATS_ADD(tid, bundle_second, 1);
+#endif
+          *next = ptr;
+          return true;
+        } else if (curr_ts > ts) {
+#ifdef __HANDLE_STATS
+          GSTATS_ADD(tid, bundle_skip_first, 1);
+#endif
+          found = getOlderPtrByTimestamp(tid, buf, idx, ts, next);
+          if (found >= 0) return found;
+          continue;
         }
       }
+      CPU_RELAX;
+      ++(*retries);
     }
-
-    end_rq();
-    return ptr;
   }
 
-  inline void reclaimEntries(timestamp_t ts) {
-    unsigned int expected;
-    while (true) {
-      while (state_ & (RESIZE_STATE | RECLAIM_STATE))
-        ;  // Wait until resize is done.
-      expected = (state_ & ~RESIZE_STATE & ~RECLAIM_STATE);
-      // Move state to reclaim only if it is not resizing.
-      if (state_.compare_exchange_weak(expected, expected | RECLAIM_STATE)) {
-        break;
-      }
+  // Reclaims any entries that are older than the newest entry needed by a
+  // range query at ts. Slots of the newest ring are recycled by later updates.
+  // Older rings are retired once none of their entries are needed. Returns the
+  // number of rings reclaimed.
+  template <typename RecordManager>
+  inline int reclaimEntries(const int tid, timestamp_t ts,
+                             RecordManager *const recmgr) {
+    CircularBundleBuffer<NodeType> *buf = buffer_;
+    if (buf == nullptr) return 0;
+    int idx = buf->curr_;
+    // Ignore the newest entry if it is pending.
+    if (buf->slots_[idx].ts_ == BUNDLE_PENDING_TIMESTAMP &&
+        !older(&buf, &idx)) {
+      return 0;
     }
-    assert(state_ & (~RESIZE_STATE));
-    assert(state_ & RECLAIM_STATE);
-
-    int i = curr_;
-    int end = base_;
-    if (i == end || i == -1) {
-      state_.fetch_and(~RECLAIM_STATE);
-      return;
+    while (buf->slots_[idx].ts_ > ts) {
+      if (!older(&buf, &idx)) return 0;  // No reclaimable entry found.
     }
 
-    // Handle wrapping.
-    if (end > i) {
-      i = capacity_ + i;
+    // At this point, (buf, idx) is the oldest entry required by the given
+    // timestamp, so everything older than it can be reclaimed.
+    if (buf->base_ != idx) {
+      buf->base_.store(idx, std::memory_order_release);
     }
-
-    if (ts == BUNDLE_NULL_TIMESTAMP) {
-      // No active range queries.
-      base_ = curr_;
-      for (i = i - 1; i >= end; --i) {
-        entries_[i % capacity_].marked_ = true;
-      }
-    } else {
-      // Locate reclaimable entries.
-      bool set = false;
-      for (; i >= end; --i) {
-        if (entries_[i % capacity_].ts_ != BUNDLE_NULL_TIMESTAMP &&
-            entries_[i % capacity_].ts_ <= ts) {
-          // Found first entry to retire at index i - 1, so set base to i.
-          if (!set) {
-#ifdef BUNDLE_DEBUG
-            last_base_ = base_;
+    CircularBundleBuffer<NodeType> *curr = buf->older_;
+    if (curr == nullptr) return 0;
+    buf->older_.store(nullptr, std::memory_order_release);
+    CircularBundleBuffer<NodeType> *pred;
+    int reclaimed = 0;
+    while (curr != nullptr) {
+      pred = curr;
+      curr = curr->older_;
+#ifndef BUNDLE_CLEANUP_NO_FREE
+      recmgr->retire(tid, pred);
 #endif
-            base_ = i % capacity_;
-            assert(base_ >= 0);
-            assert(entries_[base_].marked_ == false);
-            set = true;
-          } else {
-            entries_[i % capacity_].marked_ = true;
-          }
-        }
-      }
+      ++reclaimed;
     }
-
-    state_.fetch_and(~RECLAIM_STATE);
+    return reclaimed;
   }
 
-  inline void prepare(NodeType *const ptr) {
-    unsigned int expected;
-    while (true) {
-      while (state_ & PENDING_STATE)
-        ;  // Wait for ongoing op to finish.
-      expected = state_ & ~PENDING_STATE;
-      if (state_.compare_exchange_weak(expected, expected | PENDING_STATE)) {
-        break;
-      }
-    }
-    assert(state_ & PENDING_STATE);
-
-    if (curr_ != -1 && (curr_ + 1) % capacity_ == base_) {
-      // Resize if we have run out of room.
-      grow();
+  // Retires every ring. Used when the owning node is retired. The rings are
+  // left linked because in-flight range queries may still read them. The
+  // caller must hold the node's lock to exclude concurrent cleanup. Returns
+  // the number of rings retired.
+  template <typename RecordManager>
+  inline int retireEntries(const int tid, RecordManager *const recmgr) {
+    CircularBundleBuffer<NodeType> *curr = buffer_;
+    CircularBundleBuffer<NodeType> *next;
+    int retired = 0;
+    while (curr != nullptr) {
+      next = curr->older_;
+      recmgr->retire(tid, curr);
+      curr = next;
+      ++retired;
     }
-    SOFTWARE_BARRIER;
-    entries_[(curr_ + 1) % capacity_].ptr_ = ptr;
+    return retired;
   }
 
-  inline void finalize(timestamp_t ts) {
-    // Assumes the bundles are in the pending state.
-    assert(state_ & PENDING_STATE && !(state_ & (RESIZE_STATE)));
-    assert(curr_ == -1 || (curr_ + 1) % capacity_ != base_);
-#ifdef BUNDLE_DEBUG
-    if (curr_ == -1) {
-      its_ = ts;
-      assert(its_ != 0);
+  // Immediately frees every ring. Only safe when no other thread can access
+  // the bundle (e.g., during data structure teardown).
+  template <typename RecordManager>
+  inline void deallocateEntries(const int tid, RecordManager *const recmgr) {
+    CircularBundleBuffer<NodeType> *curr = buffer_;
+    CircularBundleBuffer<NodeType> *next;
+    buffer_ = nullptr;
+    while (curr != nullptr) {
+      next = curr->older_;
+      recmgr->deallocate(tid, curr);
+      curr = next;
     }
-    ++updates_;
-#endif
-    entries_[(curr_ + 1) % capacity_].ts_ = ts;
-    entries_[(curr_ + 1) % capacity_].marked_ = false;
-    SOFTWARE_BARRIER;
-    curr_ = (curr_ + 1) % capacity_;
-    state_.fetch_and(~PENDING_STATE);
   }
 
-  // [UNSAFE]. Returns the number of entries in the bundle.
-  inline int size() override {
-    if (curr_ == -1) {
-      return 0;
-    } else if (base_ > curr_) {
-      return (capacity_ - base_) + curr_;
-    } else {
-      return curr_ - base_;
+  // [UNSAFE] Returns the number of bundle entries.
+  int size() {
+    int size = 0;
+    for (CircularBundleBuffer<NodeType> *buf = buffer_; buf != nullptr;
+         buf = buf->older_) {
+      size += buf->size();
     }
+    return size;
   }
 
-  NodeType *first(timestamp_t &ts) override {
-    // If the bundle has no entries, return nullptr.
-    if (curr_ == -1) {
-      ts = -1;
+  inline NodeType *first(timestamp_t &ts) {
+    CircularBundleBuffer<NodeType> *buf = buffer_;
+    if (buf == nullptr) {
+      ts = BUNDLE_NULL_TIMESTAMP;
       return nullptr;
     }
-    ts = entries_[curr_].ts_;
-    return entries_[curr_].ptr_;
+    ts = buf->slots_[buf->curr_].ts_;
+    return buf->slots_[buf->curr_].ptr_;
   }
 
-  // [UNSAFE]
-  std::pair<NodeType *, timestamp_t> *get(int &length) override {
+  // [UNSAFE] Returns all entries, newest first.
+  std::pair<NodeType *, timestamp_t> *get(int &length) {
+    int size = this->size();
     std::pair<NodeType *, timestamp_t> *retarr =
-        new std::pair<NodeType *, timestamp_t>[capacity_];
-    if (curr_ == -1) {
-      length = 0;
-      return retarr;
-    }
-    NodeType *ptr;
-    timestamp_t ts;
+        new std::pair<NodeType *, timestamp_t>[size];
     int pos = 0;
-    for (int i = base_; i <= (base_ > curr_ ? capacity_ + curr_ : curr_);
-         ++i, ++pos) {
-      ptr = entries_[i % capacity_].ptr_;
-      ts = entries_[i % capacity_].ts_;
-      retarr[pos] = std::pair<NodeType *, timestamp_t>(ptr, ts);
+    CircularBundleBuffer<NodeType> *buf = buffer_;
+    if (buf != nullptr) {
+      int idx = buf->curr_;
+      do {
+        retarr[pos++] = std::pair<NodeType *, timestamp_t>(
+            buf->slots_[idx].ptr_, buf->slots_[idx].ts_);
+      } while (pos < size && older(&buf, &idx));
     }
     length = pos;
     return retarr;
   }
 
-  string __attribute__((noinline)) dump(timestamp_t ts) override {
+  string __attribute__((noinline)) dump(timestamp_t ts) {
     std::stringstream ss;
     ss << "(ts=" << ts << ") : ";
-    long i = 0;
-    for (int i = 0; i < capacity_; ++i) {
-      ss << "<" << entries_[i].ts_ << "," << entries_[i].ptr_ << ","
-         << entries_[i].marked_ << ">"
-         << ", ";
+    for (CircularBundleBuffer<NodeType> *buf = buffer_; buf != nullptr;
+         buf = buf->older_) {
+      ss << "[base_=" << buf->base_ << ", curr_=" << buf->curr_ << "] ";
+      for (int i = 0; i < BUNDLE_CIRCULAR_CAPACITY; ++i) {
+        ss << "<" << buf->slots_[i].ts_ << "," << buf->slots_[i].ptr_ << ">"
+           << ", ";
+      }
+      ss << "-->";
     }
-    ss << " [curr_ = " << curr_ << ", base_ = " << base_
-#ifdef BUNDLE_DEBUG
-       << ", updates_ = " << updates_ << ", last_base_ = " << last_base_
-#endif
-       << "]" << std::endl;
+    ss << std::endl;
     return ss.str();
   }
 };
 
-#endif  // BUNDLE_CIRCULAR_BUNDLE_H
\ No newline at end of file
+#endif  // BUNDLE_CIRCULAR_BUNDLE_H
@@ -0,0 +1,308 @@
+// Jacob Nelson
+//
+// This file implements a bundle whose newest entry is stored inline, in the
+// node itself. Older entries are spilled to a linked list of bundle entries,
+// newest first. Since most range queries are satisfied by the newest entry,
+// this avoids dereferencing a separately allocated entry in the common case.
+//
+// The inline entry is read optimistically: a reader loads the timestamp, then
+// the pointer, then validates that the timestamp has not changed. An update
+// always moves the inline timestamp to BUNDLE_PENDING_TIMESTAMP before it
+// overwrites the pointer. Like LinkedBundle (without BUNDLE_LOCKFREE), updates
+// to a bundle must be serialized by the lock of the node that contains it.
+
+#ifndef BUNDLE_INLINE_BUNDLE_H
+#define BUNDLE_INLINE_BUNDLE_H
+
+#include <atomic>
+
+#include "bundle_timestamp.h"
+#include "common_bundle.h"
+#include "linked_bundle.h"
+#include "plaf.h"
+
+template <typename NodeType>
+class InlineBundle {
+ private:
+  // Newest entry. A timestamp of BUNDLE_NULL_TIMESTAMP denotes an empty bundle.
+  std::atomic<timestamp_t> ts_;
+  std::atomic<NodeType *> ptr_;
+  // Older entries, sorted from newest to oldest.
+  std::atomic<BundleEntry<NodeType> *> next_;
+
+  // Reads a consistent (pointer, timestamp) pair from the inline entry. Returns
+  // false if the inline entry is pending.
+  inline bool readInline(NodeType **ptr, timestamp_t *ts) {
+    timestamp_t curr_ts = ts_.load(std::memory_order_acquire);
+    if (curr_ts == BUNDLE_PENDING_TIMESTAMP) return false;
+    NodeType *curr_ptr = ptr_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (ts_.load(std::memory_order_relaxed) != curr_ts) return false;
+    *ptr = curr_ptr;
+    *ts = curr_ts;
+    return true;
+  }
+
+  // Follows the spilled entries to the first one satisfying ts.
+  inline bool getSpilledPtrByTimestamp(int tid, BundleEntry<NodeType> *curr,
+                                       timestamp_t ts, NodeType **next) {
+    long long traversals = 0;
+    while (curr != nullptr && curr->ts_ > ts) {
+      curr = curr->next_;
+      ++traversals;
+    }
+#ifdef __HANDLE_STATS
+    GSTATS_APPEND(tid, bundle_traversals, traversals);
+#endif
+    if (curr == nullptr) return false;
+    *next = curr->ptr_;
+    return true;
+  }
+
+ public:
+  // Spilled entries are owned by the record manager of the enclosing data
+  // structure and are returned through retireEntries() or deallocateEntries().
+  ~InlineBundle() {}
+
+  void init() {
+    ts_.store(BUNDLE_NULL_TIMESTAMP, std::memory_order_relaxed);
+    ptr_.store(nullptr, std::memory_order_relaxed);
+    next_.store(nullptr, std::memory_order_relaxed);
+  }
+
+  // Spills the current inline entry (if any) and makes the inline entry pending
+  // with the new pointer. The caller must hold the lock of the enclosing node.
+  // Returns the number of entries allocated (1 if an entry was spilled).
+  template <typename RecordManager>
+  inline int prepare(const int tid, NodeType *const ptr,
+                      RecordManager *const recmgr) {
+    timestamp_t curr_ts = ts_.load(std::memory_order_relaxed);
+    assert(curr_ts != BUNDLE_PENDING_TIMESTAMP);
+    int allocated = 0;
+    if (curr_ts != BUNDLE_NULL_TIMESTAMP) {
+      BundleEntry<NodeType> *spilled =
+          recmgr->template allocate<BundleEntry<NodeType>>(tid);
+      if (spilled == nullptr) {
+        std::cerr << "ERROR: out of memory" << std::endl;
+        exit(-1);
+      }
+      spilled->init(curr_ts, ptr_.load(std::memory_order_relaxed),
+                    next_.load(std::memory_order_relaxed));
+      // The spilled copy is visible before the inline entry becomes pending so
+      // that readers which observe the pending entry can skip it.
+      next_.store(spilled, std::memory_order_release);
+      allocated = 1;
+    }
+    ts_.store(BUNDLE_PENDING_TIMESTAMP, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    ptr_.store(ptr, std::memory_order_relaxed);
+    return allocated;
+  }
+
+  // Reverts a pending update. The pending entry was never visible to any range
+  // query, so the spilled copy of the previous entry is freed immediately.
+  template <typename RecordManager>
+  inline void abort(const int tid, RecordManager *const recmgr) {
+    assert(ts_.load() == BUNDLE_PENDING_TIMESTAMP);
+    BundleEntry<NodeType> *spilled = next_.load(std::memory_order_relaxed);
+    if (spilled == nullptr) {
+      ptr_.store(nullptr, std::memory_order_relaxed);
+      ts_.store(BUNDLE_NULL_TIMESTAMP, std::memory_order_release);
+      return;
+    }
+    ptr_.store(spilled->ptr_, std::memory_order_relaxed);
+    next_.store(spilled->next_.load(), std::memory_order_relaxed);
+    ts_.store(spilled->ts_.load(), std::memory_order_release);
+    recmgr->deallocate(tid, spilled);
+  }
+
+  // Labels the pending entry to make it visible to range queries.
+  inline void finalize(timestamp_t ts) {
+    assert(ts != BUNDLE_PENDING_TIMESTAMP);
+    assert(ts_.load() == BUNDLE_PENDING_TIMESTAMP);
+    ts_.store(ts, std::memory_order_release);
+  }
+
+  inline bool getPtr(int tid, NodeType **next) {
+    NodeType *ptr;
+    timestamp_t ts;
+    if (readInline(&ptr, &ts)) {
+#ifdef __HANDLE_STATS
+      GSTATS_ADD(tid, bundle_first, 1);
+#endif
+      *next = ptr;
+      return ts != BUNDLE_NULL_TIMESTAMP;
+    }
+    while (!readInline(&ptr, &ts)) {
+      CPU_RELAX;
+    }
+    *next = ptr;
+    return ts != BUNDLE_NULL_TIMESTAMP;
+  }
+
+  // Returns a reference to the node that immediately followed at timestamp ts.
+  inline bool getPtrByTimestamp(int tid, timestamp_t ts, NodeType **next) {
+    long long retries = 0;
+    NodeType *ptr;
+    timestamp_t curr_ts;
+    while (true) {
+      if (readInline(&ptr, &curr_ts)) {
+        if (curr_ts == BUNDLE_NULL_TIMESTAMP) return false;
+        if (curr_ts <= ts) {
+#ifdef __HANDLE_STATS
+          GSTATS_ADD(tid, bundle_first, 1);
+          if (retries > 0) GSTATS_APPEND(tid, bundle_retries, retries);
+#endif
+          *next = ptr;
+          return true;
+        }
+        break;  // The inline entry is too new.
+      }
+
+      // The inline entry is pending. Its timestamp will be no smaller than the
+      // newest spilled entry, so it can be skipped if that is already too new.
+      BundleEntry<NodeType> *second = next_.load(std::memory_order_acquire);
+      if (second != nullptr && ts_.load() == BUNDLE_PENDING_TIMESTAMP) {
+        timestamp_t second_ts = second->ts_;
+        if (BUNDLE_TIMESTAMP_IS_UNIQUE && second_ts == ts) {
+#ifdef __HANDLE_STATS
+          GSTATS_ADD(tid, bundle_second, 1);
+#endif
+          *next = second->ptr_;
+          return true;
+        } else if (second_ts > ts) {
+#ifdef __HANDLE_STATS
+          GSTATS_ADD(tid, bundle_skip_first, 1);
+#endif
+          return getSpilledPtrByTimestamp(tid, second, ts, next);
+        }
+      }
+      CPU_RELAX;
+      ++retries;
+    }
+#ifdef __HANDLE_STATS
+    if (retries > 0) GSTATS_APPEND(tid, bundle_retries, retries);
+#endif
+    // Every spilled entry is older than the inline entry that was just read.
+    return getSpilledPtrByTimestamp(
+        tid, next_.load(std::memory_order_acquire), ts, next);
+  }
+
+  // Reclaims any spilled entries that are older than the newest entry needed by
+  // a range query at ts. The inline entry is never reclaimed. Returns the
+  // number of entries reclaimed.
+  template <typename RecordManager>
+  inline int reclaimEntries(const int tid, timestamp_t ts,
+                             RecordManager *const recmgr) {
+    // Find the link to the first reclaimable entry. If the inline entry is
+    // final and satisfies ts, then every spilled entry is reclaimable.
+    std::atomic<BundleEntry<NodeType> *> *link = &next_;
+    timestamp_t head_ts = ts_.load(std::memory_order_acquire);
+    if (head_ts == BUNDLE_PENDING_TIMESTAMP || head_ts > ts) {
+      BundleEntry<NodeType> *pred = next_.load(std::memory_order_acquire);
+      while (pred != nullptr && pred->ts_ > ts) {
+        pred = pred->next_;
+      }
+      if (pred == nullptr) return 0;  // No reclaimable entry found.
+      link = &pred->next_;
+    }
+    BundleEntry<NodeType> *curr = link->load(std::memory_order_acquire);
+    if (curr == nullptr) return 0;
+    link->store(nullptr, std::memory_order_release);
+
+    // Reclaim old entries by traversing the chain starting from curr.
+    BundleEntry<NodeType> *pred;
+    int reclaimed = 0;
+    while (curr != nullptr) {
+      pred = curr;
+      curr = curr->next_;
+      pred->mark(ts);
+#ifndef BUNDLE_CLEANUP_NO_FREE
+      recmgr->retire(tid, pred);
+#endif
+      ++reclaimed;
+    }
+    return reclaimed;
+  }
+
+  // Retires every spilled entry. Used when the owning node is retired. The
+  // chain is left intact because in-flight range queries may still follow it.
+  // The caller must hold the node's lock to exclude concurrent cleanup.
+  // Returns the number of entries retired.
+  template <typename RecordManager>
+  inline int retireEntries(const int tid, RecordManager *const recmgr) {
+    BundleEntry<NodeType> *curr = next_;
+    BundleEntry<NodeType> *next;
+    int retired = 0;
+    while (curr != nullptr) {
+      next = curr->next_;
+      recmgr->retire(tid, curr);
+      curr = next;
+      ++retired;
+    }
+    return retired;
+  }
+
+  // Immediately frees every spilled entry. Only safe when no other thread can
+  // access the bundle (e.g., during data structure teardown).
+  template <typename RecordManager>
+  inline void deallocateEntries(const int tid, RecordManager *const recmgr) {
+    BundleEntry<NodeType> *curr = next_;
+    BundleEntry<NodeType> *next;
+    next_ = nullptr;
+    while (curr != nullptr) {
+      next = curr->next_;
+      recmgr->deallocate(tid, curr);
+      curr = next;
+    }
+  }
+
+  // [UNSAFE] Returns the number of bundle entries.
+  int size() {
+    int size = (ts_ != BUNDLE_NULL_TIMESTAMP ? 1 : 0);
+    BundleEntry<NodeType> *curr = next_;
+    while (curr != nullptr) {
+      ++size;
+      curr = curr->next_;
+    }
+    return size;
+  }
+
+  inline NodeType *first(timestamp_t &ts) {
+    ts = ts_;
+    return ptr_;
+  }
+
+  std::pair<NodeType *, timestamp_t> *get(int &length) {
+    int size = this->size();
+    std::pair<NodeType *, timestamp_t> *retarr =
+        new std::pair<NodeType *, timestamp_t>[size];
+    int pos = 0;
+    if (ts_ != BUNDLE_NULL_TIMESTAMP) {
+      retarr[pos++] = std::pair<NodeType *, timestamp_t>(ptr_, ts_);
+    }
+    BundleEntry<NodeType> *curr = next_;
+    while (curr != nullptr && pos < size) {
+      retarr[pos++] = std::pair<NodeType *, timestamp_t>(curr->ptr_, curr->ts_);
+      curr = curr->next_;
+    }
+    length = pos;
+    return retarr;
+  }
+
+  string __attribute__((noinline)) dump(timestamp_t ts) {
+    std::stringstream ss;
+    ss << "(ts=" << ts << ") : ";
+    ss << "(inline)<" << ts_ << "," << ptr_ << ">";
+    BundleEntry<NodeType> *curr = next_;
+    while (curr != nullptr) {
+      ss << "-->"
+         << "<" << curr->ts_ << "," << curr->ptr_ << "," << curr->next_ << ">";
+      curr = curr->next_;
+    }
+    ss << std::endl;
+    return ss.str();
+  }
+};
+
+#endif  // BUNDLE_INLINE_BUNDLE_H
@@ -2,6 +2,24 @@
 //
 // This file implements a bundle as a linked list of bundle entries. A bundle is
 // prepared by CASing the head of the bundle to a pending entry.
+//
+// With BUNDLE_LOCKFREE, the bundle is updated by lock-free data structures
+// (the bundled BST), where an update may be completed by any thread helping
+// it. The update allocates its pending entry with newEntry() before it owns
+// the guarded field (e.g., freezes its node), and every thread that completes
+// the update calls install(), agree() and finalize() in that order, before,
+// around and after the CAS that changes the field. A range query that meets a
+// pending head it cannot skip does not wait: getPtrByTimestamp() fails, and
+// the caller helps the update named by pendingOwner() before trying again.
+// Cleanup takes a per-bundle flag instead of the node's lock, and skips the
+// bundle if the flag is taken.
+//
+// install() only checks that the head is still the entry that the new entry
+// follows, so that entry must not be reclaimed (and reused as a later head)
+// while a helper may still call install(). The owner of the update therefore
+// calls release() once the update has committed, and cleanup keeps the
+// successor of an unreleased head. A helper that starts after the successor
+// is retired finds the update committed and does not call install().
 
 #ifndef BUNDLE_LINKED_BUNDLE_H
 #define BUNDLE_LINKED_BUNDLE_H
@@ -12,6 +30,7 @@
 #include <atomic>
 #include <mutex>
 
+#include "bundle_timestamp.h"
 #include "common_bundle.h"
 #include "plaf.h"
 #include "rq_debugging.h"
@@ -36,6 +55,12 @@ class BundleEntry {
   NodeType *ptr_;
   std::atomic<BundleEntry *> next_;
   volatile timestamp_t deleted_ts_;
+#ifdef BUNDLE_LOCKFREE
+  // Timestamp chosen by the threads completing the update that installs the
+  // entry, and an opaque reference to that update (e.g., its descriptor).
+  std::atomic<timestamp_t> lin_ts_;
+  std::atomic<uintptr_t> owner_;  // 0 once released (see release()).
+#endif
 
   BundleEntry() = delete;
   BundleEntry(timestamp_t ts, NodeType *ptr, BundleEntry *next)
@@ -45,6 +70,19 @@ class BundleEntry {
   }
   ~BundleEntry() {}
 
+  // Entries are allocated by the record manager, which does not run
+  // constructors, so every freshly allocated entry must be initialized here.
+  inline void init(timestamp_t ts, NodeType *ptr, BundleEntry *next) {
+    ts_.store(ts, std::memory_order_relaxed);
+    ptr_ = ptr;
+    next_.store(next, std::memory_order_relaxed);
+    deleted_ts_ = BUNDLE_NULL_TIMESTAMP;
+#ifdef BUNDLE_LOCKFREE
+    lin_ts_.store(ts, std::memory_order_relaxed);
+    owner_.store(0, std::memory_order_relaxed);
+#endif
+  }
+
   void set_ts(const timestamp_t ts) { ts_ = ts; }
   void set_ptr(NodeType *const ptr) { this->ptr_ = ptr; }
   void set_next(BundleEntry *const next) { next_ = next; }
@@ -64,6 +102,14 @@ class LinkedBundle {
  private:
   std::atomic<BundleEntry<NodeType> *> head_;
   // BundleEntry<NodeType> *volatile tail_;
+#ifdef BUNDLE_LOCKFREE
+  // Excludes concurrent cleanup of the bundle and its retirement with the
+  // node. See reclaimEntries() and retireEntries().
+  static const int CLEANUP_IDLE = 0;
+  static const int CLEANUP_BUSY = 1;
+  static const int CLEANUP_RETIRED = 2;
+  std::atomic<int> cleanup_;
+#endif
 
 #ifdef BUNDLE_DEBUG
   volatile int updates = 0;
@@ -72,42 +118,32 @@ class LinkedBundle {
 #endif
 
  public:
-  ~LinkedBundle() {
-    BundleEntry<NodeType> *curr = head_.load();
-    BundleEntry<NodeType> *next;
-    while (curr != nullptr) {
-      assert(curr != nullptr);
-      next = curr->next_;
-      delete curr;
-      curr = next;
-    }
-  }
-
-  void init() { head_ = nullptr; }
-
-  // Inserts a new rq_bundle_node at the head of the bundle.
-  inline void prepare(NodeType *const ptr) {
-    BundleEntry<NodeType> *new_entry =
-        new BundleEntry<NodeType>(BUNDLE_PENDING_TIMESTAMP, ptr, nullptr);
+  // Entries are owned by the record manager of the enclosing data structure.
+  // They are returned to it using either retireEntries() or
+  // deallocateEntries(), so there is nothing left to do here.
+  ~LinkedBundle() {}
 
+  void init() {
+    head_ = nullptr;
 #ifdef BUNDLE_LOCKFREE
-    while (true) {
-      BundleEntry<NodeType> *expected = head_;
-      if (expected->ts_ != BUNDLE_PENDING_TIMESTAMP &&
-          head_.compare_exchange_weak(expected, new_entry)) {
-        new_entry->next_ = expected;
-#ifdef BUNDLE_DEBUG
-        ++updates;
+    cleanup_ = CLEANUP_IDLE;
 #endif
-        return;
-      }
-      // long i = 0;
-      while (expected->ts_ == BUNDLE_PENDING_TIMESTAMP) {
-        // DEBUG_PRINT("insertAtHead");
-        CPU_RELAX;
-      }
+  }
+
+  // Inserts a new rq_bundle_node at the head of the bundle. The entry is drawn
+  // from the record manager so that it can be pooled and safely reclaimed.
+  // Returns the number of entries allocated.
+  template <typename RecordManager>
+  inline int prepare(const int tid, NodeType *const ptr,
+                      RecordManager *const recmgr) {
+    BundleEntry<NodeType> *new_entry =
+        recmgr->template allocate<BundleEntry<NodeType>>(tid);
+    if (new_entry == nullptr) {
+      std::cerr << "ERROR: out of memory" << std::endl;
+      exit(-1);
     }
-#else
+    new_entry->init(BUNDLE_PENDING_TIMESTAMP, ptr, nullptr);
+
     // Since we have a lock on this node presently, we are able to use a less
     // stringent memory order
     new_entry->next_.store(head_, std::memory_order_relaxed);
@@ -115,15 +151,17 @@ class LinkedBundle {
 #ifdef BUNDLE_DEBUG
     ++updates;
 #endif
-    return;
-#endif
+    return 1;
   }
 
-  inline void abort() {
-    assert(head_->ts_ == BUNDLE_PENDING_TIMESTAMP);
-    NodeType *entry = head_;
-    head_ = entry->ptr_;
-    delete entry;
+  // Removes the pending entry. It was never visible to any range query so it
+  // can be returned to the record manager immediately.
+  template <typename RecordManager>
+  inline void abort(const int tid, RecordManager *const recmgr) {
+    assert(head_.load()->ts_ == BUNDLE_PENDING_TIMESTAMP);
+    BundleEntry<NodeType> *entry = head_;
+    head_ = entry->next_.load();
+    recmgr->deallocate(tid, entry);
   }
 
   // Labels the pending entry to make it visible to range queries.
@@ -133,6 +171,78 @@ class LinkedBundle {
     head_.load()->ts_ = ts;
   }
 
+#ifdef BUNDLE_LOCKFREE
+  // Allocates a pending entry referencing ptr that follows the current head.
+  // The update may only take effect if the head is unchanged when it gains
+  // ownership of the guarded field (e.g., LLX/SCX guarantees this). owner_
+  // must be set before any other thread can see the entry. An entry that is
+  // never installed is returned with discard().
+  template <typename RecordManager>
+  inline BundleEntry<NodeType> *newEntry(const int tid, NodeType *const ptr,
+                                         RecordManager *const recmgr) {
+    BundleEntry<NodeType> *entry =
+        recmgr->template allocate<BundleEntry<NodeType>>(tid);
+    if (entry == nullptr) {
+      std::cerr << "ERROR: out of memory" << std::endl;
+      exit(-1);
+    }
+    entry->init(BUNDLE_PENDING_TIMESTAMP, ptr, head_.load());
+    return entry;
+  }
+
+  template <typename RecordManager>
+  inline void discard(const int tid, BundleEntry<NodeType> *const entry,
+                      RecordManager *const recmgr) {
+    recmgr->deallocate(tid, entry);
+  }
+
+  // Makes entry the head of the bundle. Only the first of the threads
+  // completing the update succeeds; the others find it installed.
+  inline void install(BundleEntry<NodeType> *const entry) {
+    BundleEntry<NodeType> *expected = entry->next_.load();
+    if (head_.compare_exchange_strong(expected, entry)) {
+#ifdef BUNDLE_DEBUG
+      ++updates;
+#endif
+    }
+  }
+
+  // Returns the linearization timestamp of the update that installed entry.
+  // ts is proposed by the caller, who must have taken it after install() and
+  // before attempting the update's CAS. The first proposal wins.
+  inline timestamp_t agree(BundleEntry<NodeType> *const entry,
+                           const timestamp_t ts) {
+    timestamp_t expected = BUNDLE_PENDING_TIMESTAMP;
+    if (entry->lin_ts_.compare_exchange_strong(expected, ts)) return ts;
+    return expected;
+  }
+
+  // Labels entry with the agreed timestamp once the update's CAS is done.
+  // Idempotent, so every thread completing the update may call it.
+  inline void finalize(BundleEntry<NodeType> *const entry,
+                       const timestamp_t ts) {
+    assert(ts != BUNDLE_PENDING_TIMESTAMP);
+    entry->ts_.store(ts);
+  }
+
+  // Called by the owner of the update that installed entry once the update has
+  // committed, and before the owner retires anything. Until then, cleanup
+  // keeps the entry that entry follows, which helpers still compare against
+  // the head in install().
+  inline void release(BundleEntry<NodeType> *const entry) {
+    assert(entry->ts_ != BUNDLE_PENDING_TIMESTAMP);
+    entry->owner_.store(0, std::memory_order_release);
+  }
+
+  // Returns the owner_ of the head if it is pending, or 0.
+  inline uintptr_t pendingOwner() {
+    BundleEntry<NodeType> *head = head_;
+    return (head != nullptr && head->ts_ == BUNDLE_PENDING_TIMESTAMP
+                ? head->owner_.load(std::memory_order_relaxed)
+                : 0);
+  }
+#endif
+
   inline bool getPtr(int tid, NodeType **next) {
     BundleEntry<NodeType> *curr = head_;
     timestamp_t curr_ts = curr->ts_;
@@ -172,7 +282,7 @@ class LinkedBundle {
     BundleEntry<NodeType> *second = curr->next_;
     if (second != nullptr) {
       timestamp_t second_ts = second->ts_;
-      if (second_ts == ts) {
+      if (BUNDLE_TIMESTAMP_IS_UNIQUE && second_ts == ts) {
 // Success!
 #ifdef __HANDLE_STATS
         GSTATS_ADD(tid, bundle_second, 1);
@@ -190,6 +300,23 @@ class LinkedBundle {
     }
 
     if (!skip_first) {
+#ifdef BUNDLE_LOCKFREE
+      // A pending head can only be skipped once its update has agreed on a
+      // timestamp newer than ts. Otherwise, the caller must help the update.
+      if (curr->ts_ == BUNDLE_PENDING_TIMESTAMP) {
+        timestamp_t lin_ts = curr->lin_ts_;
+        if (lin_ts == BUNDLE_PENDING_TIMESTAMP || lin_ts <= ts) {
+          if (curr->ts_ == BUNDLE_PENDING_TIMESTAMP) {
+#ifdef __HANDLE_STATS
+            GSTATS_ADD(tid, bundle_helped, 1);
+#endif
+            return false;
+          }
+        } else {
+          curr = curr->next_;
+        }
+      }
+#else
       long long retries = 0;
       while (curr->ts_ == BUNDLE_PENDING_TIMESTAMP) {
         CPU_RELAX;
@@ -198,6 +325,7 @@ class LinkedBundle {
 
 #ifdef __HANDLE_STATS
       GSTATS_APPEND(tid, bundle_retries, retries);
+#endif
 #endif
     }
 
@@ -225,19 +353,64 @@ class LinkedBundle {
   }
 
   // Reclaims any edges that are older than ts. At the moment this should be
-  // ordered before adding a new entry to the bundle.
-  inline void reclaimEntries(timestamp_t ts) {
+  // ordered before adding a new entry to the bundle. Unlinked entries are
+  // retired rather than freed, since a range query may still be reading them.
+  // Returns the number of entries reclaimed.
+  template <typename RecordManager>
+  inline int reclaimEntries(const int tid, timestamp_t ts,
+                            RecordManager *const recmgr) {
+#ifdef BUNDLE_LOCKFREE
+    // Skip the bundle if another thread is cleaning it or it was retired. If
+    // it is retired while being cleaned, retiring it is left to the cleaner.
+    int state = CLEANUP_IDLE;
+    if (!cleanup_.compare_exchange_strong(state, CLEANUP_BUSY)) return 0;
+    int reclaimed = unlinkEntries(tid, ts, recmgr);
+    state = CLEANUP_BUSY;
+    if (!cleanup_.compare_exchange_strong(state, CLEANUP_IDLE)) {
+      reclaimed += retireAll(tid, recmgr);
+    }
+    return reclaimed;
+#else
+    return unlinkEntries(tid, ts, recmgr);
+#endif
+  }
+
+  // Retires every entry of the bundle. Used when the owning node is retired, so
+  // the entries become reclaimable in the same epoch as the node itself. The
+  // head is left intact because in-flight range queries may still follow it.
+  // The caller must hold the node's lock to exclude concurrent cleanup, unless
+  // BUNDLE_LOCKFREE is defined. Returns the number of entries retired (with
+  // BUNDLE_LOCKFREE, entries left to a concurrent cleaner are counted by its
+  // reclaimEntries()).
+  template <typename RecordManager>
+  inline int retireEntries(const int tid, RecordManager *const recmgr) {
+#ifdef BUNDLE_LOCKFREE
+    if (cleanup_.fetch_or(CLEANUP_RETIRED) & CLEANUP_BUSY) return 0;
+#endif
+    return retireAll(tid, recmgr);
+  }
+
+ private:
+  template <typename RecordManager>
+  inline int unlinkEntries(const int tid, timestamp_t ts,
+                           RecordManager *const recmgr) {
     // Obtain a reference to the pred non-reclaimable entry and first
-    // reclaimable one. Ignore the first entry if it is pending or return if
-    // there is nothing to reclaim.
+    // reclaimable one. Ignore the first entry if it is pending (or, with
+    // BUNDLE_LOCKFREE, not yet released) or return if there is nothing to
+    // reclaim.
     BundleEntry<NodeType> *pred = head_;
-    if (pred == nullptr) return;
+    if (pred == nullptr) return 0;
+#ifdef BUNDLE_LOCKFREE
+    if (pred->ts_ == BUNDLE_PENDING_TIMESTAMP ||
+        pred->owner_.load(std::memory_order_acquire) != 0) {
+#else
     if (pred->ts_ == BUNDLE_PENDING_TIMESTAMP) {
+#endif
       pred = pred->next_;
-      if (pred == nullptr) return;
+      if (pred == nullptr) return 0;
     }
     BundleEntry<NodeType> *curr = pred->next_;
-    if (curr == nullptr) return;
+    if (curr == nullptr) return 0;
 
     // Traverse the list of entries until we find the first entry whose
     // timestamp is less than or equal to the timestamp of the oldest range
@@ -246,7 +419,7 @@ class LinkedBundle {
       pred = curr;
       curr = curr->next_;
     }
-    if (curr == nullptr) return;  // No reclaimable entry found.
+    if (curr == nullptr) return 0;  // No reclaimable entry found.
 
     // At this point, pred points to the oldest node required by the given
     // timestamp. Therefore, we know that the chain starting at curr is
@@ -260,13 +433,15 @@ class LinkedBundle {
 
     // Reclaim old entries by traversing the chain starting from curr.
     assert(curr != head_ && pred->next_ == nullptr);
+    int reclaimed = 0;
     while (curr != nullptr) {
       pred = curr;
       curr = curr->next_;
       pred->mark(ts);
 #ifndef BUNDLE_CLEANUP_NO_FREE
-      delete pred;
+      recmgr->retire(tid, pred);
 #endif
+      ++reclaimed;
     }
 #ifdef BUNDLE_DEBUG
     if (curr != nullptr) {
@@ -275,6 +450,36 @@ class LinkedBundle {
       exit(1);
     }
 #endif
+    return reclaimed;
+  }
+
+  template <typename RecordManager>
+  inline int retireAll(const int tid, RecordManager *const recmgr) {
+    BundleEntry<NodeType> *curr = head_;
+    BundleEntry<NodeType> *next;
+    int retired = 0;
+    while (curr != nullptr) {
+      next = curr->next_;
+      recmgr->retire(tid, curr);
+      curr = next;
+      ++retired;
+    }
+    return retired;
+  }
+
+ public:
+  // Immediately frees every entry of the bundle. Only safe when no other
+  // thread can access the bundle (e.g., during data structure teardown).
+  template <typename RecordManager>
+  inline void deallocateEntries(const int tid, RecordManager *const recmgr) {
+    BundleEntry<NodeType> *curr = head_;
+    BundleEntry<NodeType> *next;
+    head_ = nullptr;
+    while (curr != nullptr) {
+      next = curr->next_;
+      recmgr->deallocate(tid, curr);
+      curr = next;
+    }
   }
 
   // [UNSAFE] Returns the number of bundle entries.
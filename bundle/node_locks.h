@@ -0,0 +1,206 @@
+// Jacob Nelson
+//
+// This file implements the per-node lock policies of the lock-based bundled
+// data structures (the lazylist and the skiplist), which take the policy as a
+// template parameter. A policy is embedded in every node, so it must be small
+// and must be usable by a thread that holds many locks at once (batchUpdate()
+// locks every node it modifies). Each policy provides init(), acquire(),
+// tryAcquire() and release().
+//  - TASNodeLock (default) spins with test-and-test-and-set on a single word.
+//    It is the smallest, but under contention every waiter hammers the cache
+//    line of the node, which also holds its key and links.
+//  - MCSNodeLock queues waiters, each of which spins on its own cache line and
+//    is handed the lock in FIFO order. The node only stores the tail of the
+//    queue and the queue node of the holder.
+//  - HBONodeLock is a hierarchical backoff lock. The word records the NUMA node
+//    of the holder, and waiters on that node back off for less time than
+//    remote ones, so the lock (and the node's cache lines) tend to stay on one
+//    socket for a while.
+
+#ifndef BUNDLE_NODE_LOCKS_H
+#define BUNDLE_NODE_LOCKS_H
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "plaf.h"
+
+#ifndef CPU_RELAX
+#define CPU_RELAX asm volatile("pause\n" ::: "memory")
+#endif
+#ifndef likely
+#define likely(x) __builtin_expect((x), 1)
+#endif
+
+#ifndef BUNDLE_HBO_LOCAL_BACKOFF
+#define BUNDLE_HBO_LOCAL_BACKOFF 16
+#endif
+#ifndef BUNDLE_HBO_REMOTE_BACKOFF
+#define BUNDLE_HBO_REMOTE_BACKOFF 256
+#endif
+#ifndef BUNDLE_HBO_MAX_BACKOFF
+#define BUNDLE_HBO_MAX_BACKOFF 4096
+#endif
+
+class TASNodeLock {
+ private:
+  volatile int held_;
+
+ public:
+  void init() { held_ = 0; }
+
+  void acquire() {
+    while (true) {
+      if (likely(held_ == 0) &&
+          likely(__sync_bool_compare_and_swap(&held_, 0, 1))) {
+        return;
+      }
+      CPU_RELAX;
+    }
+  }
+
+  bool tryAcquire() {
+    return held_ == 0 && __sync_bool_compare_and_swap(&held_, 0, 1);
+  }
+
+  void release() {
+    SOFTWARE_BARRIER;
+    held_ = 0;
+  }
+};
+
+class MCSNodeLock {
+ private:
+  struct qnode {
+    qnode *volatile next;
+    volatile bool waiting;
+    qnode *free;  // next in the owning thread's free list
+    volatile char padding[PREFETCH_SIZE_BYTES];
+  };
+
+  qnode *volatile tail_;
+  qnode *holder_;  // only accessed by the holder
+
+  // Queue nodes are recycled through a per-thread free list, which grows to
+  // the largest number of locks the thread has held at once. They are never
+  // freed, since a thread may exit while another still reads its last node.
+  static inline qnode *&freeList() {
+    static thread_local qnode *head = nullptr;
+    return head;
+  }
+
+  static inline qnode *allocate() {
+    qnode *&head = freeList();
+    if (head == nullptr) return new qnode();
+    qnode *q = head;
+    head = q->free;
+    return q;
+  }
+
+  static inline void deallocate(qnode *q) {
+    qnode *&head = freeList();
+    q->free = head;
+    head = q;
+  }
+
+ public:
+  void init() {
+    tail_ = nullptr;
+    holder_ = nullptr;
+  }
+
+  void acquire() {
+    qnode *q = allocate();
+    q->next = nullptr;
+    q->waiting = true;
+    qnode *pred = __atomic_exchange_n(&tail_, q, __ATOMIC_ACQ_REL);
+    if (pred != nullptr) {
+      pred->next = q;
+      while (q->waiting) CPU_RELAX;
+    }
+    holder_ = q;
+    SOFTWARE_BARRIER;
+  }
+
+  bool tryAcquire() {
+    if (tail_ != nullptr) return false;
+    qnode *q = allocate();
+    q->next = nullptr;
+    if (__sync_bool_compare_and_swap(&tail_, nullptr, q)) {
+      holder_ = q;
+      return true;
+    }
+    deallocate(q);
+    return false;
+  }
+
+  void release() {
+    SOFTWARE_BARRIER;
+    qnode *q = holder_;
+    if (q->next == nullptr) {
+      if (__sync_bool_compare_and_swap(&tail_, q, nullptr)) {
+        deallocate(q);
+        return;
+      }
+      // A successor has swapped itself in but not yet linked behind q.
+      while (q->next == nullptr) CPU_RELAX;
+    }
+    q->next->waiting = false;
+    deallocate(q);
+  }
+};
+
+class HBONodeLock {
+ private:
+  volatile int owner_;  // 0 if free, otherwise 1 + the holder's NUMA node
+
+  // The node is looked up once per thread, as in NumaTimestamp. A thread that
+  // migrates afterwards is merely treated as remote more often.
+  static inline int localNode() {
+    static thread_local int node = -1;
+    if (node < 0) {
+      unsigned cpu = 0, numa = 0;
+      if (syscall(SYS_getcpu, &cpu, &numa, nullptr) != 0) numa = 0;
+      node = numa;
+    }
+    return node;
+  }
+
+ public:
+  void init() { owner_ = 0; }
+
+  void acquire() {
+    const int self = 1 + localNode();
+    int last = 0;
+    int backoff = 0;
+    while (true) {
+      int owner = owner_;
+      if (owner == 0) {
+        if (__sync_bool_compare_and_swap(&owner_, 0, self)) return;
+        continue;
+      }
+      // Restart from the local or remote delay whenever the lock changes
+      // sockets, then back off exponentially.
+      if (owner != last) {
+        backoff = (owner == self ? BUNDLE_HBO_LOCAL_BACKOFF
+                                 : BUNDLE_HBO_REMOTE_BACKOFF);
+        last = owner;
+      } else if (backoff < BUNDLE_HBO_MAX_BACKOFF) {
+        backoff *= 2;
+      }
+      for (int i = 0; i < backoff; ++i) CPU_RELAX;
+    }
+  }
+
+  bool tryAcquire() {
+    return owner_ == 0 &&
+           __sync_bool_compare_and_swap(&owner_, 0, 1 + localNode());
+  }
+
+  void release() {
+    SOFTWARE_BARRIER;
+    owner_ = 0;
+  }
+};
+
+#endif  // BUNDLE_NODE_LOCKS_H
@@ -0,0 +1,33 @@
+// Jacob Nelson
+//
+// This file defines the handle returned by openSnapshot() in the bundled data
+// structures. A snapshot pins a single timestamp in the range query
+// announcement array, so every read made against it (rangeQuery(), find() and
+// contains()) observes the same linearizable state, however many calls are
+// made and however much time passes between them. The snapshot is released by
+// closeSnapshot().
+//
+// The announcement slot and the record manager's epoch are per thread. While a
+// snapshot is open, its thread must therefore use only the overloads that take
+// the snapshot. An open snapshot also holds back bundle cleanup and memory
+// reclamation, so long-lived snapshots let bundles and limbo bags grow.
+//
+// findAt() reads a key at an explicit timestamp instead. A timestamp is
+// readable by a thread if the thread has a snapshot open that is no newer than
+// it, which keeps every bundle entry and node describing the timestamp, and if
+// it is no newer than the latest snapshot opened by any thread, so that no
+// update can still take effect at it. Readers can thus pin the oldest
+// timestamp they need with one snapshot and move between newer ones.
+
+#ifndef BUNDLE_SNAPSHOT_H
+#define BUNDLE_SNAPSHOT_H
+
+#include "common_bundle.h"
+
+struct BundleSnapshot {
+  timestamp_t ts = BUNDLE_NULL_TIMESTAMP;  // Null once closed.
+
+  bool isOpen() const { return ts != BUNDLE_NULL_TIMESTAMP; }
+};
+
+#endif  // BUNDLE_SNAPSHOT_H
@@ -0,0 +1,203 @@
+// Jacob Nelson
+//
+// This file implements the value history used by bundled data structures to
+// replace the value of an existing key in place. The node keeps its current
+// value in its own field, and the history keeps the versions that range queries
+// may still need, newest first. The history is empty until the value is first
+// replaced, so a node whose value never changes only pays for one pointer. An
+// empty history means that the current value is visible to every range query
+// that reaches the node.
+//
+// A replacement follows the same protocol as a bundle update: the new version
+// is made pending before the update takes its timestamp, and is labeled with
+// that timestamp afterwards. Like bundles, a history must only be modified
+// while holding the lock of the node that contains it.
+
+#ifndef BUNDLE_VALUE_HISTORY_H
+#define BUNDLE_VALUE_HISTORY_H
+
+#include <atomic>
+#include <cassert>
+#include <iostream>
+
+#include "bundle_timestamp.h"
+#include "common_bundle.h"
+#include "plaf.h"
+
+template <typename V>
+class ValueEntry {
+ public:
+  std::atomic<timestamp_t> ts_;
+  V val_;
+  std::atomic<ValueEntry *> next_;
+
+  // Entries are allocated by the record manager, which does not run
+  // constructors.
+  inline void init(timestamp_t ts, const V &val, ValueEntry *next) {
+    ts_.store(ts, std::memory_order_relaxed);
+    val_ = val;
+    next_.store(next, std::memory_order_relaxed);
+  }
+};
+
+template <typename V>
+class ValueHistory {
+ private:
+  std::atomic<ValueEntry<V> *> head_;
+
+  template <typename RecordManager>
+  static inline ValueEntry<V> *allocate(const int tid,
+                                        RecordManager *const recmgr) {
+    ValueEntry<V> *entry = recmgr->template allocate<ValueEntry<V>>(tid);
+    if (entry == nullptr) {
+      std::cerr << "ERROR: out of memory" << std::endl;
+      exit(-1);
+    }
+    return entry;
+  }
+
+ public:
+  void init() { head_.store(nullptr, std::memory_order_relaxed); }
+
+  // Makes new_val the pending newest version and stores it in *val, the
+  // current value of the node. If the history was empty, the value being
+  // replaced is recorded first. It is labeled with BUNDLE_MIN_TIMESTAMP since
+  // every range query that can reach the node observes it. Returns the number
+  // of versions allocated.
+  template <typename RecordManager>
+  inline int prepare(const int tid, V volatile *const val, const V &new_val,
+                      RecordManager *const recmgr) {
+    ValueEntry<V> *head = head_.load(std::memory_order_relaxed);
+    int allocated = 1;
+    if (head == nullptr) {
+      head = allocate(tid, recmgr);
+      const V curr_val = *val;
+      head->init(BUNDLE_MIN_TIMESTAMP, curr_val, nullptr);
+      ++allocated;
+    }
+    ValueEntry<V> *pending = allocate(tid, recmgr);
+    pending->init(BUNDLE_PENDING_TIMESTAMP, new_val, head);
+    head_.store(pending, std::memory_order_release);
+    // Readers that observe the new value must also observe the history.
+    std::atomic_thread_fence(std::memory_order_release);
+    *val = new_val;
+    return allocated;
+  }
+
+  // Labels the pending version with the timestamp of the update.
+  inline void finalize(timestamp_t ts) {
+    ValueEntry<V> *head = head_.load(std::memory_order_relaxed);
+    assert(head != nullptr && head->ts_ == BUNDLE_PENDING_TIMESTAMP);
+    head->ts_.store(ts, std::memory_order_release);
+  }
+
+  // Returns the value at timestamp ts, given the current value *val of the
+  // node.
+  inline V getByTimestamp(const int tid, V volatile *const val,
+                          timestamp_t ts) {
+    V curr_val = *val;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    ValueEntry<V> *curr = head_.load(std::memory_order_acquire);
+    if (curr == nullptr) return curr_val;
+
+    // A pending version will be labeled no older than the version below it, so
+    // it can be skipped if that version is already too new. The version below
+    // is only unlinked once curr has been finalized.
+    while (curr->ts_.load(std::memory_order_acquire) ==
+           BUNDLE_PENDING_TIMESTAMP) {
+      ValueEntry<V> *second = curr->next_.load(std::memory_order_acquire);
+      if (second != nullptr) {
+        timestamp_t second_ts = second->ts_;
+        if (second_ts > ts ||
+            (BUNDLE_TIMESTAMP_IS_UNIQUE && second_ts == ts)) {
+          curr = second;
+          break;
+        }
+      }
+      CPU_RELAX;
+    }
+    while (curr->ts_ > ts) {
+      curr = curr->next_;
+      assert(curr != nullptr);
+    }
+    return curr->val_;
+  }
+
+  // Reclaims the versions that are older than the newest one needed by a range
+  // query at ts. If that is the current version, the history is emptied.
+  // Returns the number of versions reclaimed.
+  template <typename RecordManager>
+  inline int reclaimEntries(const int tid, timestamp_t ts,
+                            RecordManager *const recmgr) {
+    ValueEntry<V> *head = head_.load(std::memory_order_acquire);
+    if (head == nullptr) return 0;
+    ValueEntry<V> *curr;
+    if (head->ts_ <= ts) {
+      // The pending timestamp is never satisfied, so head is final.
+      head_.store(nullptr, std::memory_order_release);
+      curr = head;
+    } else {
+      ValueEntry<V> *pred = head->next_;
+      while (pred != nullptr && pred->ts_ > ts) {
+        pred = pred->next_;
+      }
+      if (pred == nullptr) return 0;
+      curr = pred->next_;
+      if (curr == nullptr) return 0;
+      pred->next_.store(nullptr, std::memory_order_release);
+    }
+
+    // Readers that already hold a reclaimed version are protected by the
+    // record manager.
+    int reclaimed = 0;
+    while (curr != nullptr) {
+      ValueEntry<V> *next = curr->next_;
+#ifndef BUNDLE_CLEANUP_NO_FREE
+      recmgr->retire(tid, curr);
+#endif
+      curr = next;
+      ++reclaimed;
+    }
+    return reclaimed;
+  }
+
+  // Retires every version. Used when the owning node is erased. The chain is
+  // left intact because in-flight range queries may still follow it. Returns
+  // the number of versions retired.
+  template <typename RecordManager>
+  inline int retireEntries(const int tid, RecordManager *const recmgr) {
+    ValueEntry<V> *curr = head_;
+    int retired = 0;
+    while (curr != nullptr) {
+      ValueEntry<V> *next = curr->next_;
+      recmgr->retire(tid, curr);
+      curr = next;
+      ++retired;
+    }
+    return retired;
+  }
+
+  // Immediately frees every version. Only safe when no other thread can access
+  // the history (e.g., during data structure teardown).
+  template <typename RecordManager>
+  inline void deallocateEntries(const int tid, RecordManager *const recmgr) {
+    ValueEntry<V> *curr = head_;
+    head_ = nullptr;
+    while (curr != nullptr) {
+      ValueEntry<V> *next = curr->next_;
+      recmgr->deallocate(tid, curr);
+      curr = next;
+    }
+  }
+
+  // [UNSAFE] Returns the number of versions.
+  int size() {
+    int size = 0;
+    for (ValueEntry<V> *curr = head_; curr != nullptr; curr = curr->next_) {
+      ++size;
+    }
+    return size;
+  }
+};
+
+#endif  // BUNDLE_VALUE_HISTORY_H
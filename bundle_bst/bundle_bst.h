@@ -34,6 +34,15 @@
 #endif
 #include "rq_provider.h"
 
+// Updates are completed by helpers, so bundles must support helping (see
+// linked_bundle.h) and cannot be cleaned under a node's lock.
+#if !defined(BUNDLE_LINKED_BUNDLE) || !defined(BUNDLE_LOCKFREE)
+#error bundle_bst requires BUNDLE_LINKED_BUNDLE and BUNDLE_LOCKFREE
+#endif
+#ifdef BUNDLE_CLEANUP_DIRTY
+#error bundle_bst does not support BUNDLE_CLEANUP_DIRTY
+#endif
+
 using namespace std;
 
 namespace bundle_bst_ns {
@@ -147,6 +156,10 @@ class bundle_bst {
                   Node<K, V> *newNode, Node<K, V> *const *const insertedNodes,
                   Node<K, V> *const *const deletedNodes);
   inline int computeSize(Node<K, V> *node);
+  inline Node<K, V> *readBundle(const int tid,
+                                BUNDLE_TYPE_DECL<Node<K, V>> *const bundle,
+                                const timestamp_t ts);
+  void cleanupSubtree(const int tid, Node<K, V> *subtree, const timestamp_t ts);
 
   long long debugKeySum(Node<K, V> *node);
   bool validate(Node<K, V> *const node, const int currdepth,
@@ -233,18 +246,9 @@ class bundle_bst {
     Node<K, V> *_root = initializeNode(tid, allocateNode(tid), NO_KEY, NO_VALUE,
                                        rootleft, NULL);
 
-    // need to simulate real insertion of root and the root's child,
-    // since range queries will actually try to add these nodes,
-    // and we don't want blocking rq providers to spin forever
-    // waiting for their itimes to be set to a positive number.
-    Node<K, V> *insertedNodes[] = {_root, rootleft, NULL};
-    Node<K, V> *deletedNodes[] = {NULL};
-
-    BUNDLE_TYPE_DECL<Node<K, V>> *bundles[] = {&(_root->left_bundle), nullptr};
-    Node<K, V> *ptrs[] = {rootleft, nullptr};
-    rqProvider->prepare_bundles(bundles, ptrs);
-    timestamp_t ts = rqProvider->linearize_update_at_write(tid, &root, _root);
-    rqProvider->finalize_bundles(bundles, tid);
+    // initializeNode() has given every bundle of the sentinels an entry that
+    // all range queries observe.
+    rqProvider->linearize_update_at_write(tid, &root, _root);
   }
 
   Node<K, V> *debug_getEntryPoint() { return root; }
@@ -275,6 +279,9 @@ class bundle_bst {
       dfsDeallocateBottomUp(u->right, numNodes);
     }
     MEMORY_STATS++(*numNodes);
+    BUNDLE_TYPE_DECL<Node<K, V>> *bundles[] = {&u->left_bundle,
+                                                &u->right_bundle, nullptr};
+    rqProvider->deallocate_bundles(0 /* tid */, bundles);
     recmgr->deallocate(0 /* tid */, u);
   }
   ~bundle_bst() {
@@ -285,12 +292,17 @@ class bundle_bst {
     // aborted. they have to be collected and freed only once, since they can be
     // pointed to by many nodes. so, we keep them in a set, then free each set
     // element at the end.
+    rqProvider->stopCleanup();
     int numNodes = 0;
     dfsDeallocateBottomUp(root, &numNodes);
     VERBOSE DEBUG COUTATOMIC(" deallocated nodes " << numNodes << endl);
     for (int tid = 0; tid < recmgr->NUM_PROCESSES; ++tid) {
       for (int i = 0; i < MAX_NODES; ++i) {
-        recmgr->deallocate(tid, GET_ALLOCATED_NODE_PTR(tid, i));
+        Node<K, V> *u = GET_ALLOCATED_NODE_PTR(tid, i);
+        BUNDLE_TYPE_DECL<Node<K, V>> *bundles[] = {&u->left_bundle,
+                                                    &u->right_bundle, nullptr};
+        rqProvider->deallocate_bundles(tid, bundles);
+        recmgr->deallocate(tid, u);
       }
     }
     delete[] allocatedNodes;
@@ -312,6 +324,12 @@ class bundle_bst {
   bool contains(const int tid, const K &key);
   int size(void); /** warning: size is a LINEAR time operation, and does not
                      return consistent results with concurrency **/
+  // Reclaims bundle entries that no active range query needs. Called by the
+  // background cleanup workers.
+  void cleanup(int tid, int worker = 0, int num_workers = 1);
+  // Checks that the newest entry of every bundle matches its child pointer.
+  // Only meaningful when no update is in progress.
+  bool validateBundles(int tid);
 
   /**
    * BEGIN FUNCTIONS FOR RANGE QUERY SUPPORT
@@ -421,6 +439,10 @@ class bundle_bst {
   string getBundleStatsString() {
     return "getBundleStatsString not implemented";
   }
+
+  // Sampled bundle and cleanup statistics (see bundle_telemetry.h).
+  string getBundleTelemetryString() { return rqProvider->telemetry_string(); }
+  void resetBundleTelemetry() { rqProvider->reset_telemetry(); }
 };
 
 }  // namespace bundle_bst_ns
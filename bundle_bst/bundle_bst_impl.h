@@ -81,91 +81,97 @@ bool bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::contains(
   return result.second;
 }
 
+// Returns the child referenced by bundle at ts. A pending head whose update
+// must be observed is completed by helping its SCX, which then finalizes the
+// entry, rather than by waiting for the thread that performs the SCX.
+template <class K, class V, class Compare, class RecManager>
+inline bundle_bst_ns::Node<K, V>
+    *bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::readBundle(
+        const int tid, BUNDLE_TYPE_DECL<Node<K, V>> *const bundle,
+        const timestamp_t ts) {
+  Node<K, V> *next;
+  while (!bundle->getPtrByTimestamp(tid, ts, &next)) {
+    tagptr_t owner = bundle->pendingOwner();
+    if (owner != 0) helpOther(tid, owner);
+  }
+  return next;
+}
+
 template <class K, class V, class Compare, class RecManager>
 int bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::rangeQuery(
     const int tid, const K &lo, const K &hi, K *const resultKeys,
     V *const resultValues) {
   block<Node<K, V>> stack(NULL);
-  recmgr->leaveQuiescentState(tid, true);
-  timestamp_t ts = rqProvider->start_traversal(tid);
-
-  // Phase 1. Pre-range traversal
-  Node<K, V> *prev = root;
-  Node<K, V> *curr = root->left;
-  Node<K, V> *left, *right;
-  bool is_left_child = false;
-  bool ok;
   while (true) {
-    while (curr != nullptr) {
-      if (curr->key != this->NO_KEY && !cmp(curr->key, lo) &&
-          !cmp(hi, curr->key)) {
-        break;
-      } else if (curr->key != this->NO_KEY && !cmp(hi, curr->key)) {
-        // curr is larger than hi, go left
-        prev = curr;
-        curr = rqProvider->read_addr(tid, &curr->right);
-        is_left_child = false;
-      } else if (curr->key == this->NO_KEY || cmp(lo, curr->key)) {
-        // curr is lower than lo, go right
-        prev = curr;
-        curr = rqProvider->read_addr(tid, &curr->left);
-        is_left_child = true;
-      } else {
-        assert(false);
-      }
-    }
+    recmgr->leaveQuiescentState(tid, true);
 
-    // Phase 2. Enter range
-    if (is_left_child) {
-      // curr = prev->left_bundle->getPtrByTimestamp(ts);
-      ok = prev->left_bundle.getPtrByTimestamp(ts, &curr);
-    } else {  // curr = prev->right_bundle->getPtrByTimestamp(ts);
-      ok = prev->right_bundle.getPtrByTimestamp(ts, &curr);
+    // Phase 1. Search for the root of the subtree containing the range.
+    Node<K, V> *prev = root;
+    Node<K, V> *curr = rqProvider->read_addr(tid, &root->left);
+    Node<K, V> *left, *right;
+    bool is_left_child = true;
+    while (rqProvider->read_addr(tid, &curr->left) != NULL &&
+           !isInRange(curr->key, lo, hi)) {
+      prev = curr;
+      is_left_child = (curr->key == NO_KEY || cmp(hi, curr->key));
+      curr = rqProvider->read_addr(
+          tid, (is_left_child ? &curr->left : &curr->right));
     }
 
-    if (!ok) {
+    // Phase 2. Enter the snapshot. The keys of the range are routed through
+    // prev as long as it is in the tree, so prev must not have been removed
+    // by ts. Removals mark the node before taking their timestamp.
+    timestamp_t ts = rqProvider->start_traversal(tid);
+    if (prev->marked.load(memory_order_relaxed)) {
+#ifdef __HANDLE_STATS
+      GSTATS_ADD(tid, bundle_restarts, 1);
+#endif
       rqProvider->end_traversal(tid);
       recmgr->enterQuiescentState(tid);
       continue;
     }
+    curr = readBundle(
+        tid, (is_left_child ? &prev->left_bundle : &prev->right_bundle), ts);
+
+    // Phase 3. Descend to the root of the subtree containing the range, as of
+    // ts.
+    while ((left = readBundle(tid, &curr->left_bundle, ts)) != nullptr &&
+           !isInRange(curr->key, lo, hi)) {
+      if (curr->key == NO_KEY || cmp(hi, curr->key)) {
+        curr = left;
+      } else {
+        curr = readBundle(tid, &curr->right_bundle, ts);
+      }
+    }
 
-    if (curr == nullptr) {
-      rqProvider->end_traversal(tid);
-      recmgr->enterQuiescentState(tid);
-      return 0;
-    } else {
-      // Phase 3. Range collect
-      // depth first traversal (of interesting subtrees)
-      int size = 0;
-      stack.push(curr);
-      while (!stack.isEmpty()) {
-        Node<K, V> *node = stack.pop();
-        assert(node);
-
-        ok = node->left_bundle.getPtrByTimestamp(ts, &left);
-        assert(ok);
-        // if internal node, explore its children
-        if (left != nullptr) {
-          if (node->key != this->NO_KEY && !cmp(hi, node->key)) {
-            ok = node->right_bundle.getPtrByTimestamp(ts, &right);
-            assert(ok);
-            assert(right);
-            stack.push(right);
-          }
-          if (node->key == this->NO_KEY || cmp(lo, node->key)) {
-            assert(left);
-            stack.push(left);
-          }
-          // else if leaf node, check if we should add its key to the traversal
-        } else {
-          rqProvider->traversal_try_add(tid, node, resultKeys, resultValues,
-                                        &size, lo, hi);
+    // Phase 4. Range collect
+    // depth first traversal (of interesting subtrees)
+    int size = 0;
+    stack.push(curr);
+    while (!stack.isEmpty()) {
+      Node<K, V> *node = stack.pop();
+      assert(node);
+
+      left = readBundle(tid, &node->left_bundle, ts);
+      // if internal node, explore its children
+      if (left != nullptr) {
+        if (node->key != this->NO_KEY && !cmp(hi, node->key)) {
+          right = readBundle(tid, &node->right_bundle, ts);
+          assert(right);
+          stack.push(right);
+        }
+        if (node->key == this->NO_KEY || cmp(lo, node->key)) {
+          stack.push(left);
         }
+        // else if leaf node, check if we should add its key to the traversal
+      } else {
+        rqProvider->traversal_try_add(tid, node, resultKeys, resultValues,
+                                      &size, lo, hi);
       }
-      rqProvider->end_traversal(tid);
-      recmgr->enterQuiescentState(tid);
-      return size;
     }
+    rqProvider->end_traversal(tid);
+    recmgr->enterQuiescentState(tid);
+    return size;
   }
 }
 
@@ -356,44 +362,16 @@ inline bool bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::
                                    GET_ALLOCATED_NODE_PTR(tid, 1), NULL};
     Node<K, V> *deletedNodes[] = {NULL};
 
-    // Prepare the bundles
+    // The bundles of the new nodes were filled in by initializeNode(), and
+    // scx() adds the entry for A1 to the bundle of p.
     //
     //         [p]                        [p]
     //         / \                       */ \
     //       [l]  ()          -->      [A1]  ()
-    //                                */ *\
+    //                                 / \
     //                               [l]  [A0]
-
-    BUNDLE_TYPE_DECL<Node<K, V>> *bundles[] = {
-        (l == pleft) ? &p->left_bundle : &p->right_bundle,
-        &GET_ALLOCATED_NODE_PTR(tid, 0)->left_bundle,
-        &GET_ALLOCATED_NODE_PTR(tid, 0)->right_bundle,
-        &GET_ALLOCATED_NODE_PTR(tid, 1)->left_bundle,
-        &GET_ALLOCATED_NODE_PTR(tid, 1)->right_bundle,
-        nullptr};
-    Node<K, V> *ptrs[] = {
-        nullptr,
-        nullptr,
-        (l->key == NO_KEY || cmp(key, l->key)) ? GET_ALLOCATED_NODE_PTR(tid, 0)
-                                               : l,
-        (l->key == NO_KEY || cmp(key, l->key)) ? l
-                                               : GET_ALLOCATED_NODE_PTR(tid, 0),
-        GET_ALLOCATED_NODE_PTR(tid, 1),
-        nullptr};
-    rqProvider->prepare_bundles(bundles, ptrs);
-    timestamp_t ts = rqProvider->get_update_lin_time(tid);
-
-    bool retval =
-        scx(tid, info, (l == pleft ? &p->left : &p->right),
-            GET_ALLOCATED_NODE_PTR(tid, 1), insertedNodes, deletedNodes);
-
-    rqProvider->finalize_bundles(bundles, ts);
-
-// #ifndef NDEBUG
-//     l->validate();
-// #endif
-
-    return retval;
+    return scx(tid, info, (l == pleft ? &p->left : &p->right),
+               GET_ALLOCATED_NODE_PTR(tid, 1), insertedNodes, deletedNodes);
   }
 }
 
@@ -465,37 +443,22 @@ inline bool bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::
     assert(s);
     assert(l);
 
-    // Prepare the bundles.
-    //
-    // The first bundles to replace are the newly allocated node that replaces
-    // the parent of the leaf being removed. Since the parent is just a routing
-    // node, we replace it with the sibling. It's also necessary to preapre the
-    // grandparent, whose child is CAS'ed to finalize the SCX operation.
+    // The parent of the leaf being removed is just a routing node, so it is
+    // replaced by a copy s' of the sibling. The bundles of s' were filled in
+    // by initializeNode(), and scx() adds the entry for s' to the bundle of
+    // the grandparent, whose child is CAS'ed to finalize the SCX operation.
     //
     //      [gp]                    [gp]
-    //        \                       *\                        
+    //        \                       *\
     //        [p]       ==>           [s']
-    //        / \                    */ *\                      
+    //        / \                     / \
     //      [s] [l]                  ()  ()
-    //      / \                                              
+    //      / \
     //     () ()
-
-    BUNDLE_TYPE_DECL<Node<K, V>> *bundles[] = {
-        p == gpleft ? &gp->left_bundle : &gp->right_bundle,
-        &GET_ALLOCATED_NODE_PTR(tid, 0)->left_bundle,
-        &GET_ALLOCATED_NODE_PTR(tid, 0)->right_bundle, nullptr};
-    Node<K, V> *ptrs[] = {sleft, sright, GET_ALLOCATED_NODE_PTR(tid, 0), NULL};
-    rqProvider->prepare_bundles(bundles, ptrs);
-    timestamp_t ts = rqProvider->get_update_lin_time(tid);
-
     Node<K, V> *insertedNodes[] = {GET_ALLOCATED_NODE_PTR(tid, 0), NULL};
     Node<K, V> *deletedNodes[] = {p, s, l, NULL};
-    bool retval =
-        scx(tid, info, (p == gpleft ? &gp->left : &gp->right),
-            GET_ALLOCATED_NODE_PTR(tid, 0), insertedNodes, deletedNodes);
-
-    rqProvider->finalize_bundles(bundles, ts);
-    return retval;
+    return scx(tid, info, (p == gpleft ? &gp->left : &gp->right),
+               GET_ALLOCATED_NODE_PTR(tid, 0), insertedNodes, deletedNodes);
   }
 }
 
@@ -514,8 +477,12 @@ bundle_bst_ns::Node<K, V>
   rqProvider->write_addr(tid, &newnode->right, right);
   newnode->scxRecord.store((uintptr_t)DUMMY_SCXRECORD, memory_order_relaxed);
   newnode->marked.store(false, memory_order_relaxed);
-  newnode->left_bundle.init();
-  newnode->right_bundle.init();
+  // The node can only be reached through bundle entries no older than the
+  // update that publishes it, so its children are valid at every timestamp.
+  // Entries left by an earlier, aborted attempt are freed, since the node was
+  // never published.
+  rqProvider->reset_bundle(tid, &newnode->left_bundle, left);
+  rqProvider->reset_bundle(tid, &newnode->right_bundle, right);
   return newnode;
 }
 
@@ -556,10 +523,14 @@ void bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::
       for (int i = 0; i < info->numberOfNodesAllocated; ++i) {
         REPLACE_ALLOCATED_NODE(tid, i);
       }
-      //            // nodes[1], nodes[2], ..., nodes[nNodes-1] are now retired
-      //            for (int j=0;j<info->numberOfNodesToReclaim;++j) {
-      //                recmgr->retire(tid, nodes[1+j]);
-      //            }
+      // nodes[1], nodes[2], ..., nodes[nNodes-1] were retired by the thread
+      // whose update CAS succeeded. Their bundles are retired here, exactly
+      // once. The nodes are marked, so their bundles never change again.
+      for (int j = 0; j < info->numberOfNodesToReclaim; ++j) {
+        BUNDLE_TYPE_DECL<Node<K, V>> *bundles[] = {
+            &nodes[1 + j]->left_bundle, &nodes[1 + j]->right_bundle, nullptr};
+        rqProvider->retire_bundles(tid, bundles);
+      }
     } else {
       assert(state >= state_aborted); /* is ABORTED */
     }
@@ -599,6 +570,16 @@ bool bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::scx(
   newdesc->c.numberOfNodes = (char)info->numberOfNodes;
   newdesc->c.numberOfNodesToFreeze = (char)info->numberOfNodesToFreeze;
 
+  // The entry for newNode in the bundle guarding field. It follows the head
+  // that the bundle had when nodes[0] was LLXed, which is still the head if
+  // nodes[0] gets frozen for this SCX. See help().
+  BUNDLE_TYPE_DECL<Node<K, V>> *bundle =
+      (field == &info->nodes[0]->left ? &info->nodes[0]->left_bundle
+                                      : &info->nodes[0]->right_bundle);
+  BundleEntry<Node<K, V>> *entry = rqProvider->new_entry(tid, bundle, newNode);
+  newdesc->c.bundle = bundle;
+  newdesc->c.entry = entry;
+
   // note: writes equivalent to the following two are already done by
   // DESC1_NEW()
   // rec->state.store(SCXRecord<K,V>::STATE_INPROGRESS, memory_order_relaxed);
@@ -606,8 +587,23 @@ bool bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::scx(
   DESC1_INITIALIZED(tid);  // mark descriptor as being in a consistent state
 
   SOFTWARE_BARRIER;
-  int state = help(tid, TAGPTR1_NEW(tid, newdesc->c.mutables), newdesc, false);
+  tagptr_t tagptr = TAGPTR1_NEW(tid, newdesc->c.mutables);
+  entry->owner_ = tagptr;
+  int state = help(tid, tagptr, newdesc, false);
   info->state = state;  // rec->state.load(memory_order_relaxed);
+  if (state & SCXRecord<K, V>::STATE_COMMITTED) {
+    // Helpers that read the state before the commit may still call install(),
+    // so the entry's successor is kept until now (see LinkedBundle).
+    bundle->release(entry);
+#ifdef BUNDLE_CLEANUP_UPDATE
+    rqProvider->reclaim_bundle(tid, bundle,
+                               rqProvider->get_cached_oldest_active_rq(tid));
+#endif
+  } else {
+    // Helpers only touch the entry once every node is frozen, and then the
+    // SCX cannot abort, so the entry was never installed.
+    rqProvider->discard_entry(tid, bundle, entry);
+  }
   reclaimMemoryAfterSCX(tid, info);
   return state & SCXRecord<K, V>::STATE_COMMITTED;
 }
@@ -686,11 +682,30 @@ int bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::help(
         true, memory_order_relaxed);  // finalize all but first node
   }
 
+  // Install the bundle entry for the new sub-tree and agree on its
+  // timestamp, which must be taken before the update CAS and published after
+  // it. Every helper does this, so neither range queries nor updates wait for
+  // the owner. The entry may be reclaimed once the SCX is committed, so it is
+  // only accessed while the SCX is in progress. (After that, the update CAS
+  // below fails anyway.) Cleanup keeps the head that install() compares
+  // against until the owner sees the commit and releases the entry, so it
+  // cannot be reused while a helper that read INPROGRESS is running.
+  bool succ;
+  int state = DESC1_READ_FIELD(succ, ptr->c.mutables, tagptr,
+                               MUTABLES_MASK_STATE, MUTABLES_OFFSET_STATE);
+  if (!succ || state != SCXRecord<K, V>::STATE_INPROGRESS) {
+    return SCXRecord<K, V>::STATE_COMMITTED;
+  }
+  snap->c.bundle->install(snap->c.entry);
+  timestamp_t ts = snap->c.bundle->agree(
+      snap->c.entry, rqProvider->get_update_lin_time(tid));
+
   // CAS in the new sub-tree (update CAS)
   //    uintptr_t expected = (uintptr_t) snap->nodes[1];
   rqProvider->linearize_update_at_cas(tid, snap->c.field, snap->c.nodes[1],
                                       snap->c.newNode, snap->c.insertedNodes,
                                       snap->c.deletedNodes);
+  snap->c.bundle->finalize(snap->c.entry, ts);
 
   // todo: add #ifdef CASing scx record pointers to set an "invalid" bit,
   // and add to llx a test that determines whether a pointer is invalid.
@@ -809,3 +824,80 @@ void *bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::llx(
                                           << " key=" << node->key << ")\n");
   return NULL;  // fail
 }
+
+// Bundles are cleaned without locking nodes: a bundle that is being cleaned or
+// was retired with its node is skipped (see LinkedBundle::reclaimEntries()).
+// Leaves are skipped too, since their bundles never gain entries.
+template <class K, class V, class Compare, class RecManager>
+void bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::cleanupSubtree(
+    const int tid, Node<K, V> *subtree, const timestamp_t ts) {
+  block<Node<K, V>> stack(NULL);
+  stack.push(subtree);
+  while (!stack.isEmpty()) {
+    Node<K, V> *node = stack.pop();
+    Node<K, V> *left = rqProvider->read_addr(tid, &node->left);
+    Node<K, V> *right = rqProvider->read_addr(tid, &node->right);
+    if (left == NULL) continue;
+    stack.push(left);
+    if (right != NULL) stack.push(right);
+    rqProvider->reclaim_bundle(tid, &node->left_bundle, ts);
+    rqProvider->reclaim_bundle(tid, &node->right_bundle, ts);
+  }
+}
+
+template <class K, class V, class Compare, class RecManager>
+void bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::cleanup(
+    int tid, int worker, int num_workers) {
+  recmgr->leaveQuiescentState(tid, true);
+  BUNDLE_INIT_CLEANUP(rqProvider);
+  // As in the citrus tree, nodes above the split depth are cleaned by the
+  // first worker, and the subtrees rooted at the split depth are dealt out to
+  // the workers in order.
+  const int split =
+      (BUNDLE_CLEANUP_SPLIT_DEPTH < 8 ? BUNDLE_CLEANUP_SPLIT_DEPTH : 8);
+  block<Node<K, V>> level(NULL);
+  block<Node<K, V>> next(NULL);
+  level.push(root);
+  for (int depth = 0; depth < split && !level.isEmpty(); ++depth) {
+    while (!level.isEmpty()) {
+      Node<K, V> *node = level.pop();
+      Node<K, V> *left = rqProvider->read_addr(tid, &node->left);
+      Node<K, V> *right = rqProvider->read_addr(tid, &node->right);
+      if (left == NULL) continue;
+      next.push(left);
+      if (right != NULL) next.push(right);
+      if (worker == 0) {
+        BUNDLE_CLEAN_BUNDLE(node->left_bundle);
+        BUNDLE_CLEAN_BUNDLE(node->right_bundle);
+      }
+    }
+    while (!next.isEmpty()) level.push(next.pop());
+  }
+  for (int subtree = 0; !level.isEmpty(); ++subtree) {
+    Node<K, V> *node = level.pop();
+    if (subtree % num_workers == worker) cleanupSubtree(tid, node, ts);
+  }
+  recmgr->enterQuiescentState(tid);
+}
+
+template <class K, class V, class Compare, class RecManager>
+bool bundle_bst_ns::bundle_bst<K, V, Compare, RecManager>::validateBundles(
+    int tid) {
+  bool valid = true;
+  block<Node<K, V>> stack(NULL);
+  stack.push(root);
+  while (!stack.isEmpty()) {
+    Node<K, V> *node = stack.pop();
+    timestamp_t ts;
+    if (node->left_bundle.first(ts) != node->left ||
+        node->right_bundle.first(ts) != node->right) {
+      std::cout << "Pointer mismatch! [key=" << node->key << "] "
+                << node->left_bundle.dump(0) << node->right_bundle.dump(0)
+                << std::flush;
+      valid = false;
+    }
+    if (node->left != NULL) stack.push(node->left);
+    if (node->right != NULL) stack.push(node->right);
+  }
+  return valid;
+}
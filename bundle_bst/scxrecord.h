@@ -19,6 +19,11 @@
 #include "descriptors.h"
 using namespace std;
 
+template <typename NodeType>
+class BundleEntry;
+template <typename NodeType>
+class LinkedBundle;
+
 namespace bundle_bst_ns {
 
     template <class K, class V>
@@ -153,6 +158,11 @@ namespace bundle_bst_ns {
                 // for rqProvider
                 Node<K,V> * insertedNodes[MAX_NODES+1];
                 Node<K,V> * deletedNodes[MAX_NODES+1];
+
+                // for the bundle of nodes[0] that guards field, and the entry
+                // that installs newNode in it (see bundle_bst::help())
+                LinkedBundle<Node<K,V> > * bundle;
+                BundleEntry<Node<K,V> > * entry;
             } __attribute__((packed)) c; // WARNING: be careful with atomicity because of packed attribute!!! (this means no atomic vars smaller than word size, and all atomic vars must start on a word boundary when fields are packed tightly)
             char bytes[PREFETCH_SIZE_BYTES]; // set size to prevent false sharing
         };
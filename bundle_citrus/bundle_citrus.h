@@ -46,17 +46,43 @@ using namespace std;
 
 //#define INSERT_REPLACE
 
+#ifdef BUNDLE_CITRUS_PACKED_NODE
+// Nodes start on a cache line. The fields read by searches (key, children and
+// value) come first, followed by the bundles, so a traversal that switches
+// from child[] to rqbundle[] usually finds the bundle on a line it has already
+// fetched. The lock deliberately shares the node's lines instead of getting one
+// of its own: an update that locks a node writes its children, tags or mark
+// anyway, so a separate line would only cost the update another miss.
+template <typename K, typename V>
+struct alignas(BYTES_IN_CACHE_LINE) node_t {
+  K key;
+  node_t<K, V>* volatile child[2];
+  volatile V value;
+  BUNDLE_TYPE_DECL<node_t<K, V>> rqbundle[2];
+  volatile int lock;
+  int tag[2];
+  bool marked;
+#ifdef BUNDLE_CLEANUP_DIRTY
+  volatile bool dirty;  // in a dirty log; protected by lock
+#endif
+  ValueHistory<V> vals;  // older values; modified while holding lock
+#else
 template <typename K, typename V>
 struct node_t {
   struct {
     K key;
-    V value;
+    volatile V value;
     node_t<K, V>* volatile child[2];
     int tag[2];
     volatile int lock;
     bool marked;
+#ifdef BUNDLE_CLEANUP_DIRTY
+    volatile bool dirty;  // in a dirty log; protected by lock
+#endif
   };
   BUNDLE_TYPE_DECL<node_t<K, V>> rqbundle[2];
+  ValueHistory<V> vals;  // older values; modified while holding lock
+#endif
 
   ~node_t() {}
 
@@ -109,12 +135,24 @@ class bundle_citrustree {
     if (u->child[0]) dfsDeallocateBottomUp(u->child[0], numNodes);
     if (u->child[1]) dfsDeallocateBottomUp(u->child[1], numNodes);
     MEMORY_STATS++(*numNodes);
+    BUNDLE_TYPE_DECL<node_t<K, V>>* bundles[] = {&u->rqbundle[0],
+                                                 &u->rqbundle[1], nullptr};
+    rqProvider->deallocate_bundles(0 /* tid */, bundles);
+    rqProvider->deallocate_values(0 /* tid */, &u->vals);
     recordmgr->deallocate(0 /* tid */, u);
     // delete u;
   }
 
   const V doInsert(const int tid, const K& key, const V& value,
                    bool onlyIfAbsent);
+  inline void cleanupNode(const int tid, nodeptr node, const timestamp_t ts);
+  nodeptr bulkLoadSubtree(const int tid, const K* const keys,
+                          const V* const values, const long long lo,
+                          const long long hi);
+  void cleanupSubtree(const int tid, nodeptr subtree, const timestamp_t ts);
+  template <typename Visitor>
+  int snapshotVisit(const int tid, const timestamp_t ts, const K& lo,
+                    const K& hi, Visitor&& visit);
   int init[MAX_TID_POW2] = {
       0,
   };
@@ -128,12 +166,45 @@ class bundle_citrustree {
   const V insert(const int tid, const K& key, const V& value);
   const V insertIfAbsent(const int tid, const K& key, const V& value);
   const pair<V, bool> erase(const int tid, const K& key);
+  // Fills an empty tree with the n pairs in keys and values, which must be
+  // sorted by key without duplicates. The tree is perfectly balanced and every
+  // bundle gets a single entry at BUNDLE_MIN_TIMESTAMP. No other thread may
+  // access the tree meanwhile.
+  void bulkLoad(const int tid, const K* const keys, const V* const values,
+                const long long n);
   const pair<V, bool> find(const int tid, const K& key);
   int rangeQuery(const int tid, const K& lo, const K& hi, K* const resultKeys,
                  V* const resultValues);
-  void cleanup(int tid);
+  // Passes each pair in [lo, hi] of a linearizable snapshot to
+  // visit(key, value) in ascending key order, without materializing the result
+  // set. Stops once visit returns false. Returns the number of pairs visited.
+  template <typename Visitor>
+  int rangeQueryVisit(const int tid, const K& lo, const K& hi, Visitor&& visit);
+  // Like rangeQuery(), but returns only the (at most) k smallest keys in the
+  // range. The traversal ends as soon as k keys have been found.
+  int rangeQueryLimit(const int tid, const K& lo, const K& hi, const int k,
+                      K* const resultKeys, V* const resultValues);
+  // Opens a snapshot that the overloads below read repeatedly until it is
+  // closed (see snapshot.h).
+  BundleSnapshot openSnapshot(const int tid);
+  void closeSnapshot(const int tid, BundleSnapshot& s);
+  bool contains(const int tid, const K& key, const BundleSnapshot& s);
+  const pair<V, bool> find(const int tid, const K& key,
+                           const BundleSnapshot& s);
+  int rangeQuery(const int tid, const K& lo, const K& hi, K* const resultKeys,
+                 V* const resultValues, const BundleSnapshot& s);
+  // Returns the value that key had at timestamp ts, which must be readable by
+  // the calling thread (see snapshot.h).
+  const pair<V, bool> findAt(const int tid, const K& key, const timestamp_t ts);
+  void cleanup(int tid, int worker = 0, int num_workers = 1);
+#ifdef BUNDLE_CLEANUP_DIRTY
+  void cleanupDirty(int tid, nodeptr node, timestamp_t ts);
+#endif
   void startCleanup() { rqProvider->startCleanup(); }
   void stopCleanup() { rqProvider->stopCleanup(); }
+  // Sampled bundle and cleanup statistics (see bundle_telemetry.h).
+  string getBundleTelemetryString() { return rqProvider->telemetry_string(); }
+  void resetBundleTelemetry() { rqProvider->reset_telemetry(); }
   bool contains(const int tid, const K& key);
   int size();  // warning: this is a linear time operation, and is not
                // linearizable
@@ -156,6 +227,20 @@ class bundle_citrustree {
     return 1;
   }
 
+  // Like getKeys(), but returns the value that node had at timestamp ts.
+  inline int getKeys(const int tid, node_t<K, V>* node, K* const outputKeys,
+                     V* const outputValues, timestamp_t ts) {
+    if (node->key >= NO_KEY) return 0;
+    outputKeys[0] = node->key;
+    outputValues[0] = getValue(tid, node, ts);
+    return 1;
+  }
+
+  // Returns the value that node had at timestamp ts.
+  inline V getValue(const int tid, node_t<K, V>* node, timestamp_t ts) {
+    return node->vals.getByTimestamp(tid, &node->value, ts);
+  }
+
   bool isInRange(const K& key, const K& lo, const K& hi) {
     return (key != NO_KEY && lo <= key && key <= hi);
   }
@@ -59,9 +59,13 @@ nodeptr bundle_citrustree<K, V, RecManager>::newNode(const int tid, K key,
   nnode->tag[0] = 0;
   nnode->tag[1] = 0;
   nnode->value = value;
+  nnode->vals.init();
   nnode->lock = false;
   nnode->rqbundle[0].init();
   nnode->rqbundle[1].init();
+#ifdef BUNDLE_CLEANUP_DIRTY
+  nnode->dirty = false;
+#endif
 #ifdef __HANDLE_STATS
   GSTATS_APPEND(tid, node_allocated_addresses, ((long long)nnode) % (1 << 12));
 #endif
@@ -104,7 +108,7 @@ bundle_citrustree<K, V, RecManager>::bundle_citrustree(
       &_root->rqbundle[0], &_root->rqbundle[1], &_rootchild->rqbundle[0],
       &_rootchild->rqbundle[1], nullptr};
   nodeptr ptrs[] = {_rootchild, nullptr, nullptr, nullptr, nullptr};
-  rqProvider->prepare_bundles(bundles, ptrs);
+  rqProvider->prepare_bundles(tid, bundles, ptrs);
 
   // Perform linearization point.
   timestamp_t lin_time =
@@ -121,8 +125,11 @@ bundle_citrustree<K, V, RecManager>::bundle_citrustree(
 template <typename K, typename V, class RecManager>
 bundle_citrustree<K, V, RecManager>::~bundle_citrustree() {
   int numNodes = 0;
-  delete rqProvider;
+  // Bundle entries are freed through the provider, so it must outlive the
+  // traversal.
+  rqProvider->stopCleanup();
   dfsDeallocateBottomUp(root, &numNodes);
+  delete rqProvider;
   VERBOSE DEBUG COUTATOMIC(" deallocated nodes " << numNodes << endl);
   recordmgr->printStatus();
   delete recordmgr;
@@ -131,6 +138,37 @@ bundle_citrustree<K, V, RecManager>::~bundle_citrustree() {
 #endif
 }
 
+template <typename K, typename V, class RecManager>
+void bundle_citrustree<K, V, RecManager>::bulkLoad(const int tid,
+                                                   const K* const keys,
+                                                   const V* const values,
+                                                   const long long n) {
+  nodeptr rootchild = root->child[0];
+  if (rootchild->child[0] != NULL) {
+    cerr << "ERROR: bulkLoad() requires an empty tree" << endl;
+    exit(-1);
+  }
+  nodeptr subtree = bulkLoadSubtree(tid, keys, values, 0, n);
+  rqProvider->reset_bundle(tid, &rootchild->rqbundle[0], subtree);
+  rootchild->child[0] = subtree;
+}
+
+// Builds a perfectly balanced subtree from the pairs in [lo, hi).
+template <typename K, typename V, class RecManager>
+nodeptr bundle_citrustree<K, V, RecManager>::bulkLoadSubtree(
+    const int tid, const K* const keys, const V* const values,
+    const long long lo, const long long hi) {
+  if (lo >= hi) return NULL;
+  const long long mid = lo + (hi - lo) / 2;
+  assert(mid == lo || keys[mid - 1] < keys[mid]);
+  nodeptr node = newNode(tid, keys[mid], values[mid]);
+  node->child[0] = bulkLoadSubtree(tid, keys, values, lo, mid);
+  node->child[1] = bulkLoadSubtree(tid, keys, values, mid + 1, hi);
+  rqProvider->reset_bundle(tid, &node->rqbundle[0], node->child[0]);
+  rqProvider->reset_bundle(tid, &node->rqbundle[1], node->child[1]);
+  return node;
+}
+
 template <typename K, typename V, class RecManager>
 const pair<V, bool> bundle_citrustree<K, V, RecManager>::find(const int tid,
                                                               const K& key) {
@@ -263,12 +301,23 @@ retry:
       recordmgr->enterQuiescentState(tid);
       assert(result != NO_VALUE);
       return result;
-    } else {
-      std::cerr << "In place updates are not supported by bundle_citrus_impl "
-                   "at this time..."
-                << std::endl;
-      exit(1);
     }
+    // Replace the value in place. Only the node itself is locked, since its
+    // links are unchanged.
+    acquireLock(&(curr->lock));
+    if (curr->marked) {
+      releaseLock(&(curr->lock));
+      recordmgr->enterQuiescentState(tid);
+      goto retry;
+    }
+    V result = curr->value;
+    rqProvider->update_value(tid, &curr->vals, &curr->value, value);
+    BUNDLE_TYPE_DECL<node_t<K, V>>* dirtyBundles[] = {
+        &curr->rqbundle[0], &curr->rqbundle[1], nullptr};
+    rqProvider->mark_dirty(tid, curr, dirtyBundles);
+    releaseLock(&(curr->lock));
+    recordmgr->enterQuiescentState(tid);
+    return result;
   }
 
   acquireLock(&(prev->lock));
@@ -281,7 +330,7 @@ retry:
         &nnode->rqbundle[0], &nnode->rqbundle[1], &prev->rqbundle[direction],
         nullptr};
     nodeptr ptrs[] = {nullptr, nullptr, nnode, nullptr};
-    rqProvider->prepare_bundles(bundles, ptrs);
+    rqProvider->prepare_bundles(tid, bundles, ptrs);
 
     // Perform linearization.
     timestamp_t lin_time = rqProvider->linearize_update_at_write(
@@ -289,6 +338,9 @@ retry:
 
     // Finalize the bundles.
     rqProvider->finalize_bundles(bundles, lin_time);
+    BUNDLE_TYPE_DECL<node_t<K, V>>* dirtyBundles[] = {
+        &prev->rqbundle[0], &prev->rqbundle[1], nullptr};
+    rqProvider->mark_dirty(tid, prev, dirtyBundles);
 
     releaseLock(&(nnode->lock));
     releaseLock(&(prev->lock));
@@ -354,7 +406,7 @@ retry:
                                                  &curr->rqbundle[0],
                                                  &curr->rqbundle[1], nullptr};
     nodeptr ptrs[] = {curr->child[1], root->child[0], root->child[0], nullptr};
-    rqProvider->prepare_bundles(bundles, ptrs);
+    rqProvider->prepare_bundles(tid, bundles, ptrs);
 
     // Perform linearization.
     timestamp_t lin_time = rqProvider->linearize_update_at_write(
@@ -363,8 +415,13 @@ retry:
     // Finalize bundles.
     rqProvider->finalize_bundles(bundles, lin_time);
 
-    nodeptr deletedNodes[] = {curr, nullptr};
-    rqProvider->physical_deletion_succeeded(tid, deletedNodes);
+    BUNDLE_TYPE_DECL<node_t<K, V>>* dirtyBundles[] = {
+        &prev->rqbundle[0], &prev->rqbundle[1], nullptr};
+    rqProvider->mark_dirty(tid, prev, dirtyBundles);
+    BUNDLE_TYPE_DECL<node_t<K, V>>* deletedBundles[] = {
+        &curr->rqbundle[0], &curr->rqbundle[1], nullptr};
+    rqProvider->retire_node(tid, curr, deletedBundles);
+    rqProvider->retire_values(tid, &curr->vals);
 
     if (prev->child[direction] == NULL) {
       prev->tag[direction]++;
@@ -385,7 +442,7 @@ retry:
                                                  &curr->rqbundle[0],
                                                  &curr->rqbundle[1], nullptr};
     nodeptr ptrs[] = {curr->child[0], root->child[0], root->child[0], nullptr};
-    rqProvider->prepare_bundles(bundles, ptrs);
+    rqProvider->prepare_bundles(tid, bundles, ptrs);
 
     // Perform linearization.
     timestamp_t lin_time = rqProvider->linearize_update_at_write(
@@ -394,8 +451,13 @@ retry:
     // Finalize bundles.
     rqProvider->finalize_bundles(bundles, lin_time);
 
-    nodeptr deletedNodes[] = {curr, nullptr};
-    rqProvider->physical_deletion_succeeded(tid, deletedNodes);
+    BUNDLE_TYPE_DECL<node_t<K, V>>* dirtyBundles[] = {
+        &prev->rqbundle[0], &prev->rqbundle[1], nullptr};
+    rqProvider->mark_dirty(tid, prev, dirtyBundles);
+    BUNDLE_TYPE_DECL<node_t<K, V>>* deletedBundles[] = {
+        &curr->rqbundle[0], &curr->rqbundle[1], nullptr};
+    rqProvider->retire_node(tid, curr, deletedBundles);
+    rqProvider->retire_values(tid, &curr->vals);
 
     if (prev->child[direction] == NULL) {
       prev->tag[direction]++;
@@ -451,7 +513,7 @@ retry:
                       root->child[0],
                       (prevSucc != curr ? succ->child[1] : nullptr),
                       nullptr};
-    rqProvider->prepare_bundles(bundles, ptrs);
+    rqProvider->prepare_bundles(tid, bundles, ptrs);
 
     // Perform linearization.
     timestamp_t lin_time = rqProvider->linearize_update_at_write(
@@ -460,12 +522,30 @@ retry:
     // Finalize bundles.
     rqProvider->finalize_bundles(bundles, lin_time);
 
-    nodeptr deletedNodes[] = {curr, succ, nullptr};
-    rqProvider->physical_deletion_succeeded(tid, deletedNodes);
+    BUNDLE_TYPE_DECL<node_t<K, V>>* dirtyBundles[] = {
+        &prev->rqbundle[0], &prev->rqbundle[1], nullptr};
+    rqProvider->mark_dirty(tid, prev, dirtyBundles);
+    if (prevSucc != curr) {
+      BUNDLE_TYPE_DECL<node_t<K, V>>* dirtySuccBundles[] = {
+          &prevSucc->rqbundle[0], &prevSucc->rqbundle[1], nullptr};
+      rqProvider->mark_dirty(tid, prevSucc, dirtySuccBundles);
+    }
 
+#ifdef BUNDLE_CITRUS_BATCHED_SYNC
+    synchronizeBatched();
+#else
     synchronize();
+#endif
 
     succ->marked = true;
+    BUNDLE_TYPE_DECL<node_t<K, V>>* deletedCurrBundles[] = {
+        &curr->rqbundle[0], &curr->rqbundle[1], nullptr};
+    rqProvider->retire_node(tid, curr, deletedCurrBundles);
+    rqProvider->retire_values(tid, &curr->vals);
+    BUNDLE_TYPE_DECL<node_t<K, V>>* deletedSuccBundles[] = {
+        &succ->rqbundle[0], &succ->rqbundle[1], nullptr};
+    rqProvider->retire_node(tid, succ, deletedSuccBundles);
+    rqProvider->retire_values(tid, &succ->vals);
     if (prevSucc == curr) {
       nnode->child[1] = succ->child[1];
       if (nnode->child[1] == NULL) {
@@ -574,7 +654,7 @@ int bundle_citrustree<K, V, RecManager>::rangeQuery(const int tid, const K& lo,
 
         // If the key is in the range, add it to the result set.
         rqProvider->traversal_try_add(tid, node, resultKeys, resultValues,
-                                      &size, lo, hi);
+                                      &size, lo, hi, ts);
 
         // Explore subtrees with DFS based on timestamp and range.
         ok = node->rqbundle[0].getPtrByTimestamp(tid, ts, &left);
@@ -600,13 +680,240 @@ int bundle_citrustree<K, V, RecManager>::rangeQuery(const int tid, const K& lo,
 }
 
 template <typename K, typename V, class RecManager>
-void bundle_citrustree<K, V, RecManager>::cleanup(int tid) {
+inline void bundle_citrustree<K, V, RecManager>::cleanupNode(
+    const int tid, nodeptr node, const timestamp_t ts) {
+  // The node is locked so that its entries are not retired concurrently by an
+  // erase. Locked nodes are skipped.
+  if (tryLock(&(node->lock))) {
+    if (!node->marked) {
+      rqProvider->reclaim_bundle(tid, &node->rqbundle[0], ts);
+      rqProvider->reclaim_bundle(tid, &node->rqbundle[1], ts);
+      rqProvider->reclaim_values(tid, &node->vals, ts);
+    }
+    releaseLock(&(node->lock));
+  }
+}
+
+template <typename K, typename V, class RecManager>
+template <typename Visitor>
+int bundle_citrustree<K, V, RecManager>::rangeQueryVisit(const int tid,
+                                                         const K& lo,
+                                                         const K& hi,
+                                                         Visitor&& visit) {
   recordmgr->leaveQuiescentState(tid, true);
-  BUNDLE_INIT_CLEANUP(rqProvider);
   nodeptr curr = root->child[0];
+  nodeptr pred = curr;
+  int direction = 0;
+  int cnt = 0;
+  bool ok;
+
+  // Phase 1. Search for the root of the subtree defining the range.
+  while (curr != nullptr) {
+    if (curr->key >= lo && curr->key <= hi) {
+      break;
+    }
+    pred = curr;
+    direction = (curr->key < lo ? 1 : 0);
+    curr = curr->child[direction];
+  }
 
+  // Phase 2. Enter snapshot.
+  timestamp_t ts = rqProvider->start_traversal(tid);
+  ok = pred->rqbundle[direction].getPtrByTimestamp(tid, ts, &curr);
+  assert(ok);
+
+  // Phase 3. Enter range.
+  while (curr != nullptr) {
+    if (curr->key >= lo && curr->key <= hi) {
+      break;
+    }
+    pred = curr;
+    ok = pred->rqbundle[(curr->key < lo ? 1 : 0)].getPtrByTimestamp(tid, ts,
+                                                                    &curr);
+    assert(ok);
+  }
+
+  // Phase 4. Visit the subtree in order, so that visit sees ascending keys and
+  // can stop at any point. Subtrees that lie outside the range are skipped.
   block<node_t<K, V>> stack(nullptr);
-  stack.push(curr);
+  bool stop = false;
+  while (!stop && (curr != nullptr || !stack.isEmpty())) {
+    while (curr != nullptr) {
+      stack.push(curr);
+      if (lo < curr->key) {
+        ok = curr->rqbundle[0].getPtrByTimestamp(tid, ts, &curr);
+        assert(ok);
+      } else {
+        curr = nullptr;
+      }
+    }
+    nodeptr node = stack.pop();
+    if (isInRange(node->key, lo, hi)) {
+      ++cnt;
+      stop = !visit(node->key, getValue(tid, node, ts));
+    }
+    if (hi > node->key) {
+      ok = node->rqbundle[1].getPtrByTimestamp(tid, ts, &curr);
+      assert(ok);
+    }
+  }
+  while (!stack.isEmpty()) stack.pop();
+
+  // Ending the traversal early releases the cleanup horizon sooner.
+  rqProvider->end_traversal(tid);
+  recordmgr->enterQuiescentState(tid);
+  return cnt;
+}
+
+template <typename K, typename V, class RecManager>
+BundleSnapshot bundle_citrustree<K, V, RecManager>::openSnapshot(
+    const int tid) {
+  // The thread stays non-quiescent until the snapshot is closed, so no node
+  // reachable at the snapshot's timestamp is freed in between.
+  recordmgr->leaveQuiescentState(tid, true);
+  return rqProvider->open_snapshot(tid);
+}
+
+template <typename K, typename V, class RecManager>
+void bundle_citrustree<K, V, RecManager>::closeSnapshot(const int tid,
+                                                        BundleSnapshot& s) {
+  assert(s.isOpen());
+  rqProvider->close_snapshot(tid, s);
+  recordmgr->enterQuiescentState(tid);
+}
+
+template <typename K, typename V, class RecManager>
+template <typename Visitor>
+int bundle_citrustree<K, V, RecManager>::snapshotVisit(const int tid,
+                                                       const timestamp_t ts,
+                                                       const K& lo,
+                                                       const K& hi,
+                                                       Visitor&& visit) {
+  nodeptr curr;
+  int cnt = 0;
+  bool ok;
+
+  // Phase 1. Enter snapshot. Unlike in rangeQuery(), ts predates any search of
+  // the current tree. A node found now may have been present at ts with other
+  // ancestors, in which case its subtree at ts does not cover the range. The
+  // snapshot is therefore entered at the sentinel below the root, whose left
+  // bundle covers every timestamp, and the tree is descended through bundles.
+  ok = root->child[0]->rqbundle[0].getPtrByTimestamp(tid, ts, &curr);
+  assert(ok);
+
+  // Phase 2. Enter range.
+  while (curr != nullptr) {
+    if (curr->key >= lo && curr->key <= hi) {
+      break;
+    }
+    ok = curr->rqbundle[(curr->key < lo ? 1 : 0)].getPtrByTimestamp(tid, ts,
+                                                                    &curr);
+    assert(ok);
+  }
+
+  // Phase 3. Visit the subtree in order.
+  block<node_t<K, V>> stack(nullptr);
+  bool stop = false;
+  while (!stop && (curr != nullptr || !stack.isEmpty())) {
+    while (curr != nullptr) {
+      stack.push(curr);
+      if (lo < curr->key) {
+        ok = curr->rqbundle[0].getPtrByTimestamp(tid, ts, &curr);
+        assert(ok);
+      } else {
+        curr = nullptr;
+      }
+    }
+    nodeptr node = stack.pop();
+    if (isInRange(node->key, lo, hi)) {
+      ++cnt;
+      stop = !visit(node->key, getValue(tid, node, ts));
+    }
+    if (hi > node->key) {
+      ok = node->rqbundle[1].getPtrByTimestamp(tid, ts, &curr);
+      assert(ok);
+    }
+  }
+  while (!stack.isEmpty()) stack.pop();
+  return cnt;
+}
+
+template <typename K, typename V, class RecManager>
+bool bundle_citrustree<K, V, RecManager>::contains(const int tid, const K& key,
+                                                   const BundleSnapshot& s) {
+  return find(tid, key, s).second;
+}
+
+template <typename K, typename V, class RecManager>
+const pair<V, bool> bundle_citrustree<K, V, RecManager>::find(
+    const int tid, const K& key, const BundleSnapshot& s) {
+  assert(s.isOpen());
+  return findAt(tid, key, s.ts);
+}
+
+template <typename K, typename V, class RecManager>
+const pair<V, bool> bundle_citrustree<K, V, RecManager>::findAt(
+    const int tid, const K& key, const timestamp_t ts) {
+  pair<V, bool> res(NO_VALUE, false);
+  snapshotVisit(tid, ts, key, key, [&](const K& k, const V& val) {
+    res = pair<V, bool>(val, true);
+    return false;
+  });
+  return res;
+}
+
+template <typename K, typename V, class RecManager>
+int bundle_citrustree<K, V, RecManager>::rangeQuery(const int tid, const K& lo,
+                                                    const K& hi,
+                                                    K* const resultKeys,
+                                                    V* const resultValues,
+                                                    const BundleSnapshot& s) {
+  assert(s.isOpen());
+  int cnt = 0;
+  snapshotVisit(tid, s.ts, lo, hi, [&](const K& key, const V& val) {
+    resultKeys[cnt] = key;
+    resultValues[cnt] = val;
+    ++cnt;
+    return true;
+  });
+  return cnt;
+}
+
+template <typename K, typename V, class RecManager>
+int bundle_citrustree<K, V, RecManager>::rangeQueryLimit(
+    const int tid, const K& lo, const K& hi, const int k,
+    K* const resultKeys, V* const resultValues) {
+  if (k <= 0) return 0;
+  int cnt = 0;
+  rangeQueryVisit(tid, lo, hi, [&](const K& key, const V& val) {
+    resultKeys[cnt] = key;
+    resultValues[cnt] = val;
+    return ++cnt < k;
+  });
+  return cnt;
+}
+
+#ifdef BUNDLE_CLEANUP_DIRTY
+template <typename K, typename V, class RecManager>
+void bundle_citrustree<K, V, RecManager>::cleanupDirty(int tid, nodeptr node,
+                                                       timestamp_t ts) {
+  // Unlike cleanupNode(), the lock is always acquired since the node must be
+  // removed from the dirty log.
+  acquireLock(&(node->lock));
+  if (!node->marked) rqProvider->reclaim_values(tid, &node->vals, ts);
+  BUNDLE_TYPE_DECL<node_t<K, V>>* bundles[] = {&node->rqbundle[0],
+                                               &node->rqbundle[1], nullptr};
+  rqProvider->clean_dirty(tid, node, bundles, ts);
+  releaseLock(&(node->lock));
+}
+#endif
+
+template <typename K, typename V, class RecManager>
+void bundle_citrustree<K, V, RecManager>::cleanupSubtree(const int tid,
+                                                         nodeptr subtree,
+                                                         const timestamp_t ts) {
+  block<node_t<K, V>> stack(nullptr);
+  stack.push(subtree);
   while (!stack.isEmpty()) {
     // Get the next node to process.
     nodeptr node = stack.pop();
@@ -621,9 +928,37 @@ void bundle_citrustree<K, V, RecManager>::cleanup(int tid) {
       stack.push(right);
     }
 
-    // Clean up the bundles.
-    BUNDLE_CLEAN_BUNDLE(node->rqbundle[0]);
-    BUNDLE_CLEAN_BUNDLE(node->rqbundle[1]);
+    cleanupNode(tid, node, ts);
+  }
+}
+
+template <typename K, typename V, class RecManager>
+void bundle_citrustree<K, V, RecManager>::cleanup(int tid, int worker,
+                                                  int num_workers) {
+  recordmgr->leaveQuiescentState(tid, true);
+  BUNDLE_INIT_CLEANUP(rqProvider);
+  // Nodes above the split depth are cleaned by the first worker. The subtrees
+  // rooted at the split depth divide the key space and are dealt out to the
+  // workers in order. The depth is capped so that a level fits in a block.
+  const int split =
+      (BUNDLE_CLEANUP_SPLIT_DEPTH < 8 ? BUNDLE_CLEANUP_SPLIT_DEPTH : 8);
+  block<node_t<K, V>> level(nullptr);
+  block<node_t<K, V>> next(nullptr);
+  level.push(root->child[0]);
+  for (int depth = 0; depth < split && !level.isEmpty(); ++depth) {
+    while (!level.isEmpty()) {
+      nodeptr node = level.pop();
+      nodeptr left = node->child[0];
+      nodeptr right = node->child[1];
+      if (left != nullptr) next.push(left);
+      if (right != nullptr) next.push(right);
+      if (worker == 0) cleanupNode(tid, node, ts);
+    }
+    while (!next.isEmpty()) level.push(next.pop());
+  }
+  for (int subtree = 0; !level.isEmpty(); ++subtree) {
+    nodeptr node = level.pop();
+    if (subtree % num_workers == worker) cleanupSubtree(tid, node, ts);
   }
   recordmgr->enterQuiescentState(tid);
 }
@@ -3,24 +3,27 @@
 
 #include <stack>
 #include <unordered_set>
+#include <vector>
 
 #ifndef MAX_NODES_INSERTED_OR_DELETED_ATOMICALLY
 // define BEFORE including rq_provider.h
 #define MAX_NODES_INSERTED_OR_DELETED_ATOMICALLY 4
 #endif
 #include "bundle_lazylist_impl.h"
+#include "node_locks.h"
 #include "rq_bundle.h"
 
-template <typename K, typename V>
+template <typename K, typename V, class Lock = TASNodeLock>
 class node_t;
-#define nodeptr node_t<K, V>*
+#define nodeptr node_t<K, V, Lock>*
 
-template <typename K, typename V, class RecManager>
+// Lock is the per-node lock policy (see node_locks.h).
+template <typename K, typename V, class RecManager, class Lock = TASNodeLock>
 class bundle_lazylist {
  private:
   RecManager* const recordmgr;
-  RQProvider<K, V, node_t<K, V>, bundle_lazylist<K, V, RecManager>, RecManager,
-             true, false>* const rqProvider;
+  RQProvider<K, V, node_t<K, V, Lock>, bundle_lazylist<K, V, RecManager, Lock>,
+             RecManager, true, false>* const rqProvider;
 #ifdef USE_DEBUGCOUNTERS
   debugCounters* const counters;
 #endif
@@ -37,6 +40,9 @@ class bundle_lazylist {
   };
 
   bool enterSnapshot(const int tid, nodeptr pred, timestamp_t ts, nodeptr* next);
+  template <typename Visitor>
+  int snapshotVisit(const int tid, const timestamp_t ts, const K& lo,
+                    const K& hi, Visitor&& visit);
 
  public:
   const K KEY_MIN;
@@ -53,11 +59,45 @@ class bundle_lazylist {
     return doInsert(tid, key, value, true);
   }
   V erase(const int tid, const K& key);
+  // Applies the n ops atomically at a single timestamp (see batch_update.h).
+  // Keys must lie strictly between KEY_MIN and KEY_MAX.
+  void batchUpdate(const int tid, BatchOp<K, V>* const ops, const int n);
+  // Fills an empty list with the n pairs in keys and values, which must be
+  // sorted by key without duplicates. Every bundle gets a single entry at
+  // BUNDLE_MIN_TIMESTAMP. No other thread may access the list meanwhile.
+  void bulkLoad(const int tid, const K* const keys, const V* const values,
+                const long long n);
   int rangeQuery(const int tid, const K& lo, const K& hi, K* const resultKeys,
                  V* const resultValues);
-  void cleanup(int tid);
+  // Passes each pair in [lo, hi] of a linearizable snapshot to
+  // visit(key, value) in ascending key order, without materializing the result
+  // set. Stops once visit returns false. Returns the number of pairs visited.
+  template <typename Visitor>
+  int rangeQueryVisit(const int tid, const K& lo, const K& hi, Visitor&& visit);
+  // Like rangeQuery(), but returns only the (at most) k smallest keys in the
+  // range. The traversal ends as soon as k keys have been found.
+  int rangeQueryLimit(const int tid, const K& lo, const K& hi, const int k,
+                      K* const resultKeys, V* const resultValues);
+  // Opens a snapshot that the overloads below read repeatedly until it is
+  // closed (see snapshot.h).
+  BundleSnapshot openSnapshot(const int tid);
+  void closeSnapshot(const int tid, BundleSnapshot& s);
+  bool contains(const int tid, const K& key, const BundleSnapshot& s);
+  std::pair<V, bool> find(const int tid, const K& key, const BundleSnapshot& s);
+  int rangeQuery(const int tid, const K& lo, const K& hi, K* const resultKeys,
+                 V* const resultValues, const BundleSnapshot& s);
+  // Returns the value that key had at timestamp ts, which must be readable by
+  // the calling thread (see snapshot.h).
+  std::pair<V, bool> findAt(const int tid, const K& key, const timestamp_t ts);
+  void cleanup(int tid, int worker = 0, int num_workers = 1);
+#ifdef BUNDLE_CLEANUP_DIRTY
+  void cleanupDirty(int tid, nodeptr node, timestamp_t ts);
+#endif
   void startCleanup() { rqProvider->startCleanup(); }
   void stopCleanup() { rqProvider->stopCleanup(); }
+  // Sampled bundle and cleanup statistics (see bundle_telemetry.h).
+  string getBundleTelemetryString() { return rqProvider->telemetry_string(); }
+  void resetBundleTelemetry() { rqProvider->reset_telemetry(); }
   bool validateBundles(int tid);
 
   /**
@@ -100,24 +140,38 @@ class bundle_lazylist {
 
   RecManager* const debugGetRecMgr() { return recordmgr; }
 
-  inline int getKeys(const int tid, node_t<K, V>* node, K* const outputKeys,
-                     V* const outputValues) {
+  inline int getKeys(const int tid, node_t<K, V, Lock>* node,
+                     K* const outputKeys, V* const outputValues) {
     // ignore marked
     outputKeys[0] = node->key;
     outputValues[0] = node->val;
     return 1;
   }
 
+  // Like getKeys(), but returns the value that node had at timestamp ts.
+  inline int getKeys(const int tid, node_t<K, V, Lock>* node,
+                     K* const outputKeys, V* const outputValues,
+                     timestamp_t ts) {
+    outputKeys[0] = node->key;
+    outputValues[0] = getValue(tid, node, ts);
+    return 1;
+  }
+
+  // Returns the value that node had at timestamp ts.
+  inline V getValue(const int tid, node_t<K, V, Lock>* node, timestamp_t ts) {
+    return node->vals.getByTimestamp(tid, &node->val, ts);
+  }
+
   bool isInRange(const K& key, const K& lo, const K& hi) {
     return (lo <= key && key <= hi);
   }
-  inline bool isLogicallyDeleted(const int tid, node_t<K, V>* node);
+  inline bool isLogicallyDeleted(const int tid, node_t<K, V, Lock>* node);
 
-  inline bool isLogicallyInserted(const int tid, node_t<K, V>* node) {
+  inline bool isLogicallyInserted(const int tid, node_t<K, V, Lock>* node) {
     return true;
   }
 
-  node_t<K, V>* debug_getEntryPoint() { return head; }
+  node_t<K, V, Lock>* debug_getEntryPoint() { return head; }
 
   string getBundleStatsString() {
     unsigned int max = 0;
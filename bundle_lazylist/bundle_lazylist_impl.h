@@ -7,29 +7,33 @@
 #ifndef LAZYLIST_IMPL_H
 #define LAZYLIST_IMPL_H
 
+#include <algorithm>
 #include <cassert>
 #include <csignal>
 
 #include "bundle_lazylist.h"
-#include "locks_impl.h"
 
 #ifndef casword_t
 #define casword_t uintptr_t
 #endif
 
-template <typename K, typename V>
+template <typename K, typename V, class Lock>
 class node_t {
  public:
   K key;
   volatile V val;
+  ValueHistory<V> vals;  // older values; modified while holding lock
   node_t *volatile next;
-  volatile int lock;
+  Lock lock;
   volatile long long
       marked;  // is stored as a long long simply so it is large enough to be
                // used with the lock-free RQProvider (which requires all fields
                // that are modified at linearization points of operations to be
                // at least as large as a machine word)
-  BUNDLE_TYPE_DECL<node_t<K, V>> rqbundle;
+  BUNDLE_TYPE_DECL<node_t<K, V, Lock>> rqbundle;
+#ifdef BUNDLE_CLEANUP_DIRTY
+  volatile bool dirty;  // in a dirty log; protected by lock
+#endif
 
   node_t() {}
 
@@ -48,17 +52,17 @@ class node_t {
   }
 };
 
-template <typename K, typename V, class RecManager>
-bundle_lazylist<K, V, RecManager>::bundle_lazylist(const int numProcesses,
-                                                   const K _KEY_MIN,
-                                                   const K _KEY_MAX,
-                                                   const V _NO_VALUE)
+template <typename K, typename V, class RecManager, class Lock>
+bundle_lazylist<K, V, RecManager, Lock>::bundle_lazylist(const int numProcesses,
+                                                         const K _KEY_MIN,
+                                                         const K _KEY_MAX,
+                                                         const V _NO_VALUE)
     // Plus 1 for the background thread.
     : recordmgr(new RecManager(numProcesses, SIGQUIT)),
       rqProvider(
-          new RQProvider<K, V, node_t<K, V>, bundle_lazylist<K, V, RecManager>,
-                         RecManager, true, false>(numProcesses, this,
-                                                  recordmgr))
+          new RQProvider<K, V, node_t<K, V, Lock>,
+                         bundle_lazylist<K, V, RecManager, Lock>, RecManager,
+                         true, false>(numProcesses, this, recordmgr))
 #ifdef USE_DEBUGCOUNTERS
       ,
       counters(new debugCounters(numProcesses))
@@ -73,23 +77,30 @@ bundle_lazylist<K, V, RecManager>::bundle_lazylist(const int numProcesses,
   head = new_node(tid, KEY_MIN, 0, NULL);
 
   // Perform linearization of max to ensure bundles correctly added.
-  BUNDLE_TYPE_DECL<node_t<K, V>> *bundles[] = {&head->rqbundle, nullptr};
+  BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *bundles[] = {&head->rqbundle, nullptr};
   nodeptr ptrs[] = {max, nullptr};
-  rqProvider->prepare_bundles(bundles, ptrs);
+  rqProvider->prepare_bundles(tid, bundles, ptrs);
   timestamp_t lin_time =
       rqProvider->linearize_update_at_write(tid, &head->next, max);
   rqProvider->finalize_bundles(bundles, lin_time);
 }
 
-template <typename K, typename V, class RecManager>
-bundle_lazylist<K, V, RecManager>::~bundle_lazylist() {
+template <typename K, typename V, class RecManager, class Lock>
+bundle_lazylist<K, V, RecManager, Lock>::~bundle_lazylist() {
   const int dummyTid = 0;
+  rqProvider->stopCleanup();
   nodeptr curr = head;
   while (curr->key < KEY_MAX) {
     nodeptr next = curr->next;
+    BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *bundles[] = {
+        &curr->rqbundle, nullptr};
+    rqProvider->deallocate_bundles(dummyTid, bundles);
+    rqProvider->deallocate_values(dummyTid, &curr->vals);
     recordmgr->deallocate(dummyTid, curr);
     curr = next;
   }
+  BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *bundles[] = {&curr->rqbundle, nullptr};
+  rqProvider->deallocate_bundles(dummyTid, bundles);
   recordmgr->deallocate(dummyTid, curr);
   delete rqProvider;
   recordmgr->printStatus();
@@ -99,8 +110,8 @@ bundle_lazylist<K, V, RecManager>::~bundle_lazylist() {
 #endif
 }
 
-template <typename K, typename V, class RecManager>
-void bundle_lazylist<K, V, RecManager>::initThread(const int tid) {
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_lazylist<K, V, RecManager, Lock>::initThread(const int tid) {
   if (init[tid])
     return;
   else
@@ -110,8 +121,8 @@ void bundle_lazylist<K, V, RecManager>::initThread(const int tid) {
   rqProvider->initThread(tid);
 }
 
-template <typename K, typename V, class RecManager>
-void bundle_lazylist<K, V, RecManager>::deinitThread(const int tid) {
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_lazylist<K, V, RecManager, Lock>::deinitThread(const int tid) {
   if (!init[tid])
     return;
   else
@@ -121,36 +132,41 @@ void bundle_lazylist<K, V, RecManager>::deinitThread(const int tid) {
   rqProvider->deinitThread(tid);
 }
 
-template <typename K, typename V, class RecManager>
-nodeptr bundle_lazylist<K, V, RecManager>::new_node(const int tid, const K &key,
-                                                    const V &val,
-                                                    nodeptr next) {
-  nodeptr nnode = recordmgr->template allocate<node_t<K, V>>(tid);
+template <typename K, typename V, class RecManager, class Lock>
+nodeptr bundle_lazylist<K, V, RecManager, Lock>::new_node(const int tid,
+                                                          const K &key,
+                                                          const V &val,
+                                                          nodeptr next) {
+  nodeptr nnode = recordmgr->template allocate<node_t<K, V, Lock>>(tid);
   if (nnode == NULL) {
     cout << "out of memory" << endl;
     exit(1);
   }
   nnode->key = key;
   nnode->val = val;
+  nnode->vals.init();
   nnode->next = next;
   nnode->marked = 0LL;
-  nnode->lock = false;
+  nnode->lock.init();
   nnode->rqbundle.init();
+#ifdef BUNDLE_CLEANUP_DIRTY
+  nnode->dirty = false;
+#endif
 #ifdef __HANDLE_STATS
   GSTATS_APPEND(tid, node_allocated_addresses, ((long long)nnode) % (1 << 12));
 #endif
   return nnode;
 }
 
-template <typename K, typename V, class RecManager>
-inline int bundle_lazylist<K, V, RecManager>::validateLinks(const int tid,
-                                                            nodeptr pred,
-                                                            nodeptr curr) {
+template <typename K, typename V, class RecManager, class Lock>
+inline int bundle_lazylist<K, V, RecManager, Lock>::validateLinks(
+    const int tid, nodeptr pred, nodeptr curr) {
   return (!pred->marked && !curr->marked && (pred->next == curr));
 }
 
-template <typename K, typename V, class RecManager>
-bool bundle_lazylist<K, V, RecManager>::contains(const int tid, const K &key) {
+template <typename K, typename V, class RecManager, class Lock>
+bool bundle_lazylist<K, V, RecManager, Lock>::contains(const int tid,
+                                                       const K &key) {
   bool ok;
   while (true) {
     recordmgr->leaveQuiescentState(tid, true);
@@ -181,9 +197,10 @@ bool bundle_lazylist<K, V, RecManager>::contains(const int tid, const K &key) {
   return false;
 }
 
-template <typename K, typename V, class RecManager>
-V bundle_lazylist<K, V, RecManager>::doInsert(const int tid, const K &key,
-                                              const V &val, bool onlyIfAbsent) {
+template <typename K, typename V, class RecManager, class Lock>
+V bundle_lazylist<K, V, RecManager, Lock>::doInsert(const int tid, const K &key,
+                                                    const V &val,
+                                                    bool onlyIfAbsent) {
   nodeptr curr;
   nodeptr pred;
   nodeptr newnode;
@@ -196,37 +213,50 @@ V bundle_lazylist<K, V, RecManager>::doInsert(const int tid, const K &key,
       pred = curr;
       curr = curr->next;
     }
-    acquireLock(&(pred->lock));
+    pred->lock.acquire();
     if (validateLinks(tid, pred, curr)) {
       if (curr->key == key) {
         if (curr->marked) {  // this is an optimization
-          releaseLock(&(pred->lock));
+          pred->lock.release();
           recordmgr->enterQuiescentState(tid);
           continue;
         }
         // node containing key is not marked
         if (onlyIfAbsent) {
           V result = curr->val;
-          releaseLock(&(pred->lock));
+          pred->lock.release();
           recordmgr->enterQuiescentState(tid);
           return result;
         }
-        cout << "ERROR: insert-replace functionality not implemented for "
-                "bundle_lazylist_impl at this time."
-             << endl;
-        exit(-1);
+        // Replace the value in place. The lock of pred is released first,
+        // since erase() locks curr before its predecessor.
+        pred->lock.release();
+        curr->lock.acquire();
+        if (curr->marked) {
+          curr->lock.release();
+          recordmgr->enterQuiescentState(tid);
+          continue;
+        }
+        result = curr->val;
+        rqProvider->update_value(tid, &curr->vals, &curr->val, val);
+        BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *dirtyBundles[] = {
+            &curr->rqbundle, nullptr};
+        rqProvider->mark_dirty(tid, curr, dirtyBundles);
+        curr->lock.release();
+        recordmgr->enterQuiescentState(tid);
+        return result;
       }
       // key is not in list
       assert(curr->key != key);
       result = NO_VALUE;
       newnode = new_node(tid, key, val, curr);
-      acquireLock(&(newnode->lock));
+      newnode->lock.acquire();
 
       // Prepare bundles.
-      BUNDLE_TYPE_DECL<node_t<K, V>> *bundles[] = {&newnode->rqbundle,
-                                                   &pred->rqbundle, nullptr};
+      BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *bundles[] = {
+          &newnode->rqbundle, &pred->rqbundle, nullptr};
       nodeptr ptrs[] = {curr, newnode, nullptr};
-      rqProvider->prepare_bundles(bundles, ptrs);
+      rqProvider->prepare_bundles(tid, bundles, ptrs);
       SOFTWARE_BARRIER;
 
       // Perform original linearization.
@@ -235,14 +265,17 @@ V bundle_lazylist<K, V, RecManager>::doInsert(const int tid, const K &key,
 
       // Finalize bundles.
       rqProvider->finalize_bundles(bundles, lin_time);
+      BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *dirtyBundles[] = {
+          &pred->rqbundle, nullptr};
+      rqProvider->mark_dirty(tid, pred, dirtyBundles);
 
       // Release locks and return.
-      releaseLock(&(newnode->lock));
-      releaseLock(&(pred->lock));
+      newnode->lock.release();
+      pred->lock.release();
       recordmgr->enterQuiescentState(tid);
       return result;
     }
-    releaseLock(&(pred->lock));
+    pred->lock.release();
     recordmgr->enterQuiescentState(tid);
   }
 }
@@ -251,8 +284,8 @@ V bundle_lazylist<K, V, RecManager>::doInsert(const int tid, const K &key,
  * Logically remove an element by setting a mark bit to 1
  * before removing it physically.
  */
-template <typename K, typename V, class RecManager>
-V bundle_lazylist<K, V, RecManager>::erase(const int tid, const K &key) {
+template <typename K, typename V, class RecManager, class Lock>
+V bundle_lazylist<K, V, RecManager, Lock>::erase(const int tid, const K &key) {
   nodeptr pred;
   nodeptr curr;
   V result;
@@ -270,8 +303,8 @@ V bundle_lazylist<K, V, RecManager>::erase(const int tid, const K &key) {
       recordmgr->enterQuiescentState(tid);
       return result;
     }
-    acquireLock(&(curr->lock));
-    acquireLock(&(pred->lock));
+    curr->lock.acquire();
+    pred->lock.acquire();
     if (validateLinks(tid, pred, curr)) {
       // TODO: maybe implement version with atomic removal of consecutive marked
       // nodes
@@ -280,10 +313,10 @@ V bundle_lazylist<K, V, RecManager>::erase(const int tid, const K &key) {
       nodeptr c_nxt = curr->next;
 
       // Prepare bundles.
-      BUNDLE_TYPE_DECL<node_t<K, V>> *bundles[] = {&pred->rqbundle,
-                                                   &curr->rqbundle, nullptr};
+      BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *bundles[] = {
+          &pred->rqbundle, &curr->rqbundle, nullptr};
       nodeptr ptrs[] = {c_nxt, head, nullptr};
-      rqProvider->prepare_bundles(bundles, ptrs);
+      rqProvider->prepare_bundles(tid, bundles, ptrs);
 
       // Perform original linearization point.
       timestamp_t lin_time =
@@ -293,33 +326,240 @@ V bundle_lazylist<K, V, RecManager>::erase(const int tid, const K &key) {
       rqProvider->finalize_bundles(bundles, lin_time);
 
       pred->next = c_nxt;
-      nodeptr deletedNodes[] = {curr, nullptr};
-      rqProvider->physical_deletion_succeeded(tid, deletedNodes);
-
-      releaseLock(&(curr->lock));
-      releaseLock(&(pred->lock));
+      BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *dirtyBundles[] = {
+          &pred->rqbundle, nullptr};
+      rqProvider->mark_dirty(tid, pred, dirtyBundles);
+      BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *deletedBundles[] = {
+          &curr->rqbundle, nullptr};
+      rqProvider->retire_node(tid, curr, deletedBundles);
+      rqProvider->retire_values(tid, &curr->vals);
+
+      curr->lock.release();
+      pred->lock.release();
       recordmgr->enterQuiescentState(tid);
       return result;
     }
-    releaseLock(&(curr->lock));
-    releaseLock(&(pred->lock));
+    curr->lock.release();
+    pred->lock.release();
     recordmgr->enterQuiescentState(tid);
   }
 }
 
-template <typename K, typename V, class RecManager>
-inline bool bundle_lazylist<K, V, RecManager>::enterSnapshot(const int tid,
-                                                             nodeptr pred,
-                                                             timestamp_t ts,
-                                                             nodeptr *next) {
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_lazylist<K, V, RecManager, Lock>::batchUpdate(
+    const int tid, BatchOp<K, V> *const ops, const int n) {
+  // The ops on each key form a window around the position of the key.
+  struct window_t {
+    int first;
+    int len;
+    nodeptr pred;
+    nodeptr curr;
+    bool found;    // curr holds the key
+    bool present;  // the key is present after the batch
+    bool written;  // the batch writes a value for the key
+  };
+  if (n <= 0) return;
+  batchSort(ops, n);
+  std::vector<window_t> windows;
+  std::vector<nodeptr> locked;
+  std::vector<nodeptr> created;
+  std::vector<nodeptr> erased;
+  std::vector<std::pair<nodeptr, nodeptr>> links;
+  std::vector<BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *> bundles;
+  std::vector<nodeptr> ptrs;
+  while (true) {
+    recordmgr->leaveQuiescentState(tid);
+    windows.clear();
+    locked.clear();
+
+    // Phase 1. Find every window in a single traversal and collect the nodes
+    // that a sequence of single-key operations would lock.
+    nodeptr pred = head;
+    nodeptr curr = pred->next;
+    for (int i = 0; i < n;) {
+      const int len = batchRunLength(ops + i, n - i);
+      while (curr->key < ops[i].key) {
+        pred = curr;
+        curr = curr->next;
+      }
+      window_t w = {i, len, pred, curr, curr->key == ops[i].key};
+      w.present = w.found;
+      V val = NO_VALUE;
+      w.written = batchApply(ops + i, len, NO_VALUE, &w.present, &val);
+      if (w.found) locked.push_back(curr);
+      if (!w.found || !w.present) locked.push_back(pred);
+      windows.push_back(w);
+      i += len;
+    }
+
+    // Phase 2. Lock in descending key order, like erase(), and validate.
+    std::sort(locked.begin(), locked.end(), [](nodeptr a, nodeptr b) {
+      return (a->key != b->key ? a->key > b->key : a > b);
+    });
+    locked.erase(std::unique(locked.begin(), locked.end()), locked.end());
+    for (nodeptr node : locked) node->lock.acquire();
+    bool valid = true;
+    for (const window_t &w : windows) {
+      if (w.found ? w.curr->marked : !validateLinks(tid, w.pred, w.curr)) {
+        valid = false;
+      } else if (w.found && !w.present) {
+        valid = validateLinks(tid, w.pred, w.curr);
+      }
+      if (!valid) break;
+    }
+    if (!valid) {
+      for (nodeptr node : locked) node->lock.release();
+      recordmgr->enterQuiescentState(tid);
+      continue;
+    }
+
+    // Phase 3. Compute the new links. Links of locked nodes are staged in
+    // links until the batch takes its timestamp. The links of new nodes are
+    // written directly since they are not yet reachable. A window that overlaps
+    // the previous one starts from the last node that the batch left there.
+    created.clear();
+    erased.clear();
+    links.clear();
+    nodeptr last = nullptr;
+    bool lastCreated = false;
+    nodeptr lastPred = nullptr;
+    nodeptr lastFound = nullptr;
+    auto nextOf = [&](nodeptr node, bool isCreated) {
+      if (isCreated) return (nodeptr)node->next;
+      if (!links.empty() && links.back().first == node) {
+        return links.back().second;
+      }
+      return (nodeptr)node->next;
+    };
+    auto setNext = [&](nodeptr node, bool isCreated, nodeptr next) {
+      if (isCreated) {
+        node->next = next;
+      } else if (!links.empty() && links.back().first == node) {
+        links.back().second = next;
+      } else {
+        links.emplace_back(node, next);
+      }
+    };
+    for (window_t &w : windows) {
+      V val = (w.found ? (V)w.curr->val : NO_VALUE);
+      bool present = w.found;
+      batchApply(ops + w.first, w.len, NO_VALUE, &present, &val);
+      if (w.found == w.present) {
+        if (w.present && w.written) {
+          rqProvider->prepare_value(tid, &w.curr->vals, &w.curr->val, val);
+        }
+        continue;
+      }
+      nodeptr node = w.pred;
+      bool isCreated = false;
+      if (w.pred == lastPred || w.pred == lastFound) {
+        node = last;
+        isCreated = lastCreated;
+      }
+      if (w.present) {
+        nodeptr newnode =
+            new_node(tid, ops[w.first].key, val, nextOf(node, isCreated));
+        newnode->lock.acquire();
+        created.push_back(newnode);
+        setNext(node, isCreated, newnode);
+        last = newnode;
+        lastCreated = true;
+      } else {
+        setNext(node, isCreated, w.curr->next);
+        erased.push_back(w.curr);
+        last = node;
+        lastCreated = isCreated;
+      }
+      lastPred = w.pred;
+      lastFound = (w.found ? w.curr : nullptr);
+    }
+
+    // Phase 4. Prepare every bundle, then linearize the whole batch at one
+    // timestamp.
+    bundles.clear();
+    ptrs.clear();
+    for (auto &link : links) {
+      bundles.push_back(&link.first->rqbundle);
+      ptrs.push_back(link.second);
+    }
+    for (nodeptr node : created) {
+      bundles.push_back(&node->rqbundle);
+      ptrs.push_back((nodeptr)node->next);
+    }
+    for (nodeptr node : erased) {
+      bundles.push_back(&node->rqbundle);
+      ptrs.push_back(head);
+    }
+    bundles.push_back(nullptr);
+    ptrs.push_back(nullptr);
+    rqProvider->prepare_bundles(tid, bundles.data(), ptrs.data());
+    SOFTWARE_BARRIER;
+    timestamp_t lin_time = rqProvider->get_update_lin_time(tid);
+    SOFTWARE_BARRIER;
+    for (nodeptr node : erased) node->marked = 1LL;
+    for (auto &link : links) link.first->next = link.second;
+    rqProvider->finalize_bundles(bundles.data(), lin_time);
+    for (const window_t &w : windows) {
+      if (w.found && w.present && w.written) {
+        rqProvider->finalize_value(tid, &w.curr->vals, lin_time);
+        BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *dirtyBundles[] = {
+            &w.curr->rqbundle, nullptr};
+        rqProvider->mark_dirty(tid, w.curr, dirtyBundles);
+      }
+    }
+    for (auto &link : links) {
+      BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *dirtyBundles[] = {
+          &link.first->rqbundle, nullptr};
+      rqProvider->mark_dirty(tid, link.first, dirtyBundles);
+    }
+    for (nodeptr node : erased) {
+      BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *deletedBundles[] = {
+          &node->rqbundle, nullptr};
+      rqProvider->retire_node(tid, node, deletedBundles);
+      rqProvider->retire_values(tid, &node->vals);
+    }
+
+    for (nodeptr node : created) node->lock.release();
+    for (nodeptr node : locked) node->lock.release();
+    recordmgr->enterQuiescentState(tid);
+    return;
+  }
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_lazylist<K, V, RecManager, Lock>::bulkLoad(const int tid,
+                                                       const K *const keys,
+                                                       const V *const values,
+                                                       const long long n) {
+  if (head->next->key != KEY_MAX) {
+    cerr << "ERROR: bulkLoad() requires an empty list" << endl;
+    exit(-1);
+  }
+  // Nodes are linked back to front, so each one is created with its final
+  // successor.
+  nodeptr next = head->next;
+  for (long long i = n - 1; i >= 0; --i) {
+    assert(i == 0 || keys[i - 1] < keys[i]);
+    nodeptr node = new_node(tid, keys[i], values[i], next);
+    rqProvider->reset_bundle(tid, &node->rqbundle, next);
+    next = node;
+  }
+  rqProvider->reset_bundle(tid, &head->rqbundle, next);
+  head->next = next;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+inline bool bundle_lazylist<K, V, RecManager, Lock>::enterSnapshot(
+    const int tid, nodeptr pred, timestamp_t ts, nodeptr *next) {
   return pred->rqbundle.getPtrByTimestamp(tid, ts, next);
 }
 
-template <typename K, typename V, class RecManager>
-int bundle_lazylist<K, V, RecManager>::rangeQuery(const int tid, const K &lo,
-                                                  const K &hi,
-                                                  K *const resultKeys,
-                                                  V *const resultValues) {
+template <typename K, typename V, class RecManager, class Lock>
+int bundle_lazylist<K, V, RecManager, Lock>::rangeQuery(const int tid,
+                                                        const K &lo,
+                                                        const K &hi,
+                                                        K *const resultKeys,
+                                                        V *const resultValues) {
   timestamp_t ts;
   int cnt = 0;
   bool ok;
@@ -358,7 +598,7 @@ int bundle_lazylist<K, V, RecManager>::rangeQuery(const int tid, const K &lo,
     while (curr != nullptr && curr->key <= hi) {
       if (curr->key >= lo) {
         // Phase 3. Collect snapshot while in the range.
-        cnt += getKeys(tid, curr, resultKeys + cnt, resultValues + cnt);
+        cnt += getKeys(tid, curr, resultKeys + cnt, resultValues + cnt, ts);
       }
       ok = curr->rqbundle.getPtrByTimestamp(tid, ts, &curr);
       assert(
@@ -376,24 +616,203 @@ int bundle_lazylist<K, V, RecManager>::rangeQuery(const int tid, const K &lo,
   }
 }
 
-template <typename K, typename V, class RecManager>
-void bundle_lazylist<K, V, RecManager>::cleanup(int tid) {
-  // Walk the list using the newest edge and reclaim bundle entries.
+template <typename K, typename V, class RecManager, class Lock>
+template <typename Visitor>
+int bundle_lazylist<K, V, RecManager, Lock>::rangeQueryVisit(const int tid,
+                                                             const K &lo,
+                                                             const K &hi,
+                                                             Visitor &&visit) {
+  int cnt = 0;
+  bool ok;
+  recordmgr->leaveQuiescentState(tid, true);
+
+  // Phase 1. Traverse to node immediately preceding range.
+  nodeptr curr = head;
+  nodeptr pred = curr;
+  while (curr->key < lo) {
+    pred = curr;
+    curr = curr->next;
+  }
+
+  // Phase 2. Enter range using bundles.
+  timestamp_t ts = rqProvider->start_traversal(tid);
+  ok = enterSnapshot(tid, pred, ts, &curr);
+  assert(ok);
+  while (curr->key < lo) {
+    ok = curr->rqbundle.getPtrByTimestamp(tid, ts, &curr);
+    assert(ok);
+  }
+
+  // Phase 3. Visit the range. Every bundle has an entry satisfying ts and the
+  // tail bounds the traversal, so no pair is visited twice.
+  while (curr->key <= hi && curr->key != KEY_MAX) {
+    ++cnt;
+    if (!visit(static_cast<K>(curr->key), getValue(tid, curr, ts))) break;
+    ok = curr->rqbundle.getPtrByTimestamp(tid, ts, &curr);
+    assert(ok);
+  }
+
+  // Ending the traversal early releases the cleanup horizon sooner.
+  rqProvider->end_traversal(tid);
+  recordmgr->enterQuiescentState(tid);
+  return cnt;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+BundleSnapshot bundle_lazylist<K, V, RecManager, Lock>::openSnapshot(
+    const int tid) {
+  // The thread stays non-quiescent until the snapshot is closed, so no node
+  // reachable at the snapshot's timestamp is freed in between.
+  recordmgr->leaveQuiescentState(tid, true);
+  return rqProvider->open_snapshot(tid);
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_lazylist<K, V, RecManager, Lock>::closeSnapshot(const int tid,
+                                                            BundleSnapshot &s) {
+  assert(s.isOpen());
+  rqProvider->close_snapshot(tid, s);
+  recordmgr->enterQuiescentState(tid);
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+template <typename Visitor>
+int bundle_lazylist<K, V, RecManager, Lock>::snapshotVisit(const int tid,
+                                                           const timestamp_t ts,
+                                                           const K &lo,
+                                                           const K &hi,
+                                                           Visitor &&visit) {
+  int cnt = 0;
+  bool ok;
+
+  // Phase 1. Traverse to node immediately preceding range.
+  nodeptr curr = head;
+  nodeptr pred = curr;
+  while (curr->key < lo) {
+    pred = curr;
+    curr = curr->next;
+  }
+
+  // Phase 2. Enter range using bundles. Unlike in rangeQuery(), ts predates the
+  // traversal, so pred may have been inserted after ts. Its bundle then has no
+  // entry satisfying ts and the snapshot is entered from the head instead.
+  if (!enterSnapshot(tid, pred, ts, &curr)) {
+    ok = enterSnapshot(tid, head, ts, &curr);
+    assert(ok);
+  }
+  while (curr->key < lo) {
+    ok = curr->rqbundle.getPtrByTimestamp(tid, ts, &curr);
+    assert(ok);
+  }
+
+  // Phase 3. Visit the range.
+  while (curr->key <= hi && curr->key != KEY_MAX) {
+    ++cnt;
+    if (!visit(static_cast<K>(curr->key), getValue(tid, curr, ts))) break;
+    ok = curr->rqbundle.getPtrByTimestamp(tid, ts, &curr);
+    assert(ok);
+  }
+  return cnt;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+bool bundle_lazylist<K, V, RecManager, Lock>::contains(
+    const int tid, const K &key, const BundleSnapshot &s) {
+  return find(tid, key, s).second;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+std::pair<V, bool> bundle_lazylist<K, V, RecManager, Lock>::find(
+    const int tid, const K &key, const BundleSnapshot &s) {
+  assert(s.isOpen());
+  return findAt(tid, key, s.ts);
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+std::pair<V, bool> bundle_lazylist<K, V, RecManager, Lock>::findAt(
+    const int tid, const K &key, const timestamp_t ts) {
+  std::pair<V, bool> res(NO_VALUE, false);
+  snapshotVisit(tid, ts, key, key, [&](const K &k, const V &val) {
+    res = std::pair<V, bool>(val, true);
+    return false;
+  });
+  return res;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+int bundle_lazylist<K, V, RecManager, Lock>::rangeQuery(
+    const int tid, const K &lo, const K &hi, K *const resultKeys,
+    V *const resultValues, const BundleSnapshot &s) {
+  assert(s.isOpen());
+  int cnt = 0;
+  snapshotVisit(tid, s.ts, lo, hi, [&](const K &key, const V &val) {
+    resultKeys[cnt] = key;
+    resultValues[cnt] = val;
+    ++cnt;
+    return true;
+  });
+  return cnt;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+int bundle_lazylist<K, V, RecManager, Lock>::rangeQueryLimit(
+    const int tid, const K &lo, const K &hi, const int k, K *const resultKeys,
+    V *const resultValues) {
+  if (k <= 0) return 0;
+  int cnt = 0;
+  rangeQueryVisit(tid, lo, hi, [&](const K &key, const V &val) {
+    resultKeys[cnt] = key;
+    resultValues[cnt] = val;
+    return ++cnt < k;
+  });
+  return cnt;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_lazylist<K, V, RecManager, Lock>::cleanup(int tid, int worker,
+                                                      int num_workers) {
+  // Walk the list using the newest edge and reclaim bundle entries. Without an
+  // index to split the key space, each worker walks the whole list but only
+  // cleans every num_workers-th run of BUNDLE_CLEANUP_CHUNK nodes.
   recordmgr->leaveQuiescentState(tid);
   BUNDLE_INIT_CLEANUP(rqProvider);
   if (head == nullptr) {
     recordmgr->enterQuiescentState(tid);
     return;
   }
-  BUNDLE_CLEAN_BUNDLE(&head->rqbundle);
-  for (nodeptr curr = head->next; curr->key != KEY_MAX; curr = curr->next) {
-    BUNDLE_CLEAN_BUNDLE(curr->rqbundle);
+  // Nodes are locked so that their entries are not retired concurrently by an
+  // erase. Locked nodes are skipped and cleaned during a later pass.
+  long long pos = 0;
+  for (nodeptr curr = head; curr->key != KEY_MAX; curr = curr->next, ++pos) {
+    if ((pos / BUNDLE_CLEANUP_CHUNK) % num_workers != worker) continue;
+    if (curr->lock.tryAcquire()) {
+      if (!curr->marked) {
+        BUNDLE_CLEAN_BUNDLE(curr->rqbundle);
+        BUNDLE_CLEAN_VALUES(curr->vals);
+      }
+      curr->lock.release();
+    }
   }
   recordmgr->enterQuiescentState(tid);
 }
 
-template <typename K, typename V, class RecManager>
-bool bundle_lazylist<K, V, RecManager>::validateBundles(int tid) {
+#ifdef BUNDLE_CLEANUP_DIRTY
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_lazylist<K, V, RecManager, Lock>::cleanupDirty(int tid,
+                                                           nodeptr node,
+                                                           timestamp_t ts) {
+  // Unlike cleanup(), the lock is always acquired since the node must be
+  // removed from the dirty log.
+  node->lock.acquire();
+  if (!node->marked) rqProvider->reclaim_values(tid, &node->vals, ts);
+  BUNDLE_TYPE_DECL<node_t<K, V, Lock>> *bundles[] = {&node->rqbundle, nullptr};
+  rqProvider->clean_dirty(tid, node, bundles, ts);
+  node->lock.release();
+}
+#endif
+
+template <typename K, typename V, class RecManager, class Lock>
+bool bundle_lazylist<K, V, RecManager, Lock>::validateBundles(int tid) {
   nodeptr curr = head;
   nodeptr temp;
   timestamp_t ts;
@@ -414,8 +833,8 @@ bool bundle_lazylist<K, V, RecManager>::validateBundles(int tid) {
   return valid;
 }
 
-template <typename K, typename V, class RecManager>
-long long bundle_lazylist<K, V, RecManager>::debugKeySum(nodeptr head) {
+template <typename K, typename V, class RecManager, class Lock>
+long long bundle_lazylist<K, V, RecManager, Lock>::debugKeySum(nodeptr head) {
   long long result = 0;
   nodeptr curr = head->next;
   while (curr->key < KEY_MAX) {
@@ -425,14 +844,14 @@ long long bundle_lazylist<K, V, RecManager>::debugKeySum(nodeptr head) {
   return result;
 }
 
-template <typename K, typename V, class RecManager>
-long long bundle_lazylist<K, V, RecManager>::debugKeySum() {
+template <typename K, typename V, class RecManager, class Lock>
+long long bundle_lazylist<K, V, RecManager, Lock>::debugKeySum() {
   return debugKeySum(head);
 }
 
-template <typename K, typename V, class RecManager>
-inline bool bundle_lazylist<K, V, RecManager>::isLogicallyDeleted(
-    const int tid, node_t<K, V> *node) {
+template <typename K, typename V, class RecManager, class Lock>
+inline bool bundle_lazylist<K, V, RecManager, Lock>::isLogicallyDeleted(
+    const int tid, node_t<K, V, Lock> *node) {
   return node->isMarked(tid, rqProvider);
 }
 #endif /* LAZYLIST_IMPL_H */
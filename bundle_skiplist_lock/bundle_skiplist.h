@@ -1,15 +1,18 @@
 #ifndef SKIPLIST_H
 #define SKIPLIST_H
 
+#include <cstddef>
 #include <stack>
 #include <type_traits>
 #include <unordered_set>
+#include <vector>
 
 #ifndef MAX_NODES_INSERTED_OR_DELETED_ATOMICALLY
 // define BEFORE including rq_provider.h
 #define MAX_NODES_INSERTED_OR_DELETED_ATOMICALLY 4
 #endif
 #include "plaf.h"
+#include "node_locks.h"
 #include "random.h"
 #include "rq_bundle.h"
 
@@ -18,6 +21,12 @@ using namespace std;
 /////////////////////////////////////////////////////////
 // DEFINES
 /////////////////////////////////////////////////////////
+// Search fingers may point to nodes that have been reclaimed, so their memory
+// must be recycled through the record manager's pools rather than freed.
+#if defined(BUNDLE_SKIPLIST_FINGERS) && !defined(BUNDLE_POOL_ENTRIES)
+#error "BUNDLE_SKIPLIST_FINGERS requires BUNDLE_POOL_ENTRIES"
+#endif
+
 #ifdef SKIPLIST_DEBUGGING_FLATTEN_MAX_LEVEL
 #define SKIPLIST_MAX_LEVEL (1)
 #else
@@ -27,16 +36,23 @@ using namespace std;
 /////////////////////////////////////////////////////////
 // TYPES
 /////////////////////////////////////////////////////////
-template <typename K, typename V>
-class node_t {
+// Nodes may be allocated with only topLevel+1 entries of p_next (see
+// allocateNode), so p_next must remain the last field. Nodes start on a cache
+// line. With the default lock and bundle, the fields that precede p_next fill
+// exactly that line, so reaching a node's key, lock and bundle costs one miss.
+// (MCSNodeLock and the inline bundle are larger and spill onto the next line.)
+template <typename K, typename V, class Lock = TASNodeLock>
+class alignas(BYTES_IN_CACHE_LINE) node_t {
  public:
-  BUNDLE_TYPE_DECL<node_t<K, V>> rqbundle;
   struct {
    public:
-    volatile long lock;
+    Lock lock;
     volatile K key;
     volatile V val;
     volatile int topLevel;
+#ifdef BUNDLE_CLEANUP_DIRTY
+    volatile bool dirty;  // in a dirty log; protected by lock
+#endif
     volatile long long
         marked;  // stored as long long simply so it is large enough to be used
                  // with the lock-free RQProvider (which requires all fields
@@ -47,9 +63,21 @@ class node_t {
                       // used with the lock-free RQProvider (which requires all
                       // fields that are modified at linearization points of
                       // operations to occupy a machine word)
-
-    node_t<K, V>* volatile p_next[SKIPLIST_MAX_LEVEL];
   };
+  BUNDLE_TYPE_DECL<node_t<K, V, Lock>> rqbundle;
+  ValueHistory<V> vals;  // older values; modified while holding lock
+  node_t<K, V, Lock>* volatile p_next[SKIPLIST_MAX_LEVEL];
+
+  // Bytes needed by a node whose top level is height.
+  static constexpr size_t size(const int height) {
+#ifdef BUNDLE_LINKED_BUNDLE
+    static_assert(!std::is_same<Lock, TASNodeLock>::value ||
+                      sizeof(K) > 8 || sizeof(V) > 8 ||
+                      offsetof(node_t, p_next) <= BYTES_IN_CACHE_LINE,
+                  "the fields before p_next must fit in the first cache line");
+#endif
+    return offsetof(node_t, p_next) + (height + 1) * sizeof(node_t*);
+  }
 
   bool validate() {
     timestamp_t ts;
@@ -62,9 +90,10 @@ class node_t {
   }
 };
 
-#define nodeptr node_t<K, V>*
+#define nodeptr node_t<K, V, Lock>*
 
-template <typename K, typename V, class RecManager>
+// Lock is the per-node lock policy (see node_locks.h).
+template <typename K, typename V, class RecManager, class Lock = TASNodeLock>
 class bundle_skiplist {
  private:
   volatile char padding0[PREFETCH_SIZE_BYTES];
@@ -77,18 +106,34 @@ class bundle_skiplist {
   RecManager* const recmgr;
   Random* const
       threadRNGs;  // threadRNGs[tid * PREFETCH_SIZE_WORDS] = rng for thread tid
-  RQProvider<K, V, node_t<K, V>, bundle_skiplist<K, V, RecManager>, RecManager,
-             true, false>* rqProvider;
+  RQProvider<K, V, node_t<K, V, Lock>, bundle_skiplist<K, V, RecManager, Lock>,
+             RecManager, true, false>* rqProvider;
 #ifdef USE_DEBUGCOUNTERS
   debugCounters* const counters;
 #endif
 
-  nodeptr allocateNode(const int tid);
+  nodeptr allocateNode(const int tid, const int height);
 
   void initNode(const int tid, nodeptr p_node, K key, V value, int height);
   int find_impl(const int tid, K key, nodeptr* p_preds, nodeptr* p_succs,
                 nodeptr* p_found);
   V doInsert(const int tid, const K& key, const V& value, bool onlyIfAbsent);
+  template <typename Visitor>
+  int snapshotVisit(const int tid, const timestamp_t ts, const K& lo,
+                    const K& hi, Visitor&& visit);
+  // Phase 1 of a range query. Returns the last node at the bottom level whose
+  // key is less than lo. The caller must have left the quiescent state.
+  nodeptr rangeQueryStart(const int tid, const K& lo);
+
+#ifdef BUNDLE_SKIPLIST_FINGERS
+  // The predecessors found at each level by the last range query of a thread,
+  // from which its next one starts when lo is nearby.
+  struct finger_t {
+    nodeptr preds[SKIPLIST_MAX_LEVEL];
+    volatile char padding[PREFETCH_SIZE_BYTES];
+  };
+  finger_t fingers[MAX_TID_POW2];
+#endif
 
   int init[MAX_TID_POW2] = {
       0,
@@ -113,10 +158,44 @@ class bundle_skiplist {
     return doInsert(tid, key, value, true);
   }
   V erase(const int tid, const K& key);
+  // Applies the n ops atomically at a single timestamp (see batch_update.h).
+  // Keys must lie strictly between KEY_MIN and KEY_MAX.
+  void batchUpdate(const int tid, BatchOp<K, V>* const ops, const int n);
+  // Fills an empty skiplist with the n pairs in keys and values, which must be
+  // sorted by key without duplicates. Towers are deterministic: the i-th node
+  // (from 1) reaches the level of the number of trailing zeros of i. Every
+  // bundle gets a single entry at BUNDLE_MIN_TIMESTAMP. No other thread may
+  // access the skiplist meanwhile.
+  void bulkLoad(const int tid, const K* const keys, const V* const values,
+                const long long n);
   int rangeQuery(const int tid, const K& lo, const K& hi, K* const resultKeys,
                  V* const resultValues);
-
-  void cleanup(int tid);
+  // Passes each pair in [lo, hi] of a linearizable snapshot to
+  // visit(key, value) in ascending key order, without materializing the result
+  // set. Stops once visit returns false. Returns the number of pairs visited.
+  template <typename Visitor>
+  int rangeQueryVisit(const int tid, const K& lo, const K& hi, Visitor&& visit);
+  // Like rangeQuery(), but returns only the (at most) k smallest keys in the
+  // range. The traversal ends as soon as k keys have been found.
+  int rangeQueryLimit(const int tid, const K& lo, const K& hi, const int k,
+                      K* const resultKeys, V* const resultValues);
+  // Opens a snapshot that the overloads below read repeatedly until it is
+  // closed (see snapshot.h).
+  BundleSnapshot openSnapshot(const int tid);
+  void closeSnapshot(const int tid, BundleSnapshot& s);
+  bool contains(const int tid, const K& key, const BundleSnapshot& s);
+  const pair<V, bool> find(const int tid, const K& key,
+                           const BundleSnapshot& s);
+  int rangeQuery(const int tid, const K& lo, const K& hi, K* const resultKeys,
+                 V* const resultValues, const BundleSnapshot& s);
+  // Returns the value that key had at timestamp ts, which must be readable by
+  // the calling thread (see snapshot.h).
+  const pair<V, bool> findAt(const int tid, const K& key, const timestamp_t ts);
+
+  void cleanup(int tid, int worker = 0, int num_workers = 1);
+#ifdef BUNDLE_CLEANUP_DIRTY
+  void cleanupDirty(int tid, nodeptr node, timestamp_t ts);
+#endif
 
   void initThread(const int tid);
   void deinitThread(const int tid);
@@ -150,27 +229,41 @@ class bundle_skiplist {
 
   RecManager* const debugGetRecMgr() { return recmgr; }
 
-  inline int getKeys(const int tid, node_t<K, V>* node, K* const outputKeys,
-                     V* const outputValues) {
+  inline int getKeys(const int tid, node_t<K, V, Lock>* node,
+                     K* const outputKeys, V* const outputValues) {
     outputKeys[0] = node->key;
     outputValues[0] = node->val;
     return 1;
   }
 
+  // Like getKeys(), but returns the value that node had at timestamp ts.
+  inline int getKeys(const int tid, node_t<K, V, Lock>* node,
+                     K* const outputKeys, V* const outputValues,
+                     timestamp_t ts) {
+    outputKeys[0] = node->key;
+    outputValues[0] = getValue(tid, node, ts);
+    return 1;
+  }
+
+  // Returns the value that node had at timestamp ts.
+  inline V getValue(const int tid, node_t<K, V, Lock>* node, timestamp_t ts) {
+    return node->vals.getByTimestamp(tid, &node->val, ts);
+  }
+
   bool isInRange(const K& key, const K& lo, const K& hi) {
     return (lo <= key && key <= hi);
   }
-  inline bool isLogicallyDeleted(const int tid, node_t<K, V>* node) {
+  inline bool isLogicallyDeleted(const int tid, node_t<K, V, Lock>* node) {
     return (rqProvider->read_addr(tid, &node->marked));
   }
 
-  inline bool isLogicallyInserted(const int tid, node_t<K, V>* node) {
+  inline bool isLogicallyInserted(const int tid, node_t<K, V, Lock>* node) {
     return (rqProvider->read_addr(tid, &node->fullyLinked));
   }
 
   bool validate(const long long keysum, const bool checkkeysum) { return true; }
 
-  node_t<K, V>* debug_getEntryPoint() { return p_head; }
+  node_t<K, V, Lock>* debug_getEntryPoint() { return p_head; }
 
  private:
   // warning: this can only be used when there are no other threads accessing
@@ -195,6 +288,11 @@ class bundle_skiplist {
 
   void stopCleanup() { rqProvider->stopCleanup(); }
 
+  // Sampled bundle and cleanup statistics (see bundle_telemetry.h).
+  string getBundleTelemetryString() { return rqProvider->telemetry_string(); }
+
+  void resetBundleTelemetry() { rqProvider->reset_telemetry(); }
+
   bool validateBundles(int tid);
 
   string getBundleStatsString() {
@@ -202,7 +300,7 @@ class bundle_skiplist {
     nodeptr max_node = nullptr;
     long total = 0;
     stack<nodeptr> s;
-    unordered_set<node_t<K, V>*> unique;
+    unordered_set<node_t<K, V, Lock>*> unique;
     nodeptr curr = p_head;
     nodeptr prev;
     s.push(curr);
@@ -13,27 +13,27 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include "bundle_skiplist.h"
 
 #define CAS __sync_val_compare_and_swap
 
-template <typename K, typename V>
+// The spinning, queueing and backoff are left to the lock policy (see
+// node_locks.h).
+template <typename K, typename V, class Lock>
 static void sl_node_lock(nodeptr p_node) {
-  while (1) {
-    long cur_lock = p_node->lock;
-    if (likely(cur_lock == 0)) {
-      if (likely(CAS(&(p_node->lock), 0, 1) == 0)) {
-        return;
-      }
-    }
-    CPU_RELAX;
-  }
+  p_node->lock.acquire();
 }
 
-template <typename K, typename V>
+template <typename K, typename V, class Lock>
+static bool sl_node_trylock(nodeptr p_node) {
+  return p_node->lock.tryAcquire();
+}
+
+template <typename K, typename V, class Lock>
 static void sl_node_unlock(nodeptr p_node) {
-  p_node->lock = 0;
-  SOFTWARE_BARRIER;
+  p_node->lock.release();
 }
 
 static int sl_randomLevel(const int tid, Random* const threadRNGs) {
@@ -61,21 +61,35 @@ static int sl_randomLevel(const int tid, Random* const threadRNGs) {
   return (c < SKIPLIST_MAX_LEVEL) ? c : SKIPLIST_MAX_LEVEL - 1;
 }
 
-template <typename K, typename V, class RecordMgr>
-void bundle_skiplist<K, V, RecordMgr>::initNode(const int tid, nodeptr p_node,
-                                                K key, V value, int height) {
+template <typename K, typename V, class RecordMgr, class Lock>
+void bundle_skiplist<K, V, RecordMgr, Lock>::initNode(const int tid,
+                                                      nodeptr p_node, K key,
+                                                      V value, int height) {
   p_node->rqbundle.init();
   p_node->key = key;
   p_node->val = value;
+  p_node->vals.init();
   p_node->topLevel = height;
-  p_node->lock = 0;
-  p_node->marked = (long long)0;
+  p_node->lock.init();
+  // A recycled node was marked and fully linked. Clearing fullyLinked first
+  // keeps a stale search finger from seeing it unmarked and fully linked
+  // before it is inserted again (see rangeQueryStart).
   p_node->fullyLinked = (long long)0;
+  p_node->marked = (long long)0;
+#ifdef BUNDLE_CLEANUP_DIRTY
+  p_node->dirty = false;
+#endif
 }
 
-template <typename K, typename V, class RecordMgr>
-nodeptr bundle_skiplist<K, V, RecordMgr>::allocateNode(const int tid) {
-  nodeptr nnode = recmgr->template allocate<node_t<K, V>>(tid);
+template <typename K, typename V, class RecordMgr, class Lock>
+nodeptr bundle_skiplist<K, V, RecordMgr, Lock>::allocateNode(const int tid,
+                                                             const int height) {
+  // Only the levels the node occupies are requested. This saves memory only
+  // with pool_none. Pooled records (e.g., with BUNDLE_POOL_ENTRIES, the
+  // microbenchmark default) may be recycled for any height, so
+  // pool_perthread_and_shared always hands out full-size nodes.
+  nodeptr nnode = recmgr->template allocate<node_t<K, V, Lock>>(
+      tid, node_t<K, V, Lock>::size(height));
   if (nnode == NULL) {
     cout << "ERROR: out of memory" << endl;
     exit(-1);
@@ -83,11 +97,11 @@ nodeptr bundle_skiplist<K, V, RecordMgr>::allocateNode(const int tid) {
   return nnode;
 }
 
-template <typename K, typename V, class RecordMgr>
-int bundle_skiplist<K, V, RecordMgr>::find_impl(const int tid, K key,
-                                                nodeptr* p_preds,
-                                                nodeptr* p_succs,
-                                                nodeptr* p_found) {
+template <typename K, typename V, class RecordMgr, class Lock>
+int bundle_skiplist<K, V, RecordMgr, Lock>::find_impl(const int tid, K key,
+                                                      nodeptr* p_preds,
+                                                      nodeptr* p_succs,
+                                                      nodeptr* p_found) {
   int level;
   int l_found = -1;
   nodeptr p_pred = NULL;
@@ -111,12 +125,10 @@ int bundle_skiplist<K, V, RecordMgr>::find_impl(const int tid, K key,
   return l_found;
 }
 
-template <typename K, typename V, class RecManager>
-bundle_skiplist<K, V, RecManager>::bundle_skiplist(const int numProcesses,
-                                                   const K _KEY_MIN,
-                                                   const K _KEY_MAX,
-                                                   const V NO_VALUE,
-                                                   Random* const threadRNGs)
+template <typename K, typename V, class RecManager, class Lock>
+bundle_skiplist<K, V, RecManager, Lock>::bundle_skiplist(
+    const int numProcesses, const K _KEY_MIN, const K _KEY_MAX,
+    const V NO_VALUE, Random* const threadRNGs)
     : NUM_PROCESSES(numProcesses),
       recmgr(new RecManager(numProcesses, 0)),
       threadRNGs(threadRNGs)
@@ -134,18 +146,20 @@ bundle_skiplist<K, V, RecManager>::bundle_skiplist(const int numProcesses,
   recmgr->initThread(dummyTid);
 
   rqProvider =
-      new RQProvider<K, V, node_t<K, V>, bundle_skiplist<K, V, RecManager>,
-                     RecManager, true, false>(numProcesses, this, recmgr);
+      new RQProvider<K, V, node_t<K, V, Lock>,
+                     bundle_skiplist<K, V, RecManager, Lock>, RecManager, true,
+                     false>(numProcesses, this, recmgr);
 
-  p_tail = allocateNode(dummyTid);
+  p_tail = allocateNode(dummyTid, SKIPLIST_MAX_LEVEL - 1);
   initNode(dummyTid, p_tail, KEY_MAX, NO_VALUE, SKIPLIST_MAX_LEVEL - 1);
 
-  p_head = allocateNode(dummyTid);
+  p_head = allocateNode(dummyTid, SKIPLIST_MAX_LEVEL - 1);
   initNode(dummyTid, p_head, KEY_MIN, NO_VALUE, SKIPLIST_MAX_LEVEL - 1);
 
-  BUNDLE_TYPE_DECL<node_t<K, V>>* bundles[] = {&p_head->rqbundle, nullptr};
+  BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* bundles[] = {
+      &p_head->rqbundle, nullptr};
   nodeptr ptrs[] = {p_tail, nullptr};
-  rqProvider->prepare_bundles(bundles, ptrs);
+  rqProvider->prepare_bundles(dummyTid, bundles, ptrs);
   timestamp_t ts = rqProvider->get_update_lin_time(dummyTid);
 
   for (i = 0; i < SKIPLIST_MAX_LEVEL; i++) {
@@ -153,17 +167,31 @@ bundle_skiplist<K, V, RecManager>::bundle_skiplist(const int numProcesses,
   }
 
   rqProvider->finalize_bundles(bundles, ts);
+
+#ifdef BUNDLE_SKIPLIST_FINGERS
+  for (i = 0; i < MAX_TID_POW2; i++) {
+    for (int level = 0; level < SKIPLIST_MAX_LEVEL; level++) {
+      fingers[i].preds[level] = nullptr;
+    }
+  }
+#endif
 }
 
-template <typename K, typename V, class RecManager>
-bundle_skiplist<K, V, RecManager>::~bundle_skiplist() {
+template <typename K, typename V, class RecManager, class Lock>
+bundle_skiplist<K, V, RecManager, Lock>::~bundle_skiplist() {
   const int dummyTid = 0;
+  rqProvider->stopCleanup();
   nodeptr curr = p_head;
   while (curr->key < KEY_MAX) {
     auto tmp = curr;
     curr = curr->p_next[0];
+    BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* bundles[] = {&tmp->rqbundle, nullptr};
+    rqProvider->retire_bundles(dummyTid, bundles);
+    rqProvider->retire_values(dummyTid, &tmp->vals);
     recmgr->retire(dummyTid, tmp);
   }
+  BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* bundles[] = {&curr->rqbundle, nullptr};
+  rqProvider->retire_bundles(dummyTid, bundles);
   recmgr->retire(dummyTid, curr);
   delete rqProvider;
   recmgr->printStatus();
@@ -173,8 +201,8 @@ bundle_skiplist<K, V, RecManager>::~bundle_skiplist() {
 #endif
 }
 
-template <typename K, typename V, class RecManager>
-void bundle_skiplist<K, V, RecManager>::initThread(const int tid) {
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_skiplist<K, V, RecManager, Lock>::initThread(const int tid) {
   if (init[tid])
     return;
   else
@@ -184,8 +212,8 @@ void bundle_skiplist<K, V, RecManager>::initThread(const int tid) {
   rqProvider->initThread(tid);
 }
 
-template <typename K, typename V, class RecManager>
-void bundle_skiplist<K, V, RecManager>::deinitThread(const int tid) {
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_skiplist<K, V, RecManager, Lock>::deinitThread(const int tid) {
   if (!init[tid])
     return;
   else
@@ -195,8 +223,8 @@ void bundle_skiplist<K, V, RecManager>::deinitThread(const int tid) {
   rqProvider->deinitThread(tid);
 }
 
-template <typename K, typename V, class RecManager>
-bool bundle_skiplist<K, V, RecManager>::contains(const int tid, K key) {
+template <typename K, typename V, class RecManager, class Lock>
+bool bundle_skiplist<K, V, RecManager, Lock>::contains(const int tid, K key) {
   nodeptr p_preds[SKIPLIST_MAX_LEVEL] = {
       0,
   };
@@ -235,9 +263,9 @@ bool bundle_skiplist<K, V, RecManager>::contains(const int tid, K key) {
   }
 }
 
-template <typename K, typename V, class RecManager>
-const pair<V, bool> bundle_skiplist<K, V, RecManager>::find(const int tid,
-                                                            const K& key) {
+template <typename K, typename V, class RecManager, class Lock>
+const pair<V, bool> bundle_skiplist<K, V, RecManager, Lock>::find(
+    const int tid, const K& key) {
   nodeptr p_preds[SKIPLIST_MAX_LEVEL] = {
       0,
   };
@@ -262,10 +290,10 @@ const pair<V, bool> bundle_skiplist<K, V, RecManager>::find(const int tid,
   }
 }
 
-template <typename K, typename V, class RecManager>
-V bundle_skiplist<K, V, RecManager>::doInsert(const int tid, const K& key,
-                                              const V& value,
-                                              bool onlyIfAbsent) {
+template <typename K, typename V, class RecManager, class Lock>
+V bundle_skiplist<K, V, RecManager, Lock>::doInsert(const int tid, const K& key,
+                                                    const V& value,
+                                                    bool onlyIfAbsent) {
   nodeptr p_preds[SKIPLIST_MAX_LEVEL] = {
       0,
   };
@@ -292,21 +320,31 @@ V bundle_skiplist<K, V, RecManager>::doInsert(const int tid, const K& key,
         while (!p_node_found->fullyLinked) {
           CPU_RELAX;
         }  // keep spinning
-        recmgr->enterQuiescentState(tid);
 
         // node is found and fully linked!
         if (onlyIfAbsent) {
+          recmgr->enterQuiescentState(tid);
           ret = p_node_found->val;
 #ifdef RQ_SNAPCOLLECTOR
           rqProvider->insert_readonly_report_target_key(tid, p_node_found);
 #endif
           return ret;
-        } else {
-          cout << "ERROR: insert-replace functionality not implemented for "
-                  "bundle_skiplist_impl"
-               << endl;
-          exit(-1);
         }
+        // Replace the value in place. Only the node itself is locked, since
+        // its links are unchanged.
+        sl_node_lock(p_node_found);
+        if (!p_node_found->marked) {
+          ret = p_node_found->val;
+          rqProvider->update_value(tid, &p_node_found->vals,
+                                   &p_node_found->val, value);
+          BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* dirtyBundles[] = {
+              &p_node_found->rqbundle, nullptr};
+          rqProvider->mark_dirty(tid, p_node_found, dirtyBundles);
+          sl_node_unlock(p_node_found);
+          recmgr->enterQuiescentState(tid);
+          return ret;
+        }
+        sl_node_unlock(p_node_found);
       }
       recmgr->enterQuiescentState(tid);
       continue;  // try again
@@ -328,7 +366,7 @@ V bundle_skiplist<K, V, RecManager>::doInsert(const int tid, const K& key,
     }
 
     if (valid) {
-      p_new_node = allocateNode(tid);  // shmem_none->allocateNode(tid);
+      p_new_node = allocateNode(tid, topLevel);
 #ifdef __HANDLE_STATS
       GSTATS_APPEND(tid, node_allocated_addresses,
                     ((long long)p_new_node) % (1 << 12));
@@ -341,10 +379,10 @@ V bundle_skiplist<K, V, RecManager>::doInsert(const int tid, const K& key,
       }
 
       // Bundle preparation must occur before the node is connected.
-      BUNDLE_TYPE_DECL<node_t<K, V>>* bundles[] = {
+      BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* bundles[] = {
           &p_preds[0]->rqbundle, &p_new_node->rqbundle, nullptr};
       nodeptr ptrs[] = {p_new_node, p_succs[0], nullptr};
-      rqProvider->prepare_bundles(bundles, ptrs);
+      rqProvider->prepare_bundles(tid, bundles, ptrs);
 
       SOFTWARE_BARRIER;
       timestamp_t lin_time = rqProvider->get_update_lin_time(tid);
@@ -357,6 +395,9 @@ V bundle_skiplist<K, V, RecManager>::doInsert(const int tid, const K& key,
       p_new_node->fullyLinked = 1;
       SOFTWARE_BARRIER;
       rqProvider->finalize_bundles(bundles, lin_time);
+      BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* dirtyBundles[] = {
+          &p_preds[0]->rqbundle, nullptr};
+      rqProvider->mark_dirty(tid, p_preds[0], dirtyBundles);
 #ifdef __HANDLE_STATS
       GSTATS_ADD_IX(tid, skiplist_inserted_on_level, 1, topLevel);
 #endif
@@ -378,8 +419,8 @@ V bundle_skiplist<K, V, RecManager>::doInsert(const int tid, const K& key,
   return ret;
 }
 
-template <typename K, typename V, class RecManager>
-V bundle_skiplist<K, V, RecManager>::erase(const int tid, const K& key) {
+template <typename K, typename V, class RecManager, class Lock>
+V bundle_skiplist<K, V, RecManager, Lock>::erase(const int tid, const K& key) {
   nodeptr p_preds[SKIPLIST_MAX_LEVEL] = {
       0,
   };
@@ -434,18 +475,23 @@ V bundle_skiplist<K, V, RecManager>::erase(const int tid, const K& key) {
       }
 
       if (valid) {
-        BUNDLE_TYPE_DECL<node_t<K, V>>* bundles[] = {
+        BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* bundles[] = {
             &p_preds[0]->rqbundle, &p_victim->rqbundle, nullptr};
         nodeptr ptrs[] = {p_victim->p_next[0], p_head, nullptr};
-        rqProvider->prepare_bundles(bundles, ptrs);
+        rqProvider->prepare_bundles(tid, bundles, ptrs);
         timestamp_t lin_time = rqProvider->linearize_update_at_write(
             tid, &p_victim->marked, (long long)1);
         rqProvider->finalize_bundles(bundles, lin_time);
         for (level = topLevel; level >= 0; level--) {
           p_preds[level]->p_next[level] = p_victim->p_next[level];
         }
-        nodeptr deletedNodes[] = {p_victim, nullptr};
-        rqProvider->physical_deletion_succeeded(tid, deletedNodes);
+        BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* dirtyBundles[] = {
+            &p_preds[0]->rqbundle, nullptr};
+        rqProvider->mark_dirty(tid, p_preds[0], dirtyBundles);
+        BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* deletedBundles[] = {
+            &p_victim->rqbundle, nullptr};
+        rqProvider->retire_node(tid, p_victim, deletedBundles);
+        rqProvider->retire_values(tid, &p_victim->vals);
 #ifdef BUNDLE_DEBUG
         if (!p_preds[0]->validate()) {
           timestamp_t unused_ts;
@@ -485,11 +531,340 @@ V bundle_skiplist<K, V, RecManager>::erase(const int tid, const K& key) {
   return ret;
 }
 
-template <typename K, typename V, class RecManager>
-int bundle_skiplist<K, V, RecManager>::rangeQuery(const int tid, const K& lo,
-                                                  const K& hi,
-                                                  K* const resultKeys,
-                                                  V* const resultValues) {
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_skiplist<K, V, RecManager, Lock>::batchUpdate(
+    const int tid, BatchOp<K, V>* const ops, const int n) {
+  // The ops on each key form a window around the position of the key. The
+  // preds and succs of the levels 0..height of a window are stored at offset
+  // in levelPreds and levelSuccs, since few windows span many levels.
+  struct window_t {
+    int first;
+    int len;
+    nodeptr found;  // node holding the key, if any
+    int height;     // topLevel of the found or new node, or -1
+    int offset;
+    bool present;   // the key is present after the batch
+    bool written;   // the batch writes a value for the key
+  };
+  // A link of a locked node that is written once the batch takes its
+  // timestamp.
+  struct link_t {
+    nodeptr node;
+    int level;
+    nodeptr next;
+  };
+  if (n <= 0) return;
+  batchSort(ops, n);
+  std::vector<window_t> windows;
+  std::vector<nodeptr> levelPreds;
+  std::vector<nodeptr> levelSuccs;
+  std::vector<nodeptr> locked;
+  std::vector<nodeptr> created;
+  std::vector<nodeptr> erased;
+  std::vector<link_t> links;
+  std::vector<BUNDLE_TYPE_DECL<node_t<K, V, Lock>>*> bundles;
+  std::vector<nodeptr> ptrs;
+  nodeptr p_preds[SKIPLIST_MAX_LEVEL];
+  nodeptr p_succs[SKIPLIST_MAX_LEVEL];
+  int level;
+  while (true) {
+    recmgr->leaveQuiescentState(tid);
+    windows.clear();
+    levelPreds.clear();
+    levelSuccs.clear();
+    locked.clear();
+
+    // Phase 1. Find every window. Keys are visited in ascending order, so the
+    // search for a key resumes at each level from the preds of the previous
+    // key instead of the head.
+    for (level = 0; level < SKIPLIST_MAX_LEVEL; level++) {
+      p_preds[level] = p_head;
+    }
+    for (int i = 0; i < n;) {
+      const int len = batchRunLength(ops + i, n - i);
+      const K& key = ops[i].key;
+      int lFound = -1;
+      nodeptr p_pred = p_head;
+      for (level = SKIPLIST_MAX_LEVEL - 1; level >= 0; level--) {
+        if (p_preds[level]->key > p_pred->key) p_pred = p_preds[level];
+        nodeptr p_curr = p_pred->p_next[level];
+        while (key > p_curr->key) {
+          p_pred = p_curr;
+          p_curr = p_pred->p_next[level];
+        }
+        if (lFound == -1 && key == p_curr->key) lFound = level;
+        p_preds[level] = p_pred;
+        p_succs[level] = p_curr;
+      }
+      window_t w = {i, len, (lFound != -1 ? p_succs[lFound] : nullptr)};
+      w.present = (w.found != nullptr);
+      V val = NO_VALUE;
+      w.written = batchApply(ops + i, len, NO_VALUE, &w.present, &val);
+      if (w.found == nullptr) {
+        // Absent keys lock their level-0 pred to validate their absence.
+        w.height = (w.present ? sl_randomLevel(tid, threadRNGs) : 0);
+      } else {
+        w.height = (w.present ? -1 : w.found->topLevel);
+        locked.push_back(w.found);
+      }
+      w.offset = levelPreds.size();
+      for (level = 0; level <= w.height; level++) {
+        levelPreds.push_back(p_preds[level]);
+        levelSuccs.push_back(p_succs[level]);
+        locked.push_back(p_preds[level]);
+      }
+      windows.push_back(w);
+      i += len;
+    }
+
+    // Phase 2. Lock in descending key order, like doInsert() and erase(), and
+    // validate.
+    std::sort(locked.begin(), locked.end(), [](nodeptr a, nodeptr b) {
+      return (a->key != b->key ? a->key > b->key : a > b);
+    });
+    locked.erase(std::unique(locked.begin(), locked.end()), locked.end());
+    for (nodeptr p_node : locked) sl_node_lock(p_node);
+    bool valid = true;
+    for (const window_t& w : windows) {
+      if (w.found != nullptr) {
+        valid = (!w.found->marked && w.found->fullyLinked &&
+                 (w.present || w.found->topLevel == w.height));
+      }
+      for (level = 0; valid && level <= w.height; level++) {
+        nodeptr p_pred = levelPreds[w.offset + level];
+        nodeptr p_succ =
+            (w.found != nullptr ? w.found : levelSuccs[w.offset + level]);
+        valid = (!p_pred->marked && !p_succ->marked &&
+                 (p_pred->p_next[level] == p_succ));
+      }
+      if (!valid) break;
+    }
+    if (!valid) {
+      for (nodeptr p_node : locked) sl_node_unlock(p_node);
+      recmgr->enterQuiescentState(tid);
+      continue;
+    }
+
+    // Phase 3. Compute the new links of each level. Links of locked nodes are
+    // staged in links until the batch takes its timestamp, and pending[level]
+    // indexes the latest one of each level. The links of new nodes are
+    // written directly since they are not yet reachable. A window that
+    // overlaps the previous one on some level starts from the last node that
+    // the batch left there.
+    created.clear();
+    erased.clear();
+    links.clear();
+    nodeptr last[SKIPLIST_MAX_LEVEL];
+    bool lastCreated[SKIPLIST_MAX_LEVEL];
+    nodeptr lastPred[SKIPLIST_MAX_LEVEL];
+    nodeptr lastFound[SKIPLIST_MAX_LEVEL];
+    int pending[SKIPLIST_MAX_LEVEL];
+    for (level = 0; level < SKIPLIST_MAX_LEVEL; level++) {
+      lastPred[level] = nullptr;
+      lastFound[level] = nullptr;
+      pending[level] = -1;
+    }
+    auto nextOf = [&](nodeptr p_node, bool isCreated, int l) {
+      if (!isCreated && pending[l] != -1 && links[pending[l]].node == p_node) {
+        return links[pending[l]].next;
+      }
+      return (nodeptr)p_node->p_next[l];
+    };
+    auto setNext = [&](nodeptr p_node, bool isCreated, int l, nodeptr p_next) {
+      if (isCreated) {
+        p_node->p_next[l] = p_next;
+      } else if (pending[l] != -1 && links[pending[l]].node == p_node) {
+        links[pending[l]].next = p_next;
+      } else {
+        pending[l] = links.size();
+        links.push_back({p_node, l, p_next});
+      }
+    };
+    for (const window_t& w : windows) {
+      V val = (w.found != nullptr ? (V)w.found->val : NO_VALUE);
+      bool present = (w.found != nullptr);
+      batchApply(ops + w.first, w.len, NO_VALUE, &present, &val);
+      if ((w.found != nullptr) == w.present) {
+        if (w.present && w.written) {
+          rqProvider->prepare_value(tid, &w.found->vals, &w.found->val, val);
+        }
+        continue;
+      }
+      nodeptr p_new_node = nullptr;
+      if (w.present) {
+        p_new_node = allocateNode(tid, w.height);
+#ifdef __HANDLE_STATS
+        GSTATS_APPEND(tid, node_allocated_addresses,
+                      ((long long)p_new_node) % (1 << 12));
+        GSTATS_ADD_IX(tid, skiplist_inserted_on_level, 1, w.height);
+#endif
+        initNode(tid, p_new_node, ops[w.first].key, val, w.height);
+        sl_node_lock(p_new_node);
+        created.push_back(p_new_node);
+      } else {
+        erased.push_back(w.found);
+      }
+      for (level = 0; level <= w.height; level++) {
+        nodeptr p_pred = levelPreds[w.offset + level];
+        nodeptr p_node = p_pred;
+        bool isCreated = false;
+        if (p_pred == lastPred[level] || p_pred == lastFound[level]) {
+          p_node = last[level];
+          isCreated = lastCreated[level];
+        }
+        if (w.present) {
+          p_new_node->p_next[level] = nextOf(p_node, isCreated, level);
+          setNext(p_node, isCreated, level, p_new_node);
+          last[level] = p_new_node;
+          lastCreated[level] = true;
+        } else {
+          setNext(p_node, isCreated, level, w.found->p_next[level]);
+          last[level] = p_node;
+          lastCreated[level] = isCreated;
+        }
+        lastPred[level] = p_pred;
+        lastFound[level] = w.found;
+      }
+    }
+
+    // Phase 4. Prepare every bundle, then linearize the whole batch at one
+    // timestamp.
+    bundles.clear();
+    ptrs.clear();
+    for (const link_t& link : links) {
+      if (link.level != 0) continue;
+      bundles.push_back(&link.node->rqbundle);
+      ptrs.push_back(link.next);
+    }
+    for (nodeptr p_node : created) {
+      bundles.push_back(&p_node->rqbundle);
+      ptrs.push_back((nodeptr)p_node->p_next[0]);
+    }
+    for (nodeptr p_node : erased) {
+      bundles.push_back(&p_node->rqbundle);
+      ptrs.push_back((nodeptr)p_head);
+    }
+    bundles.push_back(nullptr);
+    ptrs.push_back(nullptr);
+    rqProvider->prepare_bundles(tid, bundles.data(), ptrs.data());
+    SOFTWARE_BARRIER;
+    timestamp_t lin_time = rqProvider->get_update_lin_time(tid);
+    SOFTWARE_BARRIER;
+    for (nodeptr p_node : erased) p_node->marked = (long long)1;
+    for (const link_t& link : links) {
+      link.node->p_next[link.level] = link.next;
+    }
+    for (nodeptr p_node : created) p_node->fullyLinked = 1;
+    SOFTWARE_BARRIER;
+    rqProvider->finalize_bundles(bundles.data(), lin_time);
+    for (const window_t& w : windows) {
+      if (w.found != nullptr && w.present && w.written) {
+        rqProvider->finalize_value(tid, &w.found->vals, lin_time);
+        BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* dirtyBundles[] = {
+            &w.found->rqbundle, nullptr};
+        rqProvider->mark_dirty(tid, w.found, dirtyBundles);
+      }
+    }
+    for (const link_t& link : links) {
+      if (link.level != 0) continue;
+      BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* dirtyBundles[] = {
+          &link.node->rqbundle, nullptr};
+      rqProvider->mark_dirty(tid, link.node, dirtyBundles);
+    }
+    for (nodeptr p_node : erased) {
+      BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* deletedBundles[] = {
+          &p_node->rqbundle, nullptr};
+      rqProvider->retire_node(tid, p_node, deletedBundles);
+      rqProvider->retire_values(tid, &p_node->vals);
+    }
+
+    for (nodeptr p_node : created) sl_node_unlock(p_node);
+    for (nodeptr p_node : locked) sl_node_unlock(p_node);
+    recmgr->enterQuiescentState(tid);
+    return;
+  }
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_skiplist<K, V, RecManager, Lock>::bulkLoad(const int tid,
+                                                       const K* const keys,
+                                                       const V* const values,
+                                                       const long long n) {
+  if (p_head->p_next[0] != p_tail) {
+    cerr << "ERROR: bulkLoad() requires an empty skiplist" << endl;
+    exit(-1);
+  }
+  // last[level] is the node most recently linked at level.
+  nodeptr last[SKIPLIST_MAX_LEVEL];
+  int level;
+  for (level = 0; level < SKIPLIST_MAX_LEVEL; level++) {
+    last[level] = p_head;
+  }
+  for (long long i = 0; i < n; i++) {
+    assert(i == 0 || keys[i - 1] < keys[i]);
+    int topLevel = __builtin_ctzll(i + 1);
+    if (topLevel >= SKIPLIST_MAX_LEVEL) topLevel = SKIPLIST_MAX_LEVEL - 1;
+    nodeptr p_node = allocateNode(tid, topLevel);
+    initNode(tid, p_node, keys[i], values[i], topLevel);
+    p_node->fullyLinked = 1;
+    rqProvider->reset_bundle(tid, &last[0]->rqbundle, p_node);
+    for (level = 0; level <= topLevel; level++) {
+      last[level]->p_next[level] = p_node;
+      last[level] = p_node;
+    }
+  }
+  rqProvider->reset_bundle(tid, &last[0]->rqbundle, p_tail);
+  for (level = 0; level < SKIPLIST_MAX_LEVEL; level++) {
+    last[level]->p_next[level] = p_tail;
+  }
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+nodeptr bundle_skiplist<K, V, RecManager, Lock>::rangeQueryStart(const int tid,
+                                                                 const K& lo) {
+  nodeptr pred = p_head;
+  int level = SKIPLIST_MAX_LEVEL - 1;
+#ifdef BUNDLE_SKIPLIST_FINGERS
+  // Resume the descent at the lowest level whose finger still precedes lo
+  // while its successor does not. A finger may have been erased and recycled
+  // since the last range query, so it is only trusted once it is seen unmarked
+  // and then fully linked. The thread has left the quiescent state, so a node
+  // that is still in the skiplist at that point is not freed until the range
+  // query ends.
+  nodeptr* const finger = fingers[tid].preds;
+  for (int l = 0; l < SKIPLIST_MAX_LEVEL; ++l) {
+    nodeptr p = finger[l];
+    if (p == nullptr || p->marked || !p->fullyLinked) continue;
+    if (p->topLevel < l || p->key >= lo) continue;
+    if (p->p_next[l]->key >= lo) {
+#ifdef __HANDLE_STATS
+      GSTATS_ADD(tid, skiplist_finger_hits, 1);
+#endif
+      pred = p;
+      level = l;
+      break;
+    }
+  }
+#endif
+  for (; level >= 0; level--) {
+    nodeptr curr = pred->p_next[level];
+    while (curr->key < lo) {
+      pred = curr;
+      curr = curr->p_next[level];
+    }
+#ifdef BUNDLE_SKIPLIST_FINGERS
+    finger[level] = pred;
+#endif
+  }
+  return pred;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+int bundle_skiplist<K, V, RecManager, Lock>::rangeQuery(const int tid,
+                                                        const K& lo,
+                                                        const K& hi,
+                                                        K* const resultKeys,
+                                                        V* const resultValues) {
   //    cout<<"rangeQuery(lo="<<lo<<" hi="<<hi<<")"<<endl;
   timestamp_t ts;
   bool ok;
@@ -498,20 +873,12 @@ int bundle_skiplist<K, V, RecManager>::rangeQuery(const int tid, const K& lo,
     // `could_restart` tracks whether or not we have traversed from the head
     // because we don't want range queries whose range immediately follows the
     // head to be counted as restarted.
-    bool could_restart = false;
     int cnt = 0;
     recmgr->leaveQuiescentState(tid, true);
-    nodeptr pred = p_head;
-    nodeptr curr = nullptr;
     // Phase 1. Pre-range traversal
-    for (int level = SKIPLIST_MAX_LEVEL - 1; level >= 0; level--) {
-      curr = pred->p_next[level];
-      while (curr->key < lo) {
-        pred = curr;
-        curr = curr->p_next[level];
-        if (!could_restart) could_restart = true;
-      }
-    }
+    nodeptr pred = rangeQueryStart(tid, lo);
+    nodeptr curr = nullptr;
+    bool could_restart = (pred != p_head);
 
     // Phase 2. Enter snapshot
     ts = rqProvider->start_traversal(tid);
@@ -531,7 +898,7 @@ int bundle_skiplist<K, V, RecManager>::rangeQuery(const int tid, const K& lo,
     // Phase 3. Collect range
     while (curr != nullptr && curr->key <= hi) {
       if (curr->key >= lo) {
-        cnt += getKeys(tid, curr, resultKeys + cnt, resultValues + cnt);
+        cnt += getKeys(tid, curr, resultKeys + cnt, resultValues + cnt, ts);
       }
       ok = curr->rqbundle.getPtrByTimestamp(tid, ts, &curr);
       assert(ok);
@@ -546,22 +913,214 @@ int bundle_skiplist<K, V, RecManager>::rangeQuery(const int tid, const K& lo,
   }
 }
 
-template <typename K, typename V, class RecManager>
-void bundle_skiplist<K, V, RecManager>::cleanup(int tid) {
+template <typename K, typename V, class RecManager, class Lock>
+template <typename Visitor>
+int bundle_skiplist<K, V, RecManager, Lock>::rangeQueryVisit(const int tid,
+                                                             const K& lo,
+                                                             const K& hi,
+                                                             Visitor&& visit) {
+  int cnt = 0;
+  bool ok;
+  recmgr->leaveQuiescentState(tid, true);
+
+  // Phase 1. Pre-range traversal
+  nodeptr pred = rangeQueryStart(tid, lo);
+  nodeptr curr = nullptr;
+
+  // Phase 2. Enter snapshot
+  timestamp_t ts = rqProvider->start_traversal(tid);
+  ok = pred->rqbundle.getPtrByTimestamp(tid, ts, &curr);
+  assert(ok);
+  while (curr->key < lo) {
+    ok = curr->rqbundle.getPtrByTimestamp(tid, ts, &curr);
+    assert(ok);
+  }
+
+  // Phase 3. Visit range. Every bundle has an entry satisfying ts and the tail
+  // bounds the traversal, so no pair is visited twice.
+  while (curr->key <= hi && curr->key != KEY_MAX) {
+    ++cnt;
+    if (!visit(static_cast<K>(curr->key), getValue(tid, curr, ts))) break;
+    ok = curr->rqbundle.getPtrByTimestamp(tid, ts, &curr);
+    assert(ok);
+  }
+
+  // Ending the traversal early releases the cleanup horizon sooner.
+  rqProvider->end_traversal(tid);
+  recmgr->enterQuiescentState(tid);
+  return cnt;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+BundleSnapshot bundle_skiplist<K, V, RecManager, Lock>::openSnapshot(
+    const int tid) {
+  // The thread stays non-quiescent until the snapshot is closed, so no node
+  // reachable at the snapshot's timestamp is freed in between.
+  recmgr->leaveQuiescentState(tid, true);
+  return rqProvider->open_snapshot(tid);
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_skiplist<K, V, RecManager, Lock>::closeSnapshot(const int tid,
+                                                            BundleSnapshot& s) {
+  assert(s.isOpen());
+  rqProvider->close_snapshot(tid, s);
+  recmgr->enterQuiescentState(tid);
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+template <typename Visitor>
+int bundle_skiplist<K, V, RecManager, Lock>::snapshotVisit(const int tid,
+                                                           const timestamp_t ts,
+                                                           const K& lo,
+                                                           const K& hi,
+                                                           Visitor&& visit) {
+  nodeptr p_preds[SKIPLIST_MAX_LEVEL];
+  int cnt = 0;
+  bool ok;
+
+  // Phase 1. Pre-range traversal
+  nodeptr pred = p_head;
+  nodeptr curr = nullptr;
+  for (int level = SKIPLIST_MAX_LEVEL - 1; level >= 0; level--) {
+    curr = pred->p_next[level];
+    while (curr->key < lo) {
+      pred = curr;
+      curr = curr->p_next[level];
+    }
+    p_preds[level] = pred;
+  }
+
+  // Phase 2. Enter snapshot. Unlike in rangeQuery(), ts predates the
+  // traversal, so the predecessor may have been inserted after ts. Its bundle
+  // then has no entry satisfying ts, and the predecessors found at the higher
+  // levels, which precede it, are tried before falling back to the head.
+  int level = 0;
+  while (!p_preds[level]->rqbundle.getPtrByTimestamp(tid, ts, &curr)) {
+    if (++level == SKIPLIST_MAX_LEVEL) {
+      ok = p_head->rqbundle.getPtrByTimestamp(tid, ts, &curr);
+      assert(ok);
+      break;
+    }
+  }
+  while (curr->key < lo) {
+    ok = curr->rqbundle.getPtrByTimestamp(tid, ts, &curr);
+    assert(ok);
+  }
+
+  // Phase 3. Visit range
+  while (curr->key <= hi && curr->key != KEY_MAX) {
+    ++cnt;
+    if (!visit(static_cast<K>(curr->key), getValue(tid, curr, ts))) break;
+    ok = curr->rqbundle.getPtrByTimestamp(tid, ts, &curr);
+    assert(ok);
+  }
+  return cnt;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+bool bundle_skiplist<K, V, RecManager, Lock>::contains(
+    const int tid, const K& key, const BundleSnapshot& s) {
+  return find(tid, key, s).second;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+const pair<V, bool> bundle_skiplist<K, V, RecManager, Lock>::find(
+    const int tid, const K& key, const BundleSnapshot& s) {
+  assert(s.isOpen());
+  return findAt(tid, key, s.ts);
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+const pair<V, bool> bundle_skiplist<K, V, RecManager, Lock>::findAt(
+    const int tid, const K& key, const timestamp_t ts) {
+  pair<V, bool> res(NO_VALUE, false);
+  snapshotVisit(tid, ts, key, key, [&](const K& k, const V& val) {
+    res = pair<V, bool>(val, true);
+    return false;
+  });
+  return res;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+int bundle_skiplist<K, V, RecManager, Lock>::rangeQuery(
+    const int tid, const K& lo, const K& hi, K* const resultKeys,
+    V* const resultValues, const BundleSnapshot& s) {
+  assert(s.isOpen());
+  int cnt = 0;
+  snapshotVisit(tid, s.ts, lo, hi, [&](const K& key, const V& val) {
+    resultKeys[cnt] = key;
+    resultValues[cnt] = val;
+    ++cnt;
+    return true;
+  });
+  return cnt;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+int bundle_skiplist<K, V, RecManager, Lock>::rangeQueryLimit(
+    const int tid, const K& lo, const K& hi, const int k, K* const resultKeys,
+    V* const resultValues) {
+  if (k <= 0) return 0;
+  int cnt = 0;
+  rangeQueryVisit(tid, lo, hi, [&](const K& key, const V& val) {
+    resultKeys[cnt] = key;
+    resultValues[cnt] = val;
+    return ++cnt < k;
+  });
+  return cnt;
+}
+
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_skiplist<K, V, RecManager, Lock>::cleanup(int tid, int worker,
+                                                      int num_workers) {
   recmgr->leaveQuiescentState(tid);
   BUNDLE_INIT_CLEANUP(rqProvider);
-  BUNDLE_CLEAN_BUNDLE(p_head->rqbundle);
-  for (nodeptr curr = p_head->p_next[0]; curr->key != KEY_MAX;
-       curr = curr->p_next[0]) {
-    if (!curr->marked) {
-      BUNDLE_CLEAN_BUNDLE(curr->rqbundle);
+  // The nodes linked at the split level divide the key space into segments,
+  // which are dealt out to the workers in order. A worker only walks the
+  // bottom level of its own segments.
+  const int split = (BUNDLE_CLEANUP_SPLIT_LEVEL < SKIPLIST_MAX_LEVEL
+                         ? BUNDLE_CLEANUP_SPLIT_LEVEL
+                         : SKIPLIST_MAX_LEVEL - 1);
+  int segment = 0;
+  nodeptr end;
+  for (nodeptr start = p_head; start->key != KEY_MAX; start = end, ++segment) {
+    end = start->p_next[split];
+    if (segment % num_workers != worker) continue;
+    // Segment boundaries are compared by key, since end may be unlinked from
+    // the bottom level concurrently.
+    // Nodes are locked so that their entries are not retired concurrently by
+    // an erase. Locked nodes are skipped and cleaned during a later pass.
+    for (nodeptr curr = start; curr->key < end->key; curr = curr->p_next[0]) {
+      if (sl_node_trylock(curr)) {
+        if (!curr->marked) {
+          BUNDLE_CLEAN_BUNDLE(curr->rqbundle);
+          BUNDLE_CLEAN_VALUES(curr->vals);
+        }
+        sl_node_unlock(curr);
+      }
     }
   }
   recmgr->enterQuiescentState(tid);
 }
 
-template <typename K, typename V, class RecManager>
-bool bundle_skiplist<K, V, RecManager>::validateBundles(int tid) {
+#ifdef BUNDLE_CLEANUP_DIRTY
+template <typename K, typename V, class RecManager, class Lock>
+void bundle_skiplist<K, V, RecManager, Lock>::cleanupDirty(int tid,
+                                                           nodeptr node,
+                                                           timestamp_t ts) {
+  // Unlike cleanup(), the lock is always acquired since the node must be
+  // removed from the dirty log.
+  sl_node_lock(node);
+  if (!node->marked) rqProvider->reclaim_values(tid, &node->vals, ts);
+  BUNDLE_TYPE_DECL<node_t<K, V, Lock>>* bundles[] = {&node->rqbundle, nullptr};
+  rqProvider->clean_dirty(tid, node, bundles, ts);
+  sl_node_unlock(node);
+}
+#endif
+
+template <typename K, typename V, class RecManager, class Lock>
+bool bundle_skiplist<K, V, RecManager, Lock>::validateBundles(int tid) {
   bool valid = true;
 #ifdef BUNDLE_DEBUG
   for (nodeptr curr = p_head->p_next[0]; curr->key != KEY_MAX;
@@ -34,6 +34,7 @@ void deinit(const int numThreads);
 void readLock();
 void readUnlock();
 void synchronize(); 
+void synchronizeBatched();
 void registerThread(int id);
 void unregisterThread();
 
@@ -23,6 +23,10 @@ int threads;
 volatile char padding0[256];
 rcu_node** urcu_table;
 volatile char padding1[256];
+volatile unsigned long gpSeq = 0; // odd while a batched grace period runs
+volatile char padding2[256];
+volatile int gpLock = 0; // held by the thread running a batched grace period
+volatile char padding3[256];
 
 __thread long* times; 
 __thread int i; 
@@ -125,6 +129,34 @@ void synchronize() {
 
 #endif  /* RCU_USE_TSC */
 
+/**
+ * Like synchronize(), but concurrent callers share grace periods. A caller
+ * returns once a grace period that started after it was called has ended,
+ * and runs one itself only if no other thread is running one, so a single
+ * grace period covers every caller that arrived before it started.
+ */
+void synchronizeBatched() {
+    // order the caller's writes before reading the sequence number
+    __sync_synchronize();
+    unsigned long seq = gpSeq;
+    // a grace period that is already running (seq is odd) may have started
+    // before the call, so the caller must wait for the next one to end.
+    unsigned long target = (seq + 3) & ~1UL;
+    while (gpSeq < target) {
+        if (gpLock || !__sync_bool_compare_and_swap(&gpLock, 0, 1)) {
+            __asm__ __volatile__("pause;");
+            continue;
+        }
+        if (gpSeq < target) {
+            __sync_fetch_and_add(&gpSeq, 1);
+            synchronize();
+            __sync_fetch_and_add(&gpSeq, 1);
+        }
+        __sync_lock_release(&gpLock);
+        break;
+    }
+}
+
 };
 
 #endif /* URCU_IMPL_H */
@@ -20,6 +20,10 @@ static void acquireLock(volatile int *lock) {
     }
 }
 
+inline bool tryLock(volatile int *lock) {
+    return !(*lock) && __sync_bool_compare_and_swap(lock, false, true);
+}
+
 static void releaseLock(volatile int *lock) {
     *lock = false;
 }
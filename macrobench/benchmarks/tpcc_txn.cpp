@@ -651,11 +651,20 @@ RC tpcc_txn_man::run_delivery(tpcc_query *query) {
     key_low = neworderKey(query->w_id, d_id, 2100);
 #endif
     key_high = neworderKey(query->w_id, d_id, o_id);
+#ifdef INDEX_HAS_RQ_LIMIT
+    // Only the oldest new order is delivered.
+    uint64_t resultKeys[1];
+    itemid_t *resultValues[1];
+    int numResults = index_range_query_limit(
+        _wl->i_neworder, key_low, key_high, 1, resultKeys, resultValues,
+        wh_to_part(query->w_id), true);
+#else
     uint64_t resultKeys[key_high - key_low + 1];
     itemid_t *resultValues[key_high - key_low + 1];
     int numResults =
         index_range_query(_wl->i_neworder, key_low, key_high, resultKeys,
                           resultValues, wh_to_part(query->w_id), true);
+#endif
     if (numResults == 0) {
       continue;  // Maybe there is no new order to deliver.
     }
@@ -21,6 +21,7 @@ algs+=" CITRUS_RQ_BUNDLE"
 algs+=" CITRUS_RQ_UNSAFE"
 algs+=" CITRUS_RQ_VCAS"
 #algs+=" ABTREE_RQ_LOCKFREE ABTREE_RQ_RWLOCK ABTREE_RQ_HTM_RWLOCK ABTREE_RQ_UNSAFE"
+algs+=" ABTREE_RQ_BUNDLE"
 #algs+=" BSLACK_RQ_LOCKFREE BSLACK_RQ_RWLOCK BSLACK_RQ_HTM_RWLOCK BSLACK_RQ_UNSAFE"
 algs+=" SKIPLISTLOCK_RQ_LOCKFREE" # SKIPLISTLOCK_RQ_HTM_RWLOCK SKIPLISTLOCK_RQ_UNSAFE"
 algs+=" SKIPLISTLOCK_RQ_BUNDLE"
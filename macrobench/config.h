@@ -269,6 +269,7 @@ extern TestCases g_test_case;
 #define IDX_CITRUS_RQ_RBUNDLE 155
 #define IDX_SKIPLISTLOCK_RQ_VCAS 156
 #define IDX_CITRUS_RQ_VCAS 157
+#define IDX_ABTREE_RQ_BUNDLE 158
 // WORKLOAD
 #define YCSB 1
 #define TPCC 2
@@ -39,7 +39,8 @@
       (INDEX_STRUCT == IDX_CITRUS_RQ_RBUNDLE) || \
       (INDEX_STRUCT == IDX_CITRUS_RQ_UNSAFE) || \
       (INDEX_STRUCT == IDX_SKIPLISTLOCK_RQ_VCAS) || \
-      (INDEX_STRUCT == IDX_CITRUS_RQ_VCAS)
+      (INDEX_STRUCT == IDX_CITRUS_RQ_VCAS) || \
+      (INDEX_STRUCT == IDX_ABTREE_RQ_BUNDLE)
 #include "index_with_rq.h"
 #elif (INDEX_STRUCT == IDX_BTREE)
 #include "index_btree.h"
@@ -115,6 +115,8 @@ class index_base {
   virtual RC index_remove(KEY_TYPE key) { return RCOK; }
 
   virtual void print_stats() {}
+  // Starts a new measurement window for the statistics of print_stats().
+  virtual void reset_stats() {}
   virtual size_t getNodeSize() { return 0; }
   virtual size_t getDescriptorSize() { return 0; }
 
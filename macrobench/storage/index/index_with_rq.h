@@ -65,7 +65,8 @@ typedef reclaimer_debra<> RECLAIMER_TYPE;
 #elif (INDEX_STRUCT == IDX_SKIPLISTLOCK_RQ_BUNDLE) || \
     (INDEX_STRUCT == IDX_CITRUS_RQ_BUNDLE) ||         \
     (INDEX_STRUCT == IDX_SKIPLISTLOCK_RQ_RBUNDLE) ||  \
-    (INDEX_STRUCT == IDX_CITRUS_RQ_RBUNDLE)
+    (INDEX_STRUCT == IDX_CITRUS_RQ_RBUNDLE) ||        \
+    (INDEX_STRUCT == IDX_ABTREE_RQ_BUNDLE)
 #define RQ_BUNDLE
 #elif (INDEX_STRUCT == IDX_SKIPLISTLOCK_RQ_VCAS) || \
     (INDEX_STRUCT == IDX_CITRUS_RQ_VCAS)
@@ -141,16 +142,18 @@ typedef skiplist<KEY_TYPE, VALUE_TYPE, RECORD_MANAGER_TYPE> INDEX_TYPE;
 #define VALUES_ARRAY_TYPE VALUE_TYPE *
 
 #elif (INDEX_STRUCT == IDX_SKIPLISTLOCK_RQ_BUNDLE)
-#define BUNDLE_LINKED_BUNDLE
 #define BUNDLE_OPTIMIZED_CONTAINS
+#define INDEX_HAS_RQ_LIMIT
 #include "bundle_skiplist_impl.h"
 typedef node_t<KEY_TYPE, VALUE_TYPE> NODE_TYPE;
 typedef bool DESCRIPTOR_TYPE;  // no descriptor
-typedef record_manager<RECLAIMER_TYPE, ALLOCATOR_TYPE, POOL_TYPE, NODE_TYPE>
+typedef record_manager<RECLAIMER_TYPE, ALLOCATOR_TYPE, POOL_TYPE, NODE_TYPE,
+                       BUNDLE_ENTRY_TYPE_DECL<NODE_TYPE>,
+                       ValueEntry<VALUE_TYPE>>
     RECORD_MANAGER_TYPE;
 typedef bundle_skiplist<KEY_TYPE, VALUE_TYPE, RECORD_MANAGER_TYPE> INDEX_TYPE;
-#define INDEX_CONSTRUCTOR_ARGS                   \
-  g_thread_cnt, numeric_limits<KEY_TYPE>::min(), \
+#define INDEX_CONSTRUCTOR_ARGS                                            \
+  g_thread_cnt + BUNDLE_CLEANUP_THREADS, numeric_limits<KEY_TYPE>::min(), \
       numeric_limits<KEY_TYPE>::max() - 1, __NO_VALUE, rngs
 #define CALL_CALCULATE_INDEX_STATS_FOREACH_CHILD(x, depth)
 #define ISLEAF(x) false
@@ -163,7 +166,9 @@ typedef bundle_skiplist<KEY_TYPE, VALUE_TYPE, RECORD_MANAGER_TYPE> INDEX_TYPE;
 using namespace vcas_skiplist_lock;
 typedef node_t<KEY_TYPE, VALUE_TYPE> NODE_TYPE;
 typedef bool DESCRIPTOR_TYPE;  // no descriptor
-typedef record_manager<RECLAIMER_TYPE, ALLOCATOR_TYPE, POOL_TYPE, NODE_TYPE>
+typedef record_manager<RECLAIMER_TYPE, ALLOCATOR_TYPE, POOL_TYPE, NODE_TYPE,
+                       vcas_obj_t<long long>,
+                       vcas_obj_t<NODE_TYPE *>>
     RECORD_MANAGER_TYPE;
 typedef skiplist<KEY_TYPE, VALUE_TYPE, RECORD_MANAGER_TYPE> INDEX_TYPE;
 #define INDEX_CONSTRUCTOR_ARGS                   \
@@ -188,16 +193,19 @@ typedef unsafe_skiplist<KEY_TYPE, VALUE_TYPE, RECORD_MANAGER_TYPE> INDEX_TYPE;
 #define VALUES_ARRAY_TYPE VALUE_TYPE *
 
 #elif (INDEX_STRUCT == IDX_CITRUS_RQ_BUNDLE)
-#define BUNDLE_LINKED_BUNDLE
 #define BUNDLE_OPTIMIZED_CONTAINS
+#define INDEX_HAS_RQ_LIMIT
 #include "bundle_citrus_impl.h"
 typedef node_t<KEY_TYPE, VALUE_TYPE> NODE_TYPE;
 typedef bool DESCRIPTOR_TYPE;  // no descriptor
-typedef record_manager<RECLAIMER_TYPE, ALLOCATOR_TYPE, POOL_TYPE, NODE_TYPE>
+typedef record_manager<RECLAIMER_TYPE, ALLOCATOR_TYPE, POOL_TYPE, NODE_TYPE,
+                       BUNDLE_ENTRY_TYPE_DECL<NODE_TYPE>,
+                       ValueEntry<VALUE_TYPE>>
     RECORD_MANAGER_TYPE;
 typedef bundle_citrustree<KEY_TYPE, VALUE_TYPE, RECORD_MANAGER_TYPE> INDEX_TYPE;
-#define INDEX_CONSTRUCTOR_ARGS \
-  numeric_limits<KEY_TYPE>::max(), __NO_VALUE, g_thread_cnt
+#define INDEX_CONSTRUCTOR_ARGS                 \
+  numeric_limits<KEY_TYPE>::max(), __NO_VALUE, \
+      g_thread_cnt + BUNDLE_CLEANUP_THREADS
 #define ISLEAF(x) ((x)->child[0] == NULL && (x)->child[1] == NULL)
 #define CALL_CALCULATE_INDEX_STATS_FOREACH_CHILD(x, depth) \
   {                                                        \
@@ -213,7 +221,8 @@ typedef bundle_citrustree<KEY_TYPE, VALUE_TYPE, RECORD_MANAGER_TYPE> INDEX_TYPE;
 using namespace vcas_citrus;
 typedef node_t<KEY_TYPE, VALUE_TYPE> NODE_TYPE;
 typedef bool DESCRIPTOR_TYPE;  // no descriptor
-typedef record_manager<RECLAIMER_TYPE, ALLOCATOR_TYPE, POOL_TYPE, NODE_TYPE>
+typedef record_manager<RECLAIMER_TYPE, ALLOCATOR_TYPE, POOL_TYPE, NODE_TYPE,
+                       vcas_obj_t<NODE_TYPE *>>
     RECORD_MANAGER_TYPE;
 typedef citrustree<KEY_TYPE, VALUE_TYPE, RECORD_MANAGER_TYPE> INDEX_TYPE;
 #define INDEX_CONSTRUCTOR_ARGS \
@@ -291,6 +300,33 @@ typedef bslack<ABTREE_DEGREE, KEY_TYPE, less<KEY_TYPE>, RECORD_MANAGER_TYPE>
   }
 #define ISLEAF(x) (x)->isLeaf()
 #define VALUES_ARRAY_TYPE void **
+
+#elif (INDEX_STRUCT == IDX_ABTREE_RQ_BUNDLE)
+#define USE_SIMPLIFIED_ABTREE_REBALANCING
+#define BUNDLE_LOCKFREE
+#define INDEX_HAS_RQ_LIMIT
+#include "bundle_abtree_impl.h"
+using namespace bundle_abtree_ns;
+#define ABTREE_DEGREE 16
+typedef Node<ABTREE_DEGREE, KEY_TYPE> NODE_TYPE;
+typedef SCXRecord<ABTREE_DEGREE, KEY_TYPE> DESCRIPTOR_TYPE;
+typedef record_manager<RECLAIMER_TYPE, ALLOCATOR_TYPE, POOL_TYPE, NODE_TYPE,
+                       BUNDLE_ENTRY_TYPE_DECL<NODE_TYPE>>
+    RECORD_MANAGER_TYPE;
+typedef bundle_abtree<ABTREE_DEGREE, KEY_TYPE, less<KEY_TYPE>,
+                      RECORD_MANAGER_TYPE>
+    INDEX_TYPE;
+#define INDEX_CONSTRUCTOR_ARGS                                         \
+  g_thread_cnt + BUNDLE_CLEANUP_THREADS, ABTREE_DEGREE, __NO_KEY, \
+      SIGQUIT
+#define CALL_CALCULATE_INDEX_STATS_FOREACH_CHILD(x, depth)         \
+  {                                                                \
+    for (int __i = 0; __i < (x)->getABDegree(); ++__i) {           \
+      calculate_index_stats((NODE_TYPE *)(x)->ptrs[__i], (depth)); \
+    }                                                              \
+  }
+#define ISLEAF(x) (x)->isLeaf()
+#define VALUES_ARRAY_TYPE void **
 #endif
 
 /**
@@ -385,7 +421,8 @@ class index_with_rq : public index_base {
     (INDEX_STRUCT == IDX_CITRUS_RQ_HTM_RWLOCK) || \
     (INDEX_STRUCT == IDX_CITRUS_RQ_UNSAFE) ||     \
     (INDEX_STRUCT == IDX_CITRUS_RQ_RLU) || \
-    (INDEX_STRUCT == IDX_CITRUS_RQ_VCAS)
+    (INDEX_STRUCT == IDX_CITRUS_RQ_VCAS) || \
+    (INDEX_STRUCT == IDX_ABTREE_RQ_BUNDLE)
     const void *oldVal = (VALUE_TYPE)index->erase(tid, key).first;
 #else
     const void *oldVal = index->erase(tid, key);
@@ -412,6 +449,18 @@ class index_with_rq : public index_base {
     INCREMENT_NUM_RQS(tid);
     return RCOK;
   }
+#ifdef INDEX_HAS_RQ_LIMIT
+  // like index_range_query, but only finds the (at most) k smallest keys in
+  // [low, high], so resultKeys and resultValues need only hold k entries.
+  RC index_range_query_limit(KEY_TYPE low, KEY_TYPE high, int k,
+                             KEY_TYPE *resultKeys, VALUE_TYPE *resultValues,
+                             int *numResults, int part_id = -1) {
+    *numResults = index->rangeQueryLimit(tid, low, high, k, resultKeys,
+                                         (VALUES_ARRAY_TYPE)resultValues);
+    INCREMENT_NUM_RQS(tid);
+    return RCOK;
+  }
+#endif
   void initThread(const int tid) { index->initThread(tid); }
   void deinitThread(const int tid) { index->deinitThread(tid); }
 
@@ -435,6 +484,15 @@ class index_with_rq : public index_base {
       cout << "Alignment " << i * 8 << ": "
            << (alignment[i] / (double)num_nodes) * 100 << "%" << endl;
     }
+#if defined(RQ_BUNDLE) && defined(BUNDLE_TELEMETRY)
+    cout << index->getBundleTelemetryString();
+#endif
+  }
+
+  void reset_stats() {
+#if defined(RQ_BUNDLE) && defined(BUNDLE_TELEMETRY)
+    index->resetBundleTelemetry();
+#endif
   }
 };
 
@@ -187,7 +187,8 @@ enum TsType {R_REQ, W_REQ, P_REQ, XP_REQ};
         (INDEX_STRUCT == IDX_SKIPLISTLOCK_RQ_VCAS) || \
         (INDEX_STRUCT == IDX_CITRUS_RQ_BUNDLE) || \
         (INDEX_STRUCT == IDX_CITRUS_RQ_RBUNDLE) || \
-        (INDEX_STRUCT == IDX_CITRUS_RQ_VCAS)
+        (INDEX_STRUCT == IDX_CITRUS_RQ_VCAS) || \
+        (INDEX_STRUCT == IDX_ABTREE_RQ_BUNDLE)
 #define INDEX           index_with_rq
 #elif (INDEX_STRUCT == IDX_BST)
 #define INDEX           index_bst
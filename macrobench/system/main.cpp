@@ -150,6 +150,12 @@ int main(int argc, char *argv[]) {
 #endif
   pthread_barrier_init(&warmup_bar, NULL, g_thread_cnt);
 
+  // Leave loading and warmup out of the index statistics.
+  for (map<string, INDEX *>::iterator it = m_wl->indexes.begin();
+       it != m_wl->indexes.end(); it++) {
+    it->second->reset_stats();
+  }
+
   // spawn and run txns again.
   RLU_INIT(RLU_TYPE_FINE_GRAINED, 1);
   int64_t starttime = get_server_clock();
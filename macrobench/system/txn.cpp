@@ -202,6 +202,25 @@ txn_man::index_range_query(INDEX * index, idx_key_t low, idx_key_t high, idx_key
 }
 #endif
 
+#ifdef INDEX_HAS_RQ_LIMIT
+// perform range query over [low, high] that stops after k keys
+// return number N <= k of keys found
+// set results[0...N-1] to the values associated with the N smallest keys
+int
+txn_man::index_range_query_limit(INDEX * index, idx_key_t low, idx_key_t high, int k, idx_key_t * resultKeys, itemid_t ** resultValues, int part_id, bool countLen) {
+	uint64_t starttime = get_sys_clock();
+	int numResults = 0;
+	index->index_range_query_limit(low, high, k, resultKeys, resultValues, &numResults, part_id);
+	INC_TMP_STATS(get_thd_id(), stats_indexes[index->index_id].numRangeQuery, 1);
+	INC_TMP_STATS(get_thd_id(), stats_indexes[index->index_id].timeRangeQuery, get_sys_clock() - starttime);
+	if (countLen) {
+		INC_TMP_STATS(get_thd_id(), stats_indexes[index->index_id].lenRangeQuery, numResults);
+		INC_TMP_STATS(get_thd_id(), stats_indexes[index->index_id].numLenRangeQuery, 1);
+	}
+	return numResults;
+}
+#endif
+
 itemid_t *
 txn_man::index_read(INDEX * index, idx_key_t key, int part_id) {
 	uint64_t starttime = get_sys_clock();
@@ -89,6 +89,10 @@ class txn_man {
   int index_range_query(INDEX* index, idx_key_t low, idx_key_t high,
                         idx_key_t* resultKeys, itemid_t** resultValues,
                         int part_id, bool countLen = false);
+  int index_range_query_limit(INDEX* index, idx_key_t low, idx_key_t high,
+                              int k, idx_key_t* resultKeys,
+                              itemid_t** resultValues, int part_id,
+                              bool countLen = false);
   itemid_t* index_read(INDEX* index, idx_key_t key, int part_id);
   void index_read(INDEX* index, idx_key_t key, int part_id, itemid_t** item);
   void index_insert(INDEX* index, uint64_t key, row_t* row, int64_t part_id);
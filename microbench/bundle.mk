@@ -11,6 +11,93 @@
 ## bundle entries
 # FLAGS += -DBUNDLE_CLEANUP_BACKGROUND
 # FLAGS += -DBUNDLE_CLEANUP_SLEEP=10000  # microseconds
+## Background cleanup is split among CLEANUP_THREADS workers 
+## (default 1), which are spread over the NUMA nodes. A worker sleeps 
+## between CLEANUP_SLEEP_MIN and CLEANUP_SLEEP microseconds, sleeping 
+## less while its passes reclaim more than CLEANUP_TARGET records. 
+## Lists are split into runs of CLEANUP_CHUNK nodes, skip lists at the 
+## nodes of CLEANUP_SPLIT_LEVEL and trees into the subtrees at 
+## CLEANUP_SPLIT_DEPTH (at most 8).
+# FLAGS += -DBUNDLE_CLEANUP_THREADS=1
+# FLAGS += -DBUNDLE_CLEANUP_SLEEP_MIN=10  # microseconds
+# FLAGS += -DBUNDLE_CLEANUP_TARGET=1024
+# FLAGS += -DBUNDLE_CLEANUP_CHUNK=64
+# FLAGS += -DBUNDLE_CLEANUP_SPLIT_LEVEL=6
+# FLAGS += -DBUNDLE_CLEANUP_SPLIT_DEPTH=6
+## With CLEANUP_DIRTY, updates log every node whose bundle they 
+## extend in a per-thread log of DIRTY_LOG_SIZE entries, and the 
+## background workers only clean logged nodes instead of sweeping 
+## the whole structure. Requires CLEANUP_BACKGROUND.
+# FLAGS += -DBUNDLE_CLEANUP_DIRTY
+# FLAGS += -DBUNDLE_DIRTY_LOG_SIZE=16384
+# --------------------------
+
+## Bundle entries are allocated through the data structure's record 
+## manager. BUNDLE_POOL_ENTRIES recycles reclaimed entries (and nodes) 
+## through per-thread pools instead of returning them to the allocator. 
+## Pooled records are full-size, so the bundled skiplist only allocates 
+## nodes in proportion to their height when this is commented out.
+FLAGS += -DBUNDLE_POOL_ENTRIES
+# --------------------------
+
+## TELEMETRY reports bundle lengths (sampled once every 
+## TELEMETRY_SAMPLE bundle extensions), entries allocated and 
+## reclaimed per second, the lag of the oldest active range query 
+## behind the current timestamp (sampled once every TELEMETRY_SAMPLE 
+## range queries) and the duration of cleanup passes after each run 
+## (see bundle_telemetry.h).
+FLAGS += -DBUNDLE_TELEMETRY
+# FLAGS += -DBUNDLE_TELEMETRY_SAMPLE=64
+# --------------------------
+
+## Bundle implementation. The *.rq_bundle targets use linked bundles, 
+## *.rq_ibundle targets store the newest entry inline and *.rq_cbundle 
+## targets use rings of entries. BUNDLE_CIRCULAR_CAPACITY sets the number 
+## of entries per ring (default 8).
+# FLAGS += -DBUNDLE_CIRCULAR_CAPACITY=8
+# --------------------------
+
+## Timestamp source. By default every update increments a global 
+## counter (TIMESTAMP_GLOBAL). TIMESTAMP_TSC labels operations with 
+## the invariant TSC instead and assumes it is synchronized across 
+## sockets. TIMESTAMP_NUMA replicates an epoch that is advanced by 
+## range queries once per NUMA node, so updates only read a node-local 
+## cache line. TIMESTAMP_NUMA_NODES bounds the number of replicas 
+## (default 8).
+# FLAGS += -DBUNDLE_TIMESTAMP_TSC
+# FLAGS += -DBUNDLE_TIMESTAMP_NUMA
+# FLAGS += -DBUNDLE_TIMESTAMP_NUMA_NODES=8
+# --------------------------
+
+## Per-node lock of the lazylist and skiplist (see node_locks.h): 
+## TASNodeLock (default), MCSNodeLock or HBONodeLock. HBO waiters on 
+## the holder's NUMA node back off for HBO_LOCAL_BACKOFF pauses and 
+## remote ones for HBO_REMOTE_BACKOFF, doubling up to HBO_MAX_BACKOFF.
+# FLAGS += -DBUNDLE_NODE_LOCK=MCSNodeLock
+# FLAGS += -DBUNDLE_HBO_LOCAL_BACKOFF=16
+# FLAGS += -DBUNDLE_HBO_REMOTE_BACKOFF=256
+# FLAGS += -DBUNDLE_HBO_MAX_BACKOFF=4096
+# --------------------------
+
+## CITRUS_PACKED_NODE aligns citrus nodes to cache lines and places 
+## the fields read by searches first, followed by the bundles (see 
+## bundle_citrus.h).
+# FLAGS += -DBUNDLE_CITRUS_PACKED_NODE
+# --------------------------
+
+## With CITRUS_BATCHED_SYNC, citrus deletes of nodes with two 
+## children share RCU grace periods: a delete that needs one waits 
+## for a grace period already started on its behalf by another 
+## thread instead of running its own (see urcu_impl.h).
+# FLAGS += -DBUNDLE_CITRUS_BATCHED_SYNC
+# --------------------------
+
+## With SKIPLIST_FINGERS, each thread remembers the predecessors 
+## found by its last skiplist range query and starts the next one 
+## from them when its lower bound is nearby, instead of descending 
+## from the head. Requires POOL_ENTRIES, since a remembered node may 
+## be reclaimed.
+# FLAGS += -DBUNDLE_SKIPLIST_FINGERS
 # --------------------------
 
 ## Helpful flags for debugging.
@@ -20,4 +107,7 @@
 # FLAGS += -DBUNDLE_PRINT_BUNDLE_STATS
 # ---------------------------
 # FLAGS += -DBUNDLE_CLEANUP_UPDATE
+## Updates that clean up bundles rescan the range query announcements 
+## once every HORIZON_REFRESH bundles (default 64).
+# FLAGS += -DBUNDLE_HORIZON_REFRESH=64
 # ------------------------.
@@ -31,6 +31,12 @@ const test_type KEY_MAX =
 #define RQ_FUNC rangeQuery
 #endif
 
+// Per-node lock policy of the lock-based bundled structures (see
+// node_locks.h).
+#ifndef BUNDLE_NODE_LOCK
+#define BUNDLE_NODE_LOCK TASNodeLock
+#endif
+
 #ifndef INSERT_FUNC
 #define INSERT_FUNC insert
 #endif
@@ -43,7 +49,8 @@ const test_type KEY_MAX =
 #define FIND_FUNC contains
 #endif
 
-#if defined ABTREE || defined BSLACK
+#if defined ABTREE || defined BSLACK || defined BUNDLE_ABTREE || \
+    defined BUNDLE_BSLACK
 #define VALUE ((void *)(int64_t)key)
 #define KEY keys[0]
 #define VALUE_TYPE void *
@@ -333,15 +340,20 @@ rlu_thread_data_t *rlu_tdata = NULL;
        << " including header=" << RLU_OBJ_HEADER_SIZE << endl;
 
 #elif defined(BUNDLE_LIST)
-#define BUNDLE_TYPE_DECL LinkedBundle
 #include "record_manager.h"
 #include "bundle_lazylist_impl.h"
 
-#define DS_DECLARATION bundle_lazylist<test_type, test_type, MEMMGMT_T>
-#define MEMMGMT_T \
-  record_manager<RECLAIM, ALLOC, POOL, node_t<test_type, test_type>>
-#define DS_CONSTRUCTOR \
-  new DS_DECLARATION(TOTAL_THREADS + 1, KEY_MIN, KEY_MAX, NO_VALUE)
+#define DS_DECLARATION \
+  bundle_lazylist<test_type, test_type, MEMMGMT_T, BUNDLE_NODE_LOCK>
+#define MEMMGMT_T                                                     \
+  record_manager<RECLAIM, ALLOC, POOL,                                \
+                 node_t<test_type, test_type, BUNDLE_NODE_LOCK>,      \
+                 BUNDLE_ENTRY_TYPE_DECL<                              \
+                     node_t<test_type, test_type, BUNDLE_NODE_LOCK>>, \
+                 ValueEntry<test_type>>
+#define DS_CONSTRUCTOR                                                   \
+  new DS_DECLARATION(TOTAL_THREADS + BUNDLE_CLEANUP_THREADS, KEY_MIN, KEY_MAX, \
+                     NO_VALUE)
 
 #define INSERT_AND_CHECK_SUCCESS \
   ds->INSERT_FUNC(tid, key, VALUE) == ds->NO_VALUE
@@ -351,6 +363,8 @@ rlu_thread_data_t *rlu_tdata = NULL;
   rqcnt = ds->RQ_FUNC(tid, key, key + RQSIZE - 1, rqResultKeys, \
                       (VALUE_TYPE *)rqResultValues)
 #define RQ_GARBAGE(rqcnt) rqResultKeys[0] + rqResultKeys[rqcnt - 1]
+#define BULK_LOAD(tid, keys, values, n) ds->bulkLoad(tid, keys, values, n)
+#define BATCH_UPDATE(tid, ops, n) ds->batchUpdate(tid, ops, n)
 #define INIT_THREAD(tid) ds->initThread(tid)
 #define INIT_RQ_THREAD(tid) ds->initThread(tid, true)
 #define DEINIT_THREAD(tid) ds->deinitThread(tid);
@@ -372,11 +386,17 @@ rlu_thread_data_t *rlu_tdata = NULL;
 #include "record_manager.h"
 #include "bundle_skiplist_impl.h"
 
-#define DS_DECLARATION bundle_skiplist<test_type, test_type, MEMMGMT_T>
-#define MEMMGMT_T \
-  record_manager<RECLAIM, ALLOC, POOL, node_t<test_type, test_type>>
-#define DS_CONSTRUCTOR \
-  new DS_DECLARATION(TOTAL_THREADS + 1, KEY_MIN, KEY_MAX, NO_VALUE, glob.rngs)
+#define DS_DECLARATION \
+  bundle_skiplist<test_type, test_type, MEMMGMT_T, BUNDLE_NODE_LOCK>
+#define MEMMGMT_T                                                     \
+  record_manager<RECLAIM, ALLOC, POOL,                                \
+                 node_t<test_type, test_type, BUNDLE_NODE_LOCK>,      \
+                 BUNDLE_ENTRY_TYPE_DECL<                              \
+                     node_t<test_type, test_type, BUNDLE_NODE_LOCK>>, \
+                 ValueEntry<test_type>>
+#define DS_CONSTRUCTOR                                                   \
+  new DS_DECLARATION(TOTAL_THREADS + BUNDLE_CLEANUP_THREADS, KEY_MIN, KEY_MAX, \
+                     NO_VALUE, glob.rngs)
 
 #define INSERT_AND_CHECK_SUCCESS \
   ds->INSERT_FUNC(tid, key, VALUE) == ds->NO_VALUE
@@ -386,6 +406,8 @@ rlu_thread_data_t *rlu_tdata = NULL;
   rqcnt = ds->RQ_FUNC(tid, key, key + RQSIZE - 1, rqResultKeys, \
                       (VALUE_TYPE *)rqResultValues)
 #define RQ_GARBAGE(rqcnt) rqResultKeys[0] + rqResultKeys[rqcnt - 1]
+#define BULK_LOAD(tid, keys, values, n) ds->bulkLoad(tid, keys, values, n)
+#define BATCH_UPDATE(tid, ops, n) ds->batchUpdate(tid, ops, n)
 #define INIT_THREAD(tid) ds->initThread(tid)
 #define DEINIT_THREAD(tid) ds->deinitThread(tid);
 #define VALIDATE_BUNDLES                                  \
@@ -402,14 +424,16 @@ rlu_thread_data_t *rlu_tdata = NULL;
        << " including header=" << BUNDLE_OBJ_SIZE << endl;
 
 #elif defined(BUNDLE_CITRUS)
-#define BUNDLE_TYPE_DECL LinkedBundle
 #include "bundle_citrus_impl.h"
 #include "record_manager.h"
 
 #define DS_DECLARATION bundle_citrustree<test_type, test_type, MEMMGMT_T>
-#define MEMMGMT_T \
-  record_manager<RECLAIM, ALLOC, POOL, node_t<test_type, test_type>>
-#define DS_CONSTRUCTOR new DS_DECLARATION(KEY_MAX, NO_VALUE, TOTAL_THREADS + 1)
+#define MEMMGMT_T                                                      \
+  record_manager<RECLAIM, ALLOC, POOL, node_t<test_type, test_type>,   \
+                 BUNDLE_ENTRY_TYPE_DECL<node_t<test_type, test_type>>, \
+                 ValueEntry<test_type>>
+#define DS_CONSTRUCTOR \
+  new DS_DECLARATION(KEY_MAX, NO_VALUE, TOTAL_THREADS + BUNDLE_CLEANUP_THREADS)
 
 #define INSERT_AND_CHECK_SUCCESS \
   ds->INSERT_FUNC(tid, key, VALUE) == ds->NO_VALUE
@@ -419,6 +443,7 @@ rlu_thread_data_t *rlu_tdata = NULL;
   rqcnt = ds->RQ_FUNC(tid, key, key + RQSIZE - 1, rqResultKeys, \
                       (VALUE_TYPE *)rqResultValues)
 #define RQ_GARBAGE(rqcnt) rqResultKeys[0] + rqResultKeys[rqcnt - 1]
+#define BULK_LOAD(tid, keys, values, n) ds->bulkLoad(tid, keys, values, n)
 #define INIT_THREAD(tid) \
   ds->initThread(tid);   \
   urcu::registerThread(tid);
@@ -429,10 +454,10 @@ rlu_thread_data_t *rlu_tdata = NULL;
   ((DS_DECLARATION *)glob.__ds)->validateBundles(0)       \
       ? std::cout << "Bundle validation OK." << std::endl \
       : std::cout << "Bundle validation failed." << std::endl;
-#define INIT_ALL urcu::init(TOTAL_THREADS + 1);
+#define INIT_ALL urcu::init(TOTAL_THREADS + BUNDLE_CLEANUP_THREADS);
 #define DEINIT_ALL  \
   VALIDATE_BUNDLES; \
-  urcu::deinit(TOTAL_THREADS + 1);
+  urcu::deinit(TOTAL_THREADS + BUNDLE_CLEANUP_THREADS);
 
 #define BUNDLE_OBJ_SIZE (sizeof(BUNDLE_TYPE_DECL<node_t<test_type, test_type>>))
 #define PRINT_OBJ_SIZES                                              \
@@ -441,18 +466,18 @@ rlu_thread_data_t *rlu_tdata = NULL;
        << " including header=" << BUNDLE_OBJ_SIZE << endl;
 
 #elif defined(BUNDLE_BST)
-#define BUNDLE_TYPE_DECL LinkedBundle
-#define BUNDLE_LOCKFREE
 #include "bundle_bst_impl.h"
 #include "record_manager.h"
 using namespace bundle_bst_ns;
 
 #define DS_DECLARATION \
   bundle_bst<test_type, test_type, less<test_type>, MEMMGMT_T>
-#define MEMMGMT_T \
-  record_manager<RECLAIM, ALLOC, POOL, Node<test_type, test_type>>
-#define DS_CONSTRUCTOR \
-  new DS_DECLARATION(KEY_MAX, NO_VALUE, TOTAL_THREADS + 1, SIGQUIT)
+#define MEMMGMT_T                                                     \
+  record_manager<RECLAIM, ALLOC, POOL, Node<test_type, test_type>,    \
+                 BUNDLE_ENTRY_TYPE_DECL<Node<test_type, test_type>>>
+#define DS_CONSTRUCTOR                                                  \
+  new DS_DECLARATION(KEY_MAX, NO_VALUE,                                 \
+                     TOTAL_THREADS + BUNDLE_CLEANUP_THREADS, SIGQUIT)
 
 #define INSERT_AND_CHECK_SUCCESS \
   ds->INSERT_FUNC(tid, key, VALUE) == ds->NO_VALUE
@@ -464,14 +489,62 @@ using namespace bundle_bst_ns;
 #define RQ_GARBAGE(rqcnt) rqResultKeys[0] + rqResultKeys[(rqcnt)-1]
 #define INIT_THREAD(tid) ds->initThread(tid)
 #define DEINIT_THREAD(tid) ds->deinitThread(tid)
+#define VALIDATE_BUNDLES                                  \
+  ((DS_DECLARATION *)glob.__ds)->validateBundles(0)       \
+      ? std::cout << "Bundle validation OK." << std::endl \
+      : std::cout << "Bundle validation failed." << std::endl;
 #define INIT_ALL
-#define DEINIT_ALL
+#define DEINIT_ALL VALIDATE_BUNDLES;
 
-#define BUNDLE_OBJ_SIZE (sizeof(Bundle<node_t<test_type, test_type>>))
-#define PRINT_OBJ_SIZES                                          \
-  cout << "sizes: node=" << (sizeof(Node<test_type, test_type>)) \
+#define BUNDLE_OBJ_SIZE (sizeof(BUNDLE_TYPE_DECL<Node<test_type, test_type>>))
+#define PRINT_OBJ_SIZES                                                    \
+  cout << "sizes: node=" << (sizeof(Node<test_type, test_type>))           \
+       << " including bundles=" << (2 * BUNDLE_OBJ_SIZE)                   \
        << " descriptor=" << (sizeof(SCXRecord<test_type, test_type>)) << endl;
 
+#elif defined(BUNDLE_ABTREE) || defined(BUNDLE_BSLACK)
+#if defined(BUNDLE_ABTREE)
+#define USE_SIMPLIFIED_ABTREE_REBALANCING
+#endif
+#define ABTREE_DEGREE 16
+#include "bundle_abtree_impl.h"
+#include "record_manager.h"
+using namespace bundle_abtree_ns;
+
+#define DS_DECLARATION \
+  bundle_abtree<ABTREE_DEGREE, test_type, less<test_type>, MEMMGMT_T>
+#define MEMMGMT_T                                                 \
+  record_manager<RECLAIM, ALLOC, POOL, Node<ABTREE_DEGREE, test_type>, \
+                 BUNDLE_ENTRY_TYPE_DECL<Node<ABTREE_DEGREE, test_type>>>
+#define DS_CONSTRUCTOR                                                   \
+  new DS_DECLARATION(TOTAL_THREADS + BUNDLE_CLEANUP_THREADS, ABTREE_DEGREE, \
+                     KEY_MAX, SIGQUIT)
+
+#define INSERT_AND_CHECK_SUCCESS \
+  ds->INSERT_FUNC(tid, key, VALUE) == ds->NO_VALUE
+#define DELETE_AND_CHECK_SUCCESS ds->ERASE_FUNC(tid, key).second
+#define FIND_AND_CHECK_SUCCESS ds->FIND_FUNC(tid, key)
+#define RQ_AND_CHECK_SUCCESS(rqcnt)                               \
+  (rqcnt) = ds->RQ_FUNC(tid, key, key + RQSIZE - 1, rqResultKeys, \
+                        (VALUE_TYPE *)rqResultValues)
+#define RQ_GARBAGE(rqcnt) rqResultKeys[0] + rqResultKeys[(rqcnt)-1]
+#define INIT_THREAD(tid) ds->initThread(tid)
+#define DEINIT_THREAD(tid) ds->deinitThread(tid)
+#define VALIDATE_BUNDLES                                  \
+  ((DS_DECLARATION *)glob.__ds)->validateBundles(0)       \
+      ? std::cout << "Bundle validation OK." << std::endl \
+      : std::cout << "Bundle validation failed." << std::endl;
+#define INIT_ALL
+#define DEINIT_ALL VALIDATE_BUNDLES;
+
+#define BUNDLE_OBJ_SIZE \
+  (sizeof(BUNDLE_TYPE_DECL<Node<ABTREE_DEGREE, test_type>>))
+#define PRINT_OBJ_SIZES                                                   \
+  cout << "sizes: node=" << (sizeof(Node<ABTREE_DEGREE, test_type>))      \
+       << " including bundles=" << (ABTREE_DEGREE * BUNDLE_OBJ_SIZE)      \
+       << " descriptor=" << (sizeof(SCXRecord<ABTREE_DEGREE, test_type>)) \
+       << endl;
+
 #elif defined(UNSAFE_LIST)
 #include "unsafe_lazylist_impl.h"
 #include "record_manager.h"
@@ -595,8 +668,10 @@ using namespace vcas_lazylist;
 
 #define DS_DECLARATION \
   lazylist<test_type, test_type, MEMMGMT_T>
-#define MEMMGMT_T \
-  record_manager<RECLAIM, ALLOC, POOL, node_t<test_type, test_type> >
+#define MEMMGMT_T                                                     \
+  record_manager<RECLAIM, ALLOC, POOL, node_t<test_type, test_type>, \
+                 vcas_obj_t<long long>,                              \
+                 vcas_obj_t<node_t<test_type, test_type> *> >
 #define DS_CONSTRUCTOR \
   new DS_DECLARATION(TOTAL_THREADS, KEY_MIN, KEY_MAX, NO_VALUE)
 
@@ -626,9 +701,11 @@ using namespace vcas_lazylist;
 using namespace vcas_skiplist_lock;
 
 #define DS_DECLARATION skiplist<test_type, test_type, MEMMGMT_T>
-#define MEMMGMT_T                      \
-  record_manager<RECLAIM, ALLOC, POOL, \
-                 node_t<test_type, test_type> RQ_SNAPCOLLECTOR_OBJECT_TYPES>
+#define MEMMGMT_T                                                     \
+  record_manager<RECLAIM, ALLOC, POOL, node_t<test_type, test_type>, \
+                 vcas_obj_t<long long>,                              \
+                 vcas_obj_t<node_t<test_type, test_type> *>          \
+                     RQ_SNAPCOLLECTOR_OBJECT_TYPES>
 #define DS_CONSTRUCTOR \
   new DS_DECLARATION(TOTAL_THREADS, KEY_MIN, KEY_MAX, NO_VALUE, glob.rngs)
 
@@ -660,8 +737,9 @@ using namespace vcas_skiplist_lock;
 using namespace vcas_citrus;
 
 #define DS_DECLARATION citrustree<test_type, test_type, MEMMGMT_T>
-#define MEMMGMT_T \
-  record_manager<RECLAIM, ALLOC, POOL, node_t<test_type, test_type>>
+#define MEMMGMT_T                                                     \
+  record_manager<RECLAIM, ALLOC, POOL, node_t<test_type, test_type>, \
+                 vcas_obj_t<node_t<test_type, test_type> *>>
 #define DS_CONSTRUCTOR new DS_DECLARATION(MAXKEY, NO_VALUE, TOTAL_THREADS)
 
 #define INSERT_AND_CHECK_SUCCESS \
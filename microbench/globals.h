@@ -26,6 +26,8 @@ int RQSIZE;
 int MAXKEY;
 int MILLIS_TO_RUN;
 bool PREFILL;
+bool BULK_PREFILL;
+int BATCH_SIZE;
 int WORK_THREADS;
 int RQ_THREADS;
 int TOTAL_THREADS;
@@ -130,6 +132,9 @@ int TOTAL_THREADS;
     handle_stat(LONG_LONG, bundle_restarts, 1, { \
             stat_output_item(PRINT_RAW, SUM, TOTAL) \
              }) \
+    handle_stat(LONG_LONG, skiplist_finger_hits, 1, { \
+            stat_output_item(PRINT_RAW, SUM, TOTAL) \
+             }) \
     handle_stat(LONG_LONG, bundle_first, 1, { \
             stat_output_item(PRINT_RAW, SUM, TOTAL) \
              }) \
@@ -139,6 +144,9 @@ int TOTAL_THREADS;
     handle_stat(LONG_LONG, bundle_skip_first, 1, { \
             stat_output_item(PRINT_RAW, SUM, TOTAL) \
              }) \
+    handle_stat(LONG_LONG, bundle_helped, 1, { \
+            stat_output_item(PRINT_RAW, SUM, TOTAL) \
+             }) \
     handle_stat(LONG_LONG, bundle_retries, 10000, { \
             stat_output_item(PRINT_HISTOGRAM_LOG, NONE, FULL_DATA) \
           /*C stat_output_item(PRINT_RAW, NONE, FULL_DATA)*/ \
@@ -56,6 +56,8 @@ extern int RQSIZE;
 extern int MAXKEY;
 extern int MILLIS_TO_RUN;
 extern bool PREFILL;
+extern bool BULK_PREFILL;
+extern int BATCH_SIZE;
 extern int WORK_THREADS;
 extern int RQ_THREADS;
 extern int TOTAL_THREADS;
@@ -80,7 +82,13 @@ extern int TOTAL_THREADS;
 
 #define RECLAIM reclaimer_debra<test_type>
 #define ALLOC allocator_new_segregated<test_type>
+// Bundle entries are short-lived and allocated on every update, so bundled
+// data structures may recycle them through per-thread pools.
+#if defined(RQ_BUNDLE) && defined(BUNDLE_POOL_ENTRIES)
+#define POOL pool_perthread_and_shared<test_type>
+#else
 #define POOL pool_none<test_type>
+#endif
 
 #endif	/* GLOBALS_EXTERN_H */
 
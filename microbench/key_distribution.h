@@ -0,0 +1,183 @@
+// Jacob Nelson
+//
+// This file implements the key distributions used by the microbenchmark.
+// Point operations (inserts, deletes and finds) and range query start keys each
+// draw from their own distribution, which is selected on the command line with
+// -dist and -rqdist:
+//  - uniform                 every key is equally likely (default).
+//  - zipf:<theta>            zipfian with skew 0 < theta < 1. Ranks are
+//                            scattered over the key space, so the hottest keys
+//                            are not adjacent.
+//  - hotspot:<ops>:<keys>    a fraction ops of draws falls uniformly on the
+//                            lowest fraction keys of the key space.
+//  - latest:<theta>          inserts take sequential keys, wrapping around the
+//                            key space. Other draws are zipfian over the
+//                            distance behind the most recent insert. Range
+//                            query start keys past the last valid start are
+//                            clamped to it, so the query still covers them.
+//  - window:<keys>:<speed>   uniform over a window covering a fraction keys of
+//                            the key space, which slides by speed keys per
+//                            millisecond of the trial.
+
+#ifndef MICROBENCH_KEY_DISTRIBUTION_H
+#define MICROBENCH_KEY_DISTRIBUTION_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "plaf.h"
+#include "random.h"
+
+enum key_distribution_t {
+  KEY_DIST_UNIFORM,
+  KEY_DIST_ZIPF,
+  KEY_DIST_HOTSPOT,
+  KEY_DIST_LATEST,
+  KEY_DIST_WINDOW
+};
+
+// Frontier of the latest distribution. It is shared so that range queries
+// follow the inserts of the point operations, and is always reduced modulo the
+// full key space (see KeyDistribution::init()).
+static std::atomic<long long> key_dist_latest(0);
+
+class KeyDistribution {
+ private:
+  key_distribution_t type_;
+  std::string spec_;
+  double param1_;
+  double param2_;
+  long long n_;
+  long long space_;  // Key space of the latest frontier.
+
+  // Zipfian constants, following Gray et al., "Quickly generating
+  // billion-record synthetic databases".
+  double theta_;
+  double alpha_;
+  double zetan_;
+  double eta_;
+  double half_pow_theta_;
+
+  static double zeta(long long n, double theta) {
+    double sum = 0;
+    for (long long i = 1; i <= n; ++i) sum += std::pow(1.0 / i, theta);
+    return sum;
+  }
+
+  static inline double nextUnit(Random *const rng) {
+    return rng->nextNatural() / 4294967296.0;
+  }
+
+  // Returns a rank in [0, n_), where rank 0 is the most likely.
+  inline long long nextZipfRank(Random *const rng) {
+    double u = nextUnit(rng);
+    double uz = u * zetan_;
+    if (uz < 1) return 0;
+    if (uz < 1 + half_pow_theta_) return 1;
+    long long rank = (long long)(n_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+    return (rank < n_ ? rank : n_ - 1);
+  }
+
+  static inline long long mod(long long x, long long n) {
+    x %= n;
+    return (x < 0 ? x + n : x);
+  }
+
+ public:
+  KeyDistribution()
+      : type_(KEY_DIST_UNIFORM), spec_("uniform"), n_(1), space_(1) {}
+
+  // Parses a distribution as described at the top of this file. Returns false
+  // if spec is malformed.
+  bool parse(const char *spec) {
+    spec_ = spec;
+    if (strcmp(spec, "uniform") == 0) {
+      type_ = KEY_DIST_UNIFORM;
+    } else if (sscanf(spec, "zipf:%lf", &param1_) == 1) {
+      type_ = KEY_DIST_ZIPF;
+    } else if (sscanf(spec, "hotspot:%lf:%lf", &param1_, &param2_) == 2) {
+      type_ = KEY_DIST_HOTSPOT;
+    } else if (sscanf(spec, "latest:%lf", &param1_) == 1) {
+      type_ = KEY_DIST_LATEST;
+    } else if (sscanf(spec, "window:%lf:%lf", &param1_, &param2_) == 2) {
+      type_ = KEY_DIST_WINDOW;
+    } else {
+      return false;
+    }
+    if ((type_ == KEY_DIST_ZIPF || type_ == KEY_DIST_LATEST) &&
+        (param1_ <= 0 || param1_ >= 1)) {
+      return false;
+    }
+    if ((type_ == KEY_DIST_HOTSPOT || type_ == KEY_DIST_WINDOW) &&
+        (param1_ < 0 || param1_ > 1)) {
+      return false;
+    }
+    if (type_ == KEY_DIST_HOTSPOT && (param2_ <= 0 || param2_ > 1)) {
+      return false;
+    }
+    return true;
+  }
+
+  // Prepares to draw keys in [0, n) from a key space of space >= n keys (for
+  // range query start keys, n is smaller than space by the query size). Must
+  // be called before next().
+  void init(long long n, long long space) {
+    n_ = (n > 0 ? n : 1);
+    space_ = std::max(n_, space);
+    if (type_ == KEY_DIST_ZIPF || type_ == KEY_DIST_LATEST) {
+      theta_ = param1_;
+      alpha_ = 1 / (1 - theta_);
+      zetan_ = zeta(n_, theta_);
+      eta_ = (1 - std::pow(2.0 / n_, 1 - theta_)) /
+             (1 - zeta(2, theta_) / zetan_);
+      half_pow_theta_ = std::pow(0.5, theta_);
+    }
+  }
+
+  const std::string &spec() const { return spec_; }
+
+  // Returns the next key. millis (the time elapsed in the trial) positions the
+  // window distribution. Uniform draws consume the generator exactly as the
+  // original benchmark did.
+  inline long long next(Random *const rng, const long long millis) {
+    switch (type_) {
+      case KEY_DIST_ZIPF:
+        // 2654435761 is a prime larger than any key space, so multiplying by
+        // it permutes [0, n_).
+        return (long long)(((unsigned long long)nextZipfRank(rng) *
+                            2654435761ULL) %
+                           (unsigned long long)n_);
+      case KEY_DIST_HOTSPOT: {
+        long long hot = std::max(1LL, (long long)(param2_ * n_));
+        if (nextUnit(rng) < param1_) return rng->nextNatural() % hot;
+        return rng->nextNatural() % n_;
+      }
+      case KEY_DIST_LATEST:
+        return std::min(
+            n_ - 1, mod(key_dist_latest.load(std::memory_order_relaxed) - 1 -
+                            nextZipfRank(rng),
+                        space_));
+      case KEY_DIST_WINDOW: {
+        long long width = std::max(1LL, (long long)(param1_ * n_));
+        long long start = (long long)(millis * param2_);
+        return mod(start + rng->nextNatural() % width, n_);
+      }
+      default:
+        return rng->nextNatural() % n_;
+    }
+  }
+
+  // Returns the key an insert uses instead of the drawn key: the latest
+  // distribution advances its frontier, and the others keep key.
+  inline long long insertKey(const long long key) {
+    if (type_ != KEY_DIST_LATEST) return key;
+    return mod(key_dist_latest.fetch_add(1), space_);
+  }
+};
+
+#endif  // MICROBENCH_KEY_DISTRIBUTION_H
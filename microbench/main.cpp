@@ -31,6 +31,7 @@ typedef long long test_type;
 #include "binding.h"
 #include "globals.h"
 #include "globals_extern.h"
+#include "key_distribution.h"
 #include "papi_util_impl.h"
 #include "plaf.h"
 #include "random.h"
@@ -85,6 +86,9 @@ struct main_globals_t {
   volatile char padding10[PREFETCH_SIZE_BYTES];
   long long prefillKeySum;
   volatile char padding11[PREFETCH_SIZE_BYTES];
+  KeyDistribution keyDist;    // keys of inserts, deletes and finds
+  KeyDistribution rqKeyDist;  // start keys of range queries
+  volatile char padding12[PREFETCH_SIZE_BYTES];
 };
 
 main_globals_t glob = {
@@ -196,6 +200,52 @@ void *thread_prefill(void *_id) {
   pthread_exit(NULL);
 }
 
+#ifdef BULK_LOAD
+// Fills the data structure through its bulkLoad() instead of timed inserts.
+// Each key is present independently with the expected fullness of prefill(),
+// so the keys are drawn already sorted.
+void bulkPrefill(DS_DECLARATION *ds) {
+  chrono::time_point<chrono::high_resolution_clock> prefillStartTime =
+      chrono::high_resolution_clock::now();
+  const double expectedFullness =
+      (INS + DEL ? INS / (double)(INS + DEL) : 0.5);
+  Random *rng = &glob.rngs[0];
+  rng->setSeed(rand());
+  test_type *keys = new test_type[MAXKEY];
+  VALUE_TYPE *values = new VALUE_TYPE[MAXKEY];
+  long long sz = 0;
+  long long keysum = 0;
+  for (int key = 0; key < MAXKEY; ++key) {
+    if (rng->nextNatural(1000000) < expectedFullness * 1000000) {
+      keys[sz] = key;
+      values[sz] = VALUE;
+      keysum += key;
+      ++sz;
+    }
+  }
+
+  const int tid = 0;
+  INIT_THREAD(tid);
+  BULK_LOAD(tid, keys, values, sz);
+  DEINIT_THREAD(tid);
+  delete[] keys;
+  delete[] values;
+
+#ifdef USE_DEBUGCOUNTERS
+  glob.keysum->add(tid, keysum);
+  glob.prefillSize->add(tid, sz);
+#endif
+  glob.prefillKeySum = keysum;
+  auto elapsed = chrono::duration_cast<chrono::milliseconds>(
+                     chrono::high_resolution_clock::now() - prefillStartTime)
+                     .count();
+  COUTATOMIC("finished bulk loading to size "
+             << sz << " keysum=" << keysum << " dskeysum=" << ds->debugKeySum()
+             << " dssize=" << ds->getSize() << " in " << (elapsed / 1000.)
+             << "s" << endl);
+}
+#endif
+
 void prefill(DS_DECLARATION *ds) {
   chrono::time_point<chrono::high_resolution_clock> prefillStartTime =
       chrono::high_resolution_clock::now();
@@ -362,6 +412,48 @@ void prefill(DS_DECLARATION *ds) {
 #endif
 }
 
+#ifdef BATCH_UPDATE
+// The batch op with the semantics of INSERT_FUNC, so that batched inserts of
+// present keys do what the single-key inserts would.
+const batch_op_type_t BATCH_INSERT_TYPE =
+    (strcmp(STR(INSERT_FUNC), "insertIfAbsent") == 0 ? BATCH_INSERT_IF_ABSENT
+                                                     : BATCH_INSERT);
+
+// Applies the n updates buffered by a worker under -batch through
+// batchUpdate(), and accounts for each one as if it had run on its own.
+void applyBatch(const int tid, DS_DECLARATION *ds,
+                BatchOp<test_type, test_type> *const ops, const int n) {
+  GSTATS_TIMER_RESET(tid, timer_latency);
+  BATCH_UPDATE(tid, ops, n);
+  GSTATS_TIMER_APPEND_ELAPSED(tid, timer_latency, latency_updates);
+  for (int i = 0; i < n; ++i) {
+    const test_type key = ops[i].key;
+    if (ops[i].type == BATCH_ERASE) {
+      if (ops[i].result != ds->NO_VALUE) {
+        GSTATS_ADD(tid, key_checksum, -key);
+#ifdef USE_DEBUGCOUNTERS
+        glob.keysum->add(tid, -key);
+        GET_COUNTERS->eraseSuccess->inc(tid);
+      } else {
+        GET_COUNTERS->eraseFail->inc(tid);
+#endif
+      }
+    } else {
+      if (ops[i].result == ds->NO_VALUE) {
+        GSTATS_ADD(tid, key_checksum, key);
+#ifdef USE_DEBUGCOUNTERS
+        glob.keysum->add(tid, key);
+        GET_COUNTERS->insertSuccess->inc(tid);
+      } else {
+        GET_COUNTERS->insertFail->inc(tid);
+#endif
+      }
+    }
+  }
+  GSTATS_ADD(tid, num_updates, n);
+}
+#endif
+
 void *thread_timed(void *_id) {
   int tid = *((int *)_id);
   binding_bindThread(tid, LOGICAL_PROCESSORS);
@@ -373,6 +465,12 @@ void *thread_timed(void *_id) {
       new test_type[RQSIZE + RQ_DEBUGGING_MAX_KEYS_PER_NODE];
   VALUE_TYPE *rqResultValues =
       new VALUE_TYPE[RQSIZE + RQ_DEBUGGING_MAX_KEYS_PER_NODE];
+#ifdef BATCH_UPDATE
+  // Inserts and deletes buffered under -batch.
+  BatchOp<test_type, test_type> *batch =
+      new BatchOp<test_type, test_type>[max(BATCH_SIZE, 1)];
+  int batched = 0;
+#endif
 
   INIT_THREAD(tid);
   papi_create_eventset(tid);
@@ -385,14 +483,16 @@ void *thread_timed(void *_id) {
   papi_start_counters(tid);
   int cnt = 0;
   int rq_cnt = 0;
+  long long millis = 0;
   while (!glob.done) {
     if (((++cnt) % OPS_BETWEEN_TIME_CHECKS) == 0 ||
         (rq_cnt % RQS_BETWEEN_TIME_CHECKS) == 0) {
       chrono::time_point<chrono::high_resolution_clock> __endTime =
           chrono::high_resolution_clock::now();
-      if (chrono::duration_cast<chrono::milliseconds>(__endTime -
-                                                      glob.startTime)
-              .count() >= abs(MILLIS_TO_RUN)) {
+      millis = chrono::duration_cast<chrono::milliseconds>(__endTime -
+                                                           glob.startTime)
+                   .count();
+      if (millis >= abs(MILLIS_TO_RUN)) {
         __sync_synchronize();
         glob.done = true;
         __sync_synchronize();
@@ -402,9 +502,20 @@ void *thread_timed(void *_id) {
 
     VERBOSE if (cnt && ((cnt % 1000000) == 0))
         COUTATOMICTID("op# " << cnt << endl);
-    int key = rng->nextNatural(MAXKEY);
+    int key = (int)glob.keyDist.next(rng, millis);
     double op = rng->nextNatural(100000000) / 1000000.;
-    if (op < INS) {
+    if (op < INS) key = (int)glob.keyDist.insertKey(key);
+    if (BATCH_SIZE > 0 && op < INS + DEL) {
+#ifdef BATCH_UPDATE
+      batch[batched].type = (op < INS ? BATCH_INSERT_TYPE : BATCH_ERASE);
+      batch[batched].key = key;
+      batch[batched].val = VALUE;
+      if (++batched == BATCH_SIZE) {
+        applyBatch(tid, ds, batch, batched);
+        batched = 0;
+      }
+#endif
+    } else if (op < INS) {
       GSTATS_TIMER_RESET(tid, timer_latency);
       if (INSERT_AND_CHECK_SUCCESS) {
         GSTATS_ADD(tid, key_checksum, key);
@@ -431,7 +542,7 @@ void *thread_timed(void *_id) {
       GSTATS_TIMER_APPEND_ELAPSED(tid, timer_latency, latency_updates);
       GSTATS_ADD(tid, num_updates, 1);
     } else if (op < INS + DEL + RQ) {
-      unsigned _key = rng->nextNatural() % max(1, MAXKEY - RQSIZE);
+      unsigned _key = glob.rqKeyDist.next(rng, millis);
       assert(_key >= 0);
       assert(_key < MAXKEY);
       assert(_key < max(1, MAXKEY - RQSIZE));
@@ -467,6 +578,9 @@ void *thread_timed(void *_id) {
     }
     GSTATS_ADD(tid, num_operations, 1);
   }
+#ifdef BATCH_UPDATE
+  if (batched > 0) applyBatch(tid, ds, batch, batched);
+#endif
   glob.running.fetch_add(-1);
   while (glob.running.load()) { /* wait */
   }
@@ -475,6 +589,9 @@ void *thread_timed(void *_id) {
   DEINIT_THREAD(tid);
   delete[] rqResultKeys;
   delete[] rqResultValues;
+#ifdef BATCH_UPDATE
+  delete[] batch;
+#endif
   glob.__garbage += garbage;
   pthread_exit(NULL);
 }
@@ -501,13 +618,15 @@ void *thread_rq(void *_id) {
   }  // wait to start
   papi_start_counters(tid);
   int cnt = 0;
+  long long millis = 0;
   while (!glob.done) {
     if (((++cnt) % RQS_BETWEEN_TIME_CHECKS) == 0) {
       chrono::time_point<chrono::high_resolution_clock> __endTime =
           chrono::high_resolution_clock::now();
-      if (chrono::duration_cast<chrono::milliseconds>(__endTime -
-                                                      glob.startTime)
-              .count() >= MILLIS_TO_RUN) {
+      millis = chrono::duration_cast<chrono::milliseconds>(__endTime -
+                                                           glob.startTime)
+                   .count();
+      if (millis >= MILLIS_TO_RUN) {
         __sync_synchronize();
         glob.done = true;
         __sync_synchronize();
@@ -517,7 +636,7 @@ void *thread_rq(void *_id) {
 
     VERBOSE if (cnt && ((cnt % 1000000) == 0))
         COUTATOMICTID("op# " << cnt << endl);
-    unsigned _key = rng->nextNatural() % max(1, MAXKEY - RQSIZE);
+    unsigned _key = glob.rqKeyDist.next(rng, millis);
     assert(_key >= 0);
     assert(_key < MAXKEY);
     assert(_key < max(1, MAXKEY - RQSIZE));
@@ -582,7 +701,22 @@ void trial() {
 
   DEINIT_ALL;
 
-  if (PREFILL) prefill((DS_DECLARATION *)glob.__ds);
+#ifndef BATCH_UPDATE
+  if (BATCH_SIZE > 0) {
+    cerr << "ERROR: -batch is not supported by this data structure" << endl;
+    exit(-1);
+  }
+#endif
+  if (BULK_PREFILL) {
+#ifdef BULK_LOAD
+    bulkPrefill((DS_DECLARATION *)glob.__ds);
+#else
+    cerr << "ERROR: -bulk is not supported by this data structure" << endl;
+    exit(-1);
+#endif
+  } else if (PREFILL) {
+    prefill((DS_DECLARATION *)glob.__ds);
+  }
 
   INIT_ALL;
 
@@ -627,6 +761,11 @@ void trial() {
       << endl);
   COUTATOMIC(endl);
 
+#if defined(RQ_BUNDLE) && defined(BUNDLE_TELEMETRY)
+  // Leave out the prefilling phase.
+  ((DS_DECLARATION *)glob.__ds)->resetBundleTelemetry();
+#endif
+
   SOFTWARE_BARRIER;
   glob.startTime = chrono::high_resolution_clock::now();
   __sync_synchronize();
@@ -859,6 +998,10 @@ void printOutput() {
   COUTATOMIC(ds->getBundleStatsString() << flush);
   COUTATOMIC(endl);
 #endif
+#ifdef BUNDLE_TELEMETRY
+  COUTATOMIC(ds->getBundleTelemetryString() << flush);
+  COUTATOMIC(endl);
+#endif
 #endif
 
 #if defined(USE_DEBUGCOUNTERS) || defined(USE_GSTATS)
@@ -882,6 +1025,8 @@ int main(int argc, char **argv) {
   // setup default args
   PREFILL = false;  // must be false, or else there's no way to specify no
                     // prefilling on the command line...
+  BULK_PREFILL = false;
+  BATCH_SIZE = 0;
   MILLIS_TO_RUN = 1000;
   RQ_THREADS = 0;
   WORK_THREADS = 4;
@@ -893,7 +1038,7 @@ int main(int argc, char **argv) {
 
   // read command line args
   // example args: -i 25 -d 25 -k 10000 -rq 0 -rqsize 1000 -p -t 1000 -nrq 0
-  // -nwork 8
+  // -nwork 8 -dist zipf:0.99 -rqdist hotspot:0.9:0.1
   for (int i = 1; i < argc; ++i) {
     if (strcmp(argv[i], "-i") == 0) {
       INS = atof(argv[++i]);
@@ -911,8 +1056,24 @@ int main(int argc, char **argv) {
       WORK_THREADS = atoi(argv[++i]);
     } else if (strcmp(argv[i], "-t") == 0) {
       MILLIS_TO_RUN = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-dist") == 0 ||
+               strcmp(argv[i], "-rqdist") == 0) {
+      KeyDistribution *dist =
+          (strcmp(argv[i], "-dist") == 0 ? &glob.keyDist : &glob.rqKeyDist);
+      if (!dist->parse(argv[++i])) {
+        cout << "bad key distribution " << argv[i] << endl;
+        exit(1);
+      }
     } else if (strcmp(argv[i], "-p") == 0) {
       PREFILL = true;
+    } else if (strcmp(argv[i], "-bulk") == 0) {
+      // Prefill through bulkLoad() (bundled data structures only).
+      PREFILL = true;
+      BULK_PREFILL = true;
+    } else if (strcmp(argv[i], "-batch") == 0) {
+      // Apply inserts and deletes in batches of this many through
+      // batchUpdate() (bundled lazylist and skiplist only).
+      BATCH_SIZE = atoi(argv[++i]);
     } else if (strcmp(argv[i], "-bind") ==
                0) {                    // e.g., "-bind 1,2,3,8-11,4-7,0"
       binding_parseCustom(argv[++i]);  // e.g., "1,2,3,8-11,4-7,0"
@@ -923,6 +1084,8 @@ int main(int argc, char **argv) {
     }
   }
   TOTAL_THREADS = WORK_THREADS + RQ_THREADS;
+  glob.keyDist.init(MAXKEY, MAXKEY);
+  glob.rqKeyDist.init(max(1, MAXKEY - RQSIZE), MAXKEY);
 
   // print used args
   PRINTS(FIND_FUNC);
@@ -933,6 +1096,8 @@ int main(int argc, char **argv) {
   PRINTS(ALLOC);
   PRINTS(POOL);
   PRINTI(PREFILL);
+  PRINTI(BULK_PREFILL);
+  PRINTI(BATCH_SIZE);
   PRINTI(MILLIS_TO_RUN);
   PRINTI(INS);
   PRINTI(DEL);
@@ -941,25 +1106,42 @@ int main(int argc, char **argv) {
   PRINTI(MAXKEY);
   PRINTI(WORK_THREADS);
   PRINTI(RQ_THREADS);
+  cout << "KEY_DIST=" << glob.keyDist.spec() << endl;
+  cout << "RQ_KEY_DIST=" << glob.rqKeyDist.spec() << endl;
 
 // TODO: Find a way to keep strategy specific code out of main.
 #ifdef RQ_BUNDLE
 #if defined BUNDLE_LINKED_BUNDLE
   cout << "BUNDLE_TYPE=linked" << endl;
+#elif defined BUNDLE_INLINE_BUNDLE
+  cout << "BUNDLE_TYPE=inline" << endl;
 #elif defined BUNDLE_CIRCULAR_BUNDLE
   cout << "BUNDLE_TYPE=circular" << endl;
+  cout << "BUNDLE_CIRCULAR_CAPACITY=" << BUNDLE_CIRCULAR_CAPACITY << endl;
 #endif
 #if defined BUNDLE_CLEANUP_BACKGROUND
+#if defined BUNDLE_CLEANUP_DIRTY
+  cout << "BUNDLE_CLEANUP=background-dirty" << endl;
+  cout << "BUNDLE_DIRTY_LOG_SIZE=" << BUNDLE_DIRTY_LOG_SIZE << endl;
+#else
   cout << "BUNDLE_CLEANUP=background" << endl;
+#endif
   cout << "BUNDLE_CLEANUP_SLEEP=" << BUNDLE_CLEANUP_SLEEP << endl;
 #elif defined BUNDLE_CLEANUP_UPDATE
   cout << "BUNDLE_CLEANUP=update" << endl;
 #else
   cout << "BUNDLE_CLEANUP=none" << endl;
+#endif
+  cout << "BUNDLE_TIMESTAMP=" << BUNDLE_TIMESTAMP_NAME << endl;
+#if defined BUNDLE_TIMESTAMP_NUMA
+  cout << "BUNDLE_TIMESTAMP_NUMA_NODES=" << BUNDLE_TIMESTAMP_NUMA_NODES << endl;
 #endif
 #if defined BUNDLE_TIMESTAMP_RELAXATION
   cout << "BUNDLE_TIMESTAMP_RELAXATION=" << BUNDLE_TIMESTAMP_RELAXATION << endl;
 #endif
+#if defined(BUNDLE_LIST) || defined(BUNDLE_SKIPLIST)
+  PRINTS(BUNDLE_NODE_LOCK);
+#endif
 #endif
 
 #ifdef WIDTH_SEQ
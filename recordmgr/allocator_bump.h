@@ -86,6 +86,10 @@ class allocator_bump : public allocator_interface<T> {
             }
             return bump_memory_next(tid);
         }
+        // records are bumped in fixed-size slots
+        T* allocate(const int tid, const size_t bytes) {
+            return allocate(tid);
+        }
         void static deallocate(const int tid, T * const p) {
             // no op for this allocator; memory is freed only by the destructor.
             // however, we have to call the destructor for the object manually...
@@ -30,6 +30,9 @@ public:
     
     // allocate space for one object of type T
     T* allocate(const int tid);
+    // allocate space for one object of type T whose trailing array is cut
+    // short, so that the object occupies only bytes <= sizeof(T) bytes
+    T* allocate(const int tid, const size_t bytes);
     void deallocate(const int tid, T * const p);
     void deallocateAndClear(const int tid, blockbag<T> * const bag);
     void initThread(const int tid);
@@ -43,6 +43,10 @@ public:
         }
         return new T; //(T*) malloc(sizeof(T));
     }
+    // objects are freed with delete, which expects a full-size object
+    T* allocate(const int tid, const size_t bytes) {
+        return allocate(tid);
+    }
     void deallocate(const int tid, T * const p) {
         // note: allocators perform the actual freeing/deleting, since
         // only they know how memory was allocated.
@@ -10,6 +10,7 @@
 
 #include "plaf.h"
 #include "pool_interface.h"
+#include <cstddef>
 #include <cstdlib>
 #include <cassert>
 #include <iostream>
@@ -26,8 +27,25 @@ private:
     volatile char padding0[PREFETCH_SIZE_BYTES];
     void* (*allocfn)(size_t size);
     void (*freefn)(void *ptr);
+    int (*alignfn)(void **ptr, size_t alignment, size_t size);
     volatile char padding1[PREFETCH_SIZE_BYTES];
     
+    // malloc only guarantees the alignment of max_align_t, so over-aligned
+    // types (e.g., nodes aligned to cache lines) use posix_memalign instead.
+    // Both kinds are released with free().
+    T* allocateBytes(const size_t bytes) {
+        if (alignof(T) <= alignof(std::max_align_t)) {
+            return (T*) allocfn(bytes);
+        }
+        void *ptr;
+        if (alignfn == NULL) {
+            fprintf(stderr, "unable to resolve posix_memalign\n");
+            exit(1);
+        }
+        if (alignfn(&ptr, alignof(T), bytes) != 0) return NULL;
+        return (T*) ptr;
+    }
+
 public:
     template<typename _Tp1>
     struct rebind {
@@ -49,7 +67,16 @@ public:
 //                maxAllocatedBytes = currentAllocatedBytes;
 //            }
         }
-        return (T*) allocfn(sizeof(T));
+        return allocateBytes(sizeof(T));
+    }
+    // reserve space for ONE object of type T, truncated to the given size.
+    // free() does not need the size, so deallocate() handles both kinds.
+    T* allocate(const int tid, const size_t bytes) {
+        assert(bytes <= sizeof(T));
+        MEMORY_STATS {
+            this->debug->addAllocated(tid, 1);
+        }
+        return allocateBytes(bytes);
     }
     void deallocate(const int tid, T * const p) {
         // note: allocators perform the actual freeing/deleting, since
@@ -91,6 +118,7 @@ public:
 		printf("no TREE_MALLOC defined: using default!\n");
                 allocfn = malloc;
                 freefn = free;
+                alignfn = posix_memalign;
 		return;
 	}
 	void *h = dlopen(lib, RTLD_NOW | RTLD_LOCAL);
@@ -120,6 +148,8 @@ public:
 		fprintf(stderr, "unable to resolve free\n");
 		exit(1);
 	}
+	// only needed by over-aligned types (see allocateBytes())
+	alignfn = (__typeof(alignfn)) dlsym(h, "posix_memalign");
     }
     ~allocator_new_segregated() {
         VERBOSE DEBUG cout<<"destructor allocator_new_segregated"<<endl;
@@ -44,6 +44,11 @@ public:
      * and return a pointer to it. otherwise, return NULL.
      */
     inline T* get(const int tid);
+    /**
+     * as above, but the object only needs to provide the given number of
+     * bytes (see allocator_interface::allocate(tid, bytes)).
+     */
+    inline T* get(const int tid, const size_t bytes);
     inline void add(const int tid, T* ptr);
     inline void addMoveFullBlocks(const int tid, blockbag<T> *bag);
     inline void addMoveAll(const int tid, blockbag<T> *bag);
@@ -87,6 +87,13 @@ public:
         MEMORY_STATS2 this->alloc->debug->addFromPool(tid, 1);
         return freeBag[tid]->template remove<Alloc>(tid, sharedBag, this->alloc);
     }
+    /**
+     * recycled objects may be handed out again for any size, so every object
+     * in the pool must be full-size.
+     */
+    inline T* get(const int tid, const size_t bytes) {
+        return get(tid);
+    }
     inline void add(const int tid, T* ptr) {
         MEMORY_STATS2 this->debug->addToPool(tid, 1);
         freeBag[tid]->add(tid, ptr, sharedBag, POOL_THRESHOLD_IN_BLOCKS, this->alloc);
@@ -261,6 +261,15 @@ public:
         assert(!Reclaim::supportsCrashRecovery() || isQuiescent(tid));
         return rmset->get((T *) NULL)->allocate(tid);
     }
+
+    // for records that end in a variable-length array: the record only needs
+    // bytes <= sizeof(T) bytes. the record may still be allocated full-size,
+    // e.g., if the pool recycles records.
+    template <typename T>
+    inline T * allocate(const int tid, const size_t bytes) {
+        assert(!Reclaim::supportsCrashRecovery() || isQuiescent(tid));
+        return rmset->get((T *) NULL)->allocate(tid, bytes);
+    }
     
     // optional function which can be used if it is safe to call free()
     template <typename T>
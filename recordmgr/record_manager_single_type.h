@@ -152,6 +152,10 @@ public:
         assert(!Reclaim::supportsCrashRecovery() || isQuiescent(tid));
         return pool->get(tid);
     }
+    inline record_pointer allocate(const int tid, const size_t bytes) {
+        assert(!Reclaim::supportsCrashRecovery() || isQuiescent(tid));
+        return pool->get(tid, bytes);
+    }
     inline void deallocate(const int tid, record_pointer p) {
         assert(!Reclaim::supportsCrashRecovery() || isQuiescent(tid));
         pool->add(tid, p);
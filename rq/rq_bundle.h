@@ -13,32 +13,101 @@
 #ifndef BUNDLE_CLEANUP_SLEEP
 #error BUNDLE_CLEANUP_SLEEP NOT DEFINED
 #endif
+// Cleanup workers sleep between BUNDLE_CLEANUP_SLEEP_MIN and
+// BUNDLE_CLEANUP_SLEEP microseconds, sleeping less while each pass reclaims
+// more than BUNDLE_CLEANUP_TARGET records.
+#ifndef BUNDLE_CLEANUP_SLEEP_MIN
+#define BUNDLE_CLEANUP_SLEEP_MIN 10
 #endif
+#ifndef BUNDLE_CLEANUP_TARGET
+#define BUNDLE_CLEANUP_TARGET 1024
+#endif
+#endif
+
+// With BUNDLE_CLEANUP_DIRTY, updates log the nodes whose bundles they extend
+// and the background workers only clean logged nodes. Nodes must then provide
+// a `dirty` flag, which is protected by the node's lock.
+#ifdef BUNDLE_CLEANUP_DIRTY
+#ifndef BUNDLE_CLEANUP_BACKGROUND
+#error BUNDLE_CLEANUP_DIRTY requires BUNDLE_CLEANUP_BACKGROUND
+#endif
+#ifndef BUNDLE_DIRTY_LOG_SIZE
+#define BUNDLE_DIRTY_LOG_SIZE (1 << 14)
+#endif
+#endif
+
+// Number of background cleanup workers. They use the last thread ids of the
+// data structure, which must be constructed with this many extra threads.
+#ifndef BUNDLE_CLEANUP_THREADS
+#define BUNDLE_CLEANUP_THREADS 1
+#endif
+// Granularity at which the data structures split work among cleanup workers.
+// See the cleanup() implementation of each data structure.
+#ifndef BUNDLE_CLEANUP_CHUNK
+#define BUNDLE_CLEANUP_CHUNK 64
+#endif
+#ifndef BUNDLE_CLEANUP_SPLIT_LEVEL
+#define BUNDLE_CLEANUP_SPLIT_LEVEL 6
+#endif
+#ifndef BUNDLE_CLEANUP_SPLIT_DEPTH
+#define BUNDLE_CLEANUP_SPLIT_DEPTH 6
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <fstream>
+#include <sstream>
 
+#include "bundle_timestamp.h"
+
+// BUNDLE_ENTRY_TYPE_DECL is the record type that a bundle allocates from the
+// data structure's record manager. It must be one of the record manager's types.
 #if defined BUNDLE_CIRCULAR_BUNDLE
+#define BUNDLE_TYPE_DECL CircularBundle
+#define BUNDLE_ENTRY_TYPE_DECL CircularBundleBuffer
 #include "circular_bundle.h"
-#error Not implemented
 #elif defined BUNDLE_LINKED_BUNDLE
 #define BUNDLE_TYPE_DECL LinkedBundle
+#define BUNDLE_ENTRY_TYPE_DECL BundleEntry
 #include "linked_bundle.h"
+#elif defined BUNDLE_INLINE_BUNDLE
+#define BUNDLE_TYPE_DECL InlineBundle
+#define BUNDLE_ENTRY_TYPE_DECL BundleEntry
+#include "inline_bundle.h"
 #elif defined BUNDLE_UNSAFE_BUNDLE
 #define BUNDLE_UNSAFE
 #define BUNDLE_TYPE_DECL LinkedBundle
+#define BUNDLE_ENTRY_TYPE_DECL BundleEntry
 #include "linked_bundle.h"
 #else
 #error NO BUNDLE TYPE DEFINED
 #endif
 
 #include "common_bundle.h"
-
-static thread_local int backoff_amt = 0;
+// Allocates ValueEntry<V> records, which must also be record manager types.
+#include "value_history.h"
+// Op type of batchUpdate() in the data structures using this provider.
+#include "batch_update.h"
+// Handle returned by openSnapshot() in the data structures using this provider.
+#include "snapshot.h"
+#include "bundle_telemetry.h"
+
+#ifndef BUNDLE_HORIZON_REFRESH
+#define BUNDLE_HORIZON_REFRESH 64
+#endif
 
 #define __THREAD_DATA_SIZE 1024
 // Used to announce an active range query and its linearization point.
 union __rq_thread_data {
   struct {
     volatile timestamp_t rq_lin_time;
-    std::atomic<bool> rq_flag;
+    // Number of records reclaimed or retired by this thread through
+    // reclaim_bundle(), reclaim_values(), retire_bundles() and
+    // retire_values().
+    volatile long long reclaimed;
+    // Calls to get_cached_oldest_active_rq() since this thread last rescanned
+    // the announcements of this provider.
+    int horizon_calls;
 #ifdef BUNDLE_TIMESTAMP_RELAXATION
     volatile char pad1[PREFETCH_SIZE_BYTES];
     volatile long local_timestamp;
@@ -52,6 +121,11 @@ union __rq_thread_data {
 // The active RQ array is the total number of processes to accomodate any
 // number of range query threads. Snapshots are still taken by iterating over
 // the list.
+//
+// A range query announces a lower bound on its linearization time before it
+// takes one, so computing the oldest active range query never waits on a range
+// query thread. Any horizon computed this way remains safe to use later, which
+// lets updates that clean up bundles reuse a cached horizon.
 
 // Ensures consistent view of data structure for range queries by augmenting
 // updates to keep track of their linearization points and observe any active
@@ -64,16 +138,19 @@ class RQProvider {
   // Number of processes concurrently operating on the data structure.
   const int num_processes_;
   volatile char pad0[PREFETCH_SIZE_BYTES];
-  // Timestamp used by range queries to linearize accesses.
-  std::atomic<timestamp_t> curr_timestamp_;
-  volatile char pad1[PREFETCH_SIZE_BYTES];
+  // Timestamp source used by range queries to linearize accesses.
+  BUNDLE_TIMESTAMP_DECL timestamp_;
 
   // Array of RQ announcements. One per thread.
   __rq_thread_data *rq_thread_data_;
   volatile char pad2[PREFETCH_SIZE_BYTES];
+  // Most recently computed oldest active RQ.
+  std::atomic<timestamp_t> horizon_;
+  volatile char pad3[PREFETCH_SIZE_BYTES];
 
   DataStructure *ds_;
   RecordManager *const recmgr_;
+  BundleTelemetry telemetry_;
 
   int init_[MAX_TID_POW2] = {
       0,
@@ -83,18 +160,38 @@ class RQProvider {
 #ifdef BUNDLE_CLEANUP_BACKGROUND
   struct cleanup_args {
     std::atomic<bool> *const stop;
-    DataStructure *const ds;
+    RQProvider *const provider;
     int tid;
+    int worker;
   };
 
-  pthread_t cleanup_thread_;
-  struct cleanup_args *cleanup_args_;
+  pthread_t cleanup_threads_[BUNDLE_CLEANUP_THREADS];
+  struct cleanup_args *cleanup_args_[BUNDLE_CLEANUP_THREADS];
   std::atomic<bool> stop_cleanup_;
+  bool cleanup_stopped_;
+#endif
+
+#ifdef BUNDLE_CLEANUP_DIRTY
+  // Single-producer single-consumer ring of nodes that have gained bundle
+  // entries since they were last cleaned. Each thread fills its own log, which
+  // is drained by a single cleanup worker. A node is in at most one log, and
+  // only while its dirty flag is set.
+  struct dirty_log {
+    std::atomic<long long> head;
+    volatile char pad0[PREFETCH_SIZE_BYTES];
+    std::atomic<long long> tail;
+    volatile char pad1[PREFETCH_SIZE_BYTES];
+    NodeType *nodes[BUNDLE_DIRTY_LOG_SIZE];
+  };
+  dirty_log *dirty_logs_;
 #endif
 
  public:
   RQProvider(const int num_processes, DataStructure *ds, RecordManager *recmgr)
-      : num_processes_(num_processes), ds_(ds), recmgr_(recmgr) {
+      : num_processes_(num_processes),
+        ds_(ds),
+        recmgr_(recmgr),
+        telemetry_(num_processes) {
     if (num_processes > MAX_TID_POW2) {
       cerr << "num_processes (" << num_processes << ") > maxthreads_pow2 ("
            << MAX_TID_POW2 << "): Please increase maxthreads_pow2 in config.mk";
@@ -103,35 +200,75 @@ class RQProvider {
     rq_thread_data_ = new __rq_thread_data[num_processes];
     for (int i = 0; i < num_processes; ++i) {
       rq_thread_data_[i].data.rq_lin_time = BUNDLE_NULL_TIMESTAMP;
-      rq_thread_data_[i].data.rq_flag = false;
+      rq_thread_data_[i].data.reclaimed = 0;
+      rq_thread_data_[i].data.horizon_calls = 0;
     }
-    curr_timestamp_ = BUNDLE_MIN_TIMESTAMP;
+    timestamp_.init();
+    horizon_ = timestamp_.current();
+#ifdef BUNDLE_CLEANUP_DIRTY
+    dirty_logs_ = new dirty_log[num_processes];
+    for (int i = 0; i < num_processes; ++i) {
+      dirty_logs_[i].head = 0;
+      dirty_logs_[i].tail = 0;
+    }
+#endif
 
-// Launches a background thread to handle bundle entry cleanup.
+// Launches background threads to handle bundle entry cleanup.
 #ifdef BUNDLE_CLEANUP_BACKGROUND
-    cleanup_args_ = new cleanup_args{&stop_cleanup_, ds_, num_processes_ - 1};
-    if (pthread_create(&cleanup_thread_, nullptr, cleanup_run,
-                       (void *)cleanup_args_)) {
-      cerr << "ERROR: could not create thread" << endl;
-      exit(-1);
+    if (num_processes_ <= BUNDLE_CLEANUP_THREADS) {
+      cerr << "num_processes (" << num_processes_
+           << ") must exceed BUNDLE_CLEANUP_THREADS ("
+           << BUNDLE_CLEANUP_THREADS << ")" << endl;
+      exit(1);
+    }
+    stop_cleanup_ = false;
+    cleanup_stopped_ = false;
+    for (int i = 0; i < BUNDLE_CLEANUP_THREADS; ++i) {
+      cleanup_args_[i] = new cleanup_args{
+          &stop_cleanup_, this, num_processes_ - BUNDLE_CLEANUP_THREADS + i, i};
+      if (pthread_create(&cleanup_threads_[i], nullptr, cleanup_run,
+                         (void *)cleanup_args_[i])) {
+        cerr << "ERROR: could not create thread" << endl;
+        exit(-1);
+      }
+      std::stringstream ss;
+      ss << "Cleanup started: 0x" << std::hex << cleanup_threads_[i]
+         << std::endl;
+      std::cout << ss.str() << std::flush;
     }
-    std::stringstream ss;
-    ss << "Cleanup started: 0x" << std::hex << cleanup_thread_ << std::endl;
-    std::cout << ss.str() << std::flush;
 #endif
   }
 
   ~RQProvider() {
+    stopCleanup();
+#ifdef BUNDLE_CLEANUP_DIRTY
+    delete[] dirty_logs_;
+#endif
+    delete[] rq_thread_data_;
+  }
+
+  // Stops the background cleanup workers. Data structures call this before
+  // tearing themselves down, since workers may still be traversing them. Any
+  // logged nodes are cleaned, which retires nodes that were erased while in a
+  // dirty log.
+  void stopCleanup() {
 #ifdef BUNDLE_CLEANUP_BACKGROUND
+    if (cleanup_stopped_) return;
+    cleanup_stopped_ = true;
     std::cout << "Stopping cleanup..." << std::endl << std::flush;
     stop_cleanup_ = true;
-    if (pthread_join(cleanup_thread_, nullptr)) {
-      cerr << "ERROR: could not join thread" << endl;
-      exit(-1);
+    for (int i = 0; i < BUNDLE_CLEANUP_THREADS; ++i) {
+      if (pthread_join(cleanup_threads_[i], nullptr)) {
+        cerr << "ERROR: could not join thread" << endl;
+        exit(-1);
+      }
+      delete cleanup_args_[i];
     }
-    delete cleanup_args_;
+#ifdef BUNDLE_CLEANUP_DIRTY
+    // No range query is active at this point.
+    drain_dirty(0 /* tid */, 0, 1, timestamp_.current());
+#endif
 #endif
-    delete[] rq_thread_data_;
   }
 
   void initThread(const int tid) {
@@ -148,26 +285,8 @@ class RQProvider {
       init_[tid] = !init_[tid];
   }
 
-  inline void backoff(int amount) {
-    if (amount == 0) return;
-    volatile long long sum = 0;
-    int limit = amount;
-    for (int i = 0; i < limit; i++) sum += i;
-  }
-
   inline long long getNextTS(const int tid) {
-    // return __sync_fetch_and_add(&timestamp, 1);
-    timestamp_t ts = curr_timestamp_.load(std::memory_order_seq_cst);
-    backoff(backoff_amt);
-    if (ts == curr_timestamp_.load(std::memory_order_seq_cst)) {
-      if (curr_timestamp_.fetch_add(1, std::memory_order_release) == ts)
-        backoff_amt /= 2;
-      else
-        backoff_amt *= 2;
-    }
-    if (backoff_amt < 1) backoff_amt = 1;
-    if (backoff_amt > 512) backoff_amt = 512;
-    return ts + 1;
+    return timestamp_.next_update_ts(tid);
   }
 
   inline void init_node(int tid, NodeType *const node) {}
@@ -188,17 +307,30 @@ class RQProvider {
     return *addr;
   }
 
-#define BUNDLE_INIT_CLEANUP(provider) \
-  const timestamp_t ts = provider->get_oldest_active_rq();
-#define BUNDLE_CLEAN_BUNDLE(bundle) bundle.reclaimEntries(ts)
+// Cleanup assumes that `tid` is in scope and that the caller is not quiescent,
+// since reclaimed entries are retired to the record manager.
+#define BUNDLE_INIT_CLEANUP(provider)                \
+  auto *const __cleanup_provider = (provider);       \
+  const timestamp_t ts = __cleanup_provider->get_oldest_active_rq(tid);
+#define BUNDLE_CLEAN_BUNDLE(bundle) \
+  __cleanup_provider->reclaim_bundle(tid, &(bundle), ts)
+#define BUNDLE_CLEAN_VALUES(values) \
+  __cleanup_provider->reclaim_values(tid, &(values), ts)
+
+  // Creates a snapshot of the current state of active RQs. The current
+  // timestamp must be read before the announcements: a range query whose
+  // announcement is missed takes its timestamp afterwards, so it is no older.
+  inline timestamp_t get_oldest_active_rq(const int tid) {
+    const timestamp_t oldest_active = scan_rqs(timestamp_.current());
+    horizon_.store(oldest_active, std::memory_order_release);
+    return oldest_active;
+  }
 
-  // Creates a snapshot of the current state of active RQs.
-  inline timestamp_t get_oldest_active_rq() {
-    timestamp_t oldest_active = curr_timestamp_.load(std::memory_order_acquire);
+  // Returns the oldest announced range query, or now if there is none.
+  inline timestamp_t scan_rqs(const timestamp_t now) {
+    timestamp_t oldest_active = now;
     timestamp_t curr_rq;
     for (int i = 0; i < num_processes_; ++i) {
-      while (rq_thread_data_[i].data.rq_flag == true)
-        ;  // Wait until RQ linearizes itself.
       curr_rq = rq_thread_data_[i].data.rq_lin_time;
       if (curr_rq != BUNDLE_NULL_TIMESTAMP && curr_rq < oldest_active) {
         oldest_active = curr_rq;  // Update oldest.
@@ -207,33 +339,116 @@ class RQProvider {
     return oldest_active;
   }
 
+  // Records how far the oldest active range query lags behind the current
+  // timestamp, for a sample of the range queries started by tid.
+  inline void sample_lag(const int tid) {
+    if (!telemetry_.sample_rq(tid)) return;
+    const timestamp_t now = timestamp_.current();
+    telemetry_.record_lag(tid, now - scan_rqs(now));
+  }
+
+  // Returns a possibly stale oldest active RQ, rescanning the announcements
+  // once every BUNDLE_HORIZON_REFRESH calls by the same thread to this
+  // provider.
+  inline timestamp_t get_cached_oldest_active_rq(const int tid) {
+    int *const calls = &rq_thread_data_[tid].data.horizon_calls;
+    if (++*calls >= BUNDLE_HORIZON_REFRESH) {
+      *calls = 0;
+      return get_oldest_active_rq(tid);
+    }
+    return horizon_.load(std::memory_order_acquire);
+  }
+
 #ifdef BUNDLE_CLEANUP_BACKGROUND
+  // Pins the calling thread to the CPUs of NUMA node `node`, modulo the number
+  // of nodes. The thread is left unpinned if the topology is unavailable.
+  static void pin_to_numa_node(int node) {
+    int num_nodes = 0;
+    while (std::ifstream("/sys/devices/system/node/node" +
+                         std::to_string(num_nodes) + "/cpulist")
+               .good()) {
+      ++num_nodes;
+    }
+    if (num_nodes == 0) return;
+    std::ifstream file("/sys/devices/system/node/node" +
+                       std::to_string(node % num_nodes) + "/cpulist");
+    std::string range;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    // The list has the form "0-3,8-11".
+    while (std::getline(file, range, ',')) {
+      int first, last;
+      char dash;
+      std::stringstream ss(range);
+      if (!(ss >> first)) continue;
+      if (!(ss >> dash >> last)) last = first;
+      for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+        CPU_SET(cpu, &cpus);
+      }
+    }
+    if (CPU_COUNT(&cpus) > 0) {
+      pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+  }
+
+  // Each worker cleans its share of the data structure. Workers are spread
+  // over the NUMA nodes and back off while passes reclaim little.
   static void *cleanup_run(void *args) {
-    std::cout << "Starting cleanup" << std::endl << std::flush;
     struct cleanup_args *c = (struct cleanup_args *)args;
-    long i = 0;
+    DataStructure *const ds = c->provider->ds_;
+    volatile long long *const reclaimed =
+        &c->provider->rq_thread_data_[c->tid].data.reclaimed;
+    std::stringstream ss;
+    ss << "Starting cleanup " << c->worker << std::endl;
+    std::cout << ss.str() << std::flush;
+    pin_to_numa_node(c->worker);
+    long sleep = BUNDLE_CLEANUP_SLEEP;
     while (!(*(c->stop))) {
-      usleep(BUNDLE_CLEANUP_SLEEP);
-      c->ds->cleanup(c->tid);
+      usleep(sleep);
+      // Reclaimed entries are retired, so this thread must be registered with
+      // the record manager. This is deferred until the data structure has
+      // finished construction and is a no-op after the first pass.
+      ds->initThread(c->tid);
+      long long before = *reclaimed;
+      auto start = std::chrono::steady_clock::now();
+#ifdef BUNDLE_CLEANUP_DIRTY
+      c->provider->recmgr_->leaveQuiescentState(c->tid);
+      c->provider->drain_dirty(c->tid, c->worker, BUNDLE_CLEANUP_THREADS,
+                               c->provider->get_oldest_active_rq(c->tid));
+      c->provider->recmgr_->enterQuiescentState(c->tid);
+#else
+      ds->cleanup(c->tid, c->worker, BUNDLE_CLEANUP_THREADS);
+#endif
+      c->provider->telemetry_.record_pass(
+          c->tid, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count());
+      long long pass = *reclaimed - before;
+      if (pass > BUNDLE_CLEANUP_TARGET) {
+        sleep = std::max(sleep / 2, std::min((long)BUNDLE_CLEANUP_SLEEP_MIN,
+                                             (long)BUNDLE_CLEANUP_SLEEP));
+      } else if (pass < BUNDLE_CLEANUP_TARGET / 2) {
+        sleep = std::min(sleep * 2, (long)BUNDLE_CLEANUP_SLEEP);
+      }
     }
+    ds->deinitThread(c->tid);
     pthread_exit(nullptr);
   }
 #endif
 
-  // Atomically increments the global timestamp and returns the new value to the
-  // caller.
+  // Returns the linearization timestamp of an update whose bundles are pending.
   inline timestamp_t get_update_lin_time(int tid) {
 #ifdef BUNDLE_RQTS
-    return curr_timestamp_.load(std::memory_order_acquire);
+    return timestamp_.current();
 #elif defined(BUNDLE_UNSAFE_BUNDLE)
 #ifdef BUNDLE_TIMESTAMP_RELAXATION
     if (((rq_thread_data_[tid].data.local_timestamp + 1) %
          BUNDLE_TIMESTAMP_RELAXATION) == 0) {
       ++rq_thread_data_[tid].data.local_timestamp;
-      return curr_timestamp_.fetch_add(1) + 1;
+      return timestamp_.advance();
     } else {
       ++rq_thread_data_[tid].data.local_timestamp;
-      return curr_timestamp_;
+      return timestamp_.current();
     }
 // #elif defined(BUNDLE_UPDATE_USES_CAS)
 #else
@@ -254,7 +469,7 @@ class RQProvider {
   }
 
   inline timestamp_t get_curr_timestamp(int tid) {
-    return curr_timestamp_.load(std::memory_order_seq_cst);
+    return timestamp_.current();
   }
 
   // Write the range query linearization time so updates do not recycle any
@@ -263,13 +478,14 @@ class RQProvider {
 #if defined(BUNDLE_RQTS)
 // Reads drive timestamp.
 #if defined(BUNDLE_UPDATE_USES_CAS)
-    timestamp_t ts = curr_timestamp_;
-    curr_timestamp_.compare_exchange_strong(ts, ts + 1);
+    timestamp_t ts = timestamp_.current();
+    timestamp_.advance();
     return ts;
 #else
-    rq_thread_data_[tid].data.rq_flag.store(true, std::memory_order_acquire);
+    rq_thread_data_[tid].data.rq_lin_time = timestamp_.current();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
     rq_thread_data_[tid].data.rq_lin_time = getNextTS(tid) - 1;
-    rq_thread_data_[tid].data.rq_flag.store(false, std::memory_order_release);
+    sample_lag(tid);
     return rq_thread_data_[tid].data.rq_lin_time;
     // return getNextTS(tid) - 1;
 #endif
@@ -279,7 +495,7 @@ class RQProvider {
   ++rq_thread_data_[tid].data.local_timestamp;
   if (((rq_thread_data_[tid].data.local_timestamp + 1) %
        BUNDLE_TIMESTAMP_RELAXATION) == 0) {
-    rq_thread_data_[tid].data.local_timestamp = curr_timestamp_;
+    rq_thread_data_[tid].data.local_timestamp = timestamp_.current();
     return rq_thread_data_[tid].data.local_timestamp;
   } else {
     return rq_thread_data_[tid].data.local_timestamp;
@@ -289,9 +505,11 @@ class RQProvider {
   return BUNDLE_MIN_TIMESTAMP;
 #endif
 #else
-  rq_thread_data_[tid].data.rq_flag.store(true, std::memory_order_acquire);
-  rq_thread_data_[tid].data.rq_lin_time = curr_timestamp_;
-  rq_thread_data_[tid].data.rq_flag.store(false, std::memory_order_release);
+  // Announce a lower bound until the linearization time is known.
+  rq_thread_data_[tid].data.rq_lin_time = timestamp_.current();
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  rq_thread_data_[tid].data.rq_lin_time = timestamp_.next_rq_ts(tid);
+  sample_lag(tid);
   return rq_thread_data_[tid].data.rq_lin_time;
 #endif
   }
@@ -306,6 +524,26 @@ class RQProvider {
     int start = (*startIndex);
     int keysInNode =
         ds_->getKeys(tid, node, rqResultKeys + start, rqResultValues + start);
+    filter_range(rqResultKeys, rqResultValues, startIndex, keysInNode, lo, hi);
+  }
+
+  // Like traversal_try_add(), but for data structures that replace values in
+  // place: the values are read as of ts, the timestamp of the range query.
+  inline void traversal_try_add(const int tid, NodeType *const node,
+                                K *const rqResultKeys, V *const rqResultValues,
+                                int *const startIndex, const K &lo, const K &hi,
+                                const timestamp_t ts) {
+    int start = (*startIndex);
+    int keysInNode = ds_->getKeys(tid, node, rqResultKeys + start,
+                                  rqResultValues + start, ts);
+    filter_range(rqResultKeys, rqResultValues, startIndex, keysInNode, lo, hi);
+  }
+
+  // Keeps the keysInNode keys just added at *startIndex that are in [lo, hi].
+  inline void filter_range(K *const rqResultKeys, V *const rqResultValues,
+                           int *const startIndex, const int keysInNode,
+                           const K &lo, const K &hi) {
+    int start = (*startIndex);
     assert(keysInNode < RQ_DEBUGGING_MAX_KEYS_PER_NODE);
     if (keysInNode == 0) return;
     int location = start;
@@ -330,8 +568,22 @@ class RQProvider {
 #endif
   }
 
+  // Announces a timestamp that stays pinned until close_snapshot(), so that
+  // cleanup keeps every bundle entry needed to read the snapshot.
+  inline BundleSnapshot open_snapshot(int tid) {
+    BundleSnapshot s;
+    s.ts = start_traversal(tid);
+    return s;
+  }
+
+  inline void close_snapshot(int tid, BundleSnapshot &s) {
+    end_traversal(tid);
+    s.ts = BUNDLE_NULL_TIMESTAMP;
+  }
+
   // Prepares bundles by calling prepare on each provided bundle-pointer pair.
-  inline void prepare_bundles(BUNDLE_TYPE_DECL<NodeType> *bundles[],
+  inline void prepare_bundles(const int tid,
+                              BUNDLE_TYPE_DECL<NodeType> *bundles[],
                               NodeType *const *const ptrs) {
     // PENDING_TIMESTAMP blocks all RQs that might see the update, ensuring that
     // the update is visible (i.e., get and RQ have the same linearization
@@ -341,9 +593,11 @@ class RQProvider {
     BUNDLE_TYPE_DECL<NodeType> *curr_bundle = bundles[0];
     NodeType *curr_ptr = ptrs[0];
     while (curr_bundle != nullptr) {
-      curr_bundle->prepare(curr_ptr);
+      telemetry_.count_allocated(tid,
+                                 curr_bundle->prepare(tid, curr_ptr, recmgr_));
+      telemetry_.sample_length(tid, curr_bundle);
 #ifdef BUNDLE_CLEANUP_UPDATE
-      curr_bundle->reclaimEntries(get_oldest_active_rq());
+      reclaim_bundle(tid, curr_bundle, get_cached_oldest_active_rq(tid));
 #endif
       ++i;
       curr_bundle = bundles[i];
@@ -363,6 +617,206 @@ class RQProvider {
     SOFTWARE_BARRIER;
   }
 
+  // Replaces the entries of a bundle with a single entry referencing ptr that
+  // every range query observes. Used to build a data structure in place, so no
+  // other thread may access the bundle.
+  inline void reset_bundle(const int tid, BUNDLE_TYPE_DECL<NodeType> *bundle,
+                           NodeType *const ptr) {
+    bundle->deallocateEntries(tid, recmgr_);
+    bundle->init();
+    telemetry_.count_allocated(tid, bundle->prepare(tid, ptr, recmgr_));
+    bundle->finalize(BUNDLE_MIN_TIMESTAMP);
+  }
+
+#ifdef BUNDLE_LOCKFREE
+  // Allocates the pending entry of a lock-free update to bundle (see
+  // LinkedBundle::newEntry()). An entry that is never installed must be
+  // returned with discard_entry().
+  inline BUNDLE_ENTRY_TYPE_DECL<NodeType> *new_entry(
+      const int tid, BUNDLE_TYPE_DECL<NodeType> *bundle, NodeType *const ptr) {
+    telemetry_.count_allocated(tid, 1);
+    telemetry_.sample_length(tid, bundle);
+    return bundle->newEntry(tid, ptr, recmgr_);
+  }
+
+  inline void discard_entry(const int tid, BUNDLE_TYPE_DECL<NodeType> *bundle,
+                            BUNDLE_ENTRY_TYPE_DECL<NodeType> *const entry) {
+    telemetry_.count_allocated(tid, -1);
+    bundle->discard(tid, entry, recmgr_);
+  }
+#endif
+
+  // Retires the entries of bundles belonging to a node that is being retired.
+  // The node must be locked and already unreachable to new operations.
+  inline void retire_bundles(const int tid,
+                             BUNDLE_TYPE_DECL<NodeType> **bundles) {
+    for (int i = 0; bundles[i] != nullptr; ++i) {
+      rq_thread_data_[tid].data.reclaimed +=
+          bundles[i]->retireEntries(tid, recmgr_);
+    }
+  }
+
+  // Frees the entries of bundles belonging to a node that is being
+  // deallocated. Only used when the data structure is being destroyed.
+  inline void deallocate_bundles(const int tid,
+                                 BUNDLE_TYPE_DECL<NodeType> **bundles) {
+    for (int i = 0; bundles[i] != nullptr; ++i) {
+      bundles[i]->deallocateEntries(tid, recmgr_);
+    }
+  }
+
+  // Retires a node that was unlinked by an erase, along with its bundles. A
+  // node that is still in a dirty log is instead retired by the worker that
+  // drains it. The node must be locked.
+  inline void retire_node(const int tid, NodeType *const node,
+                          BUNDLE_TYPE_DECL<NodeType> **bundles) {
+#ifdef BUNDLE_CLEANUP_DIRTY
+    if (node->dirty) return;
+#endif
+    recmgr_->retire(tid, node);
+    retire_bundles(tid, bundles);
+  }
+
+  // Records that the bundles of node have gained an entry. If the log of the
+  // calling thread is full, the bundles are cleaned immediately instead. The
+  // node must be locked.
+  inline void mark_dirty(const int tid, NodeType *const node,
+                         BUNDLE_TYPE_DECL<NodeType> **bundles) {
+#ifdef BUNDLE_CLEANUP_DIRTY
+    if (node->dirty) return;
+    dirty_log &log = dirty_logs_[tid];
+    const long long tail = log.tail.load(std::memory_order_relaxed);
+    if (tail - log.head.load(std::memory_order_acquire) <
+        BUNDLE_DIRTY_LOG_SIZE) {
+      node->dirty = true;
+      log.nodes[tail % BUNDLE_DIRTY_LOG_SIZE] = node;
+      log.tail.store(tail + 1, std::memory_order_release);
+      return;
+    }
+    const timestamp_t ts = get_cached_oldest_active_rq(tid);
+    for (int i = 0; bundles[i] != nullptr; ++i) {
+      reclaim_bundle(tid, bundles[i], ts);
+    }
+#endif
+  }
+
+#ifdef BUNDLE_CLEANUP_DIRTY
+  // Cleans a node taken from a dirty log. If the node was erased while logged,
+  // it is retired here. Otherwise, its bundles are cleaned and it is logged
+  // again if range queries still need some of the older entries. The node
+  // must be locked.
+  inline void clean_dirty(const int tid, NodeType *const node,
+                          BUNDLE_TYPE_DECL<NodeType> **bundles,
+                          const timestamp_t ts) {
+    node->dirty = false;
+    if (node->marked) {
+      recmgr_->retire(tid, node);
+      retire_bundles(tid, bundles);
+      return;
+    }
+    bool clean = true;
+    for (int i = 0; bundles[i] != nullptr; ++i) {
+      reclaim_bundle(tid, bundles[i], ts);
+      if (bundles[i]->size() > 1) clean = false;
+    }
+    if (!clean) mark_dirty(tid, node, bundles);
+  }
+
+  // Cleans the nodes currently in the logs assigned to worker, using
+  // DataStructure::cleanupDirty() to lock them. Nodes logged again while
+  // draining are left for the next pass. The caller must not be quiescent.
+  void drain_dirty(const int tid, const int worker, const int num_workers,
+                   const timestamp_t ts) {
+    for (int i = worker; i < num_processes_; i += num_workers) {
+      dirty_log &log = dirty_logs_[i];
+      long long head = log.head.load(std::memory_order_relaxed);
+      const long long tail = log.tail.load(std::memory_order_acquire);
+      for (; head < tail; ++head) {
+        NodeType *node = log.nodes[head % BUNDLE_DIRTY_LOG_SIZE];
+        log.head.store(head + 1, std::memory_order_release);
+        ds_->cleanupDirty(tid, node, ts);
+      }
+    }
+  }
+#endif
+
+  // Reclaims entries of a single bundle that are no longer needed by any range
+  // query at or after ts. Used by BUNDLE_CLEAN_BUNDLE.
+  inline void reclaim_bundle(const int tid, BUNDLE_TYPE_DECL<NodeType> *bundle,
+                             timestamp_t ts) {
+    rq_thread_data_[tid].data.reclaimed +=
+        bundle->reclaimEntries(tid, ts, recmgr_);
+  }
+
+  // Reports the telemetry collected since construction or the last call to
+  // reset_telemetry(). See bundle_telemetry.h.
+  std::string telemetry_string() {
+    return telemetry_.toString(total_reclaimed(),
+                               sizeof(BUNDLE_ENTRY_TYPE_DECL<NodeType>));
+  }
+
+  void reset_telemetry() { telemetry_.reset(total_reclaimed()); }
+
+  // Returns the number of records reclaimed by all threads.
+  long long total_reclaimed() {
+    long long sum = 0;
+    for (int i = 0; i < num_processes_; ++i) {
+      sum += rq_thread_data_[i].data.reclaimed;
+    }
+    return sum;
+  }
+
+  // Replaces the current value *val of a node with new_val in place. The
+  // replaced version stays in the node's value history for range queries
+  // older than the returned linearization timestamp. Versions that are no
+  // longer needed are reclaimed using the cached horizon. The node must be
+  // locked.
+  inline timestamp_t update_value(const int tid, ValueHistory<V> *values,
+                                  V volatile *const val, const V &new_val) {
+    prepare_value(tid, values, val, new_val);
+    SOFTWARE_BARRIER;
+    timestamp_t ts = get_update_lin_time(tid);
+    SOFTWARE_BARRIER;
+    finalize_value(tid, values, ts);
+    return ts;
+  }
+
+  // The two halves of update_value(), for updates that linearize several
+  // changes at one timestamp. Range queries that reach the node wait for the
+  // pending value until it is finalized. The node must be locked throughout.
+  inline void prepare_value(const int tid, ValueHistory<V> *values,
+                            V volatile *const val, const V &new_val) {
+    telemetry_.count_allocated(tid,
+                               values->prepare(tid, val, new_val, recmgr_));
+  }
+
+  inline void finalize_value(const int tid, ValueHistory<V> *values,
+                             timestamp_t ts) {
+    values->finalize(ts);
+    reclaim_values(tid, values, get_cached_oldest_active_rq(tid));
+  }
+
+  // Reclaims versions of a value history that are no longer needed by any
+  // range query at or after ts. Used by BUNDLE_CLEAN_VALUES.
+  inline void reclaim_values(const int tid, ValueHistory<V> *values,
+                             timestamp_t ts) {
+    rq_thread_data_[tid].data.reclaimed +=
+        values->reclaimEntries(tid, ts, recmgr_);
+  }
+
+  // Retires the value history of a node that is being erased. The node must
+  // be locked and already marked, so that its history is never cleaned again.
+  inline void retire_values(const int tid, ValueHistory<V> *values) {
+    rq_thread_data_[tid].data.reclaimed +=
+        values->retireEntries(tid, recmgr_);
+  }
+
+  // Frees the value history of a node that is being deallocated. Only used
+  // when the data structure is being destroyed.
+  inline void deallocate_values(const int tid, ValueHistory<V> *values) {
+    values->deallocateEntries(tid, recmgr_);
+  }
+
   // Find and update the newest reference in the predecesor's bundle. If this
   // operation is an insert, then the new nodes bundle must also be
   // initialized. Any node whose bundle is passed here must be locked.
@@ -8,6 +8,8 @@
 #include <atomic>
 #include <unordered_set>
 
+#include "bundle_timestamp.h"
+
 #ifndef casword_t
 #define casword_t uintptr_t
 #endif
@@ -15,14 +17,24 @@
 #define CAS(addr, expected_value, new_value) \
   __sync_bool_compare_and_swap((addr), (expected_value), (new_value))
 
-static thread_local int backoff_amt = 1;
+// Versions are labeled with timestamp_t, as bundles are. By default range
+// queries advance a global counter. With VCAS_TIMESTAMP_TSC, versions are
+// labeled with the invariant timestamp counter of the executing core instead,
+// so taking a snapshot writes nothing shared (see TscTimestamp).
+
+#ifndef VCAS_HORIZON_REFRESH
+// Number of successful vCAS updates by a thread between recomputations of its
+// truncation horizon.
+#define VCAS_HORIZON_REFRESH 64
+#endif
 
 #ifdef NVCAS_OPTIMIZATION
-// Encodes a vCAS object
+// Encodes a vCAS object. Versions are allocated and retired through the record
+// manager, so it must manage vcas_obj_t<T> for every T a data structure uses.
 template <typename T>
 struct vcas_obj_t {
   T val;
-  int ts;
+  volatile timestamp_t ts;
   vcas_obj_t<T>* nextv;
   vcas_obj_t(T val, vcas_obj_t<T>* nextv)
       : val(val), nextv(nextv), ts(-1) {}  // TBD=-1
@@ -39,7 +51,9 @@ class RQProvider {
     union {
       struct {  // anonymous struct inside anonymous union means we don't need
                 // to type anything special to access these variables
-        long long rq_lin_time;
+        volatile timestamp_t rq_lin_time;  // announced by range queries
+        timestamp_t horizon;               // cached truncation horizon
+        int updates_since_refresh;
       };
       char bytes[__RQ_THREAD_DATA_SIZE];  // avoid false sharing
     };
@@ -49,7 +63,11 @@ class RQProvider {
 
   const int NUM_PROCESSES;
   volatile char padding0[PREFETCH_SIZE_BYTES];
-  volatile long long timestamp = 1;
+#ifdef VCAS_TIMESTAMP_TSC
+  TscTimestamp clock_;
+#else
+  volatile timestamp_t timestamp = 1;
+#endif
   volatile char padding1[PREFETCH_SIZE_BYTES];
   RWLock rwlock;
   volatile char padding2[PREFETCH_SIZE_BYTES];
@@ -69,9 +87,12 @@ class RQProvider {
     for (int i = 0; i < limit; i++) sum += i;
   }
 
-  inline long long takeSnapshot(const int tid) {
+  inline timestamp_t takeSnapshot(const int tid) {
+#ifdef VCAS_TIMESTAMP_TSC
+    return clock_.next_rq_ts(tid);
+#else
     // return __sync_fetch_and_add(&timestamp, 1);
-    long long ts = timestamp;
+    timestamp_t ts = timestamp;
     backoff(backoff_amt);
     std::atomic_thread_fence(std::memory_order_seq_cst);
     if (ts == timestamp) {
@@ -90,6 +111,16 @@ class RQProvider {
       // nodesSeen.clear();
 #endif
     return ts;
+#endif
+  }
+
+  // Returns a timestamp that is no greater than that of any future range query.
+  inline timestamp_t currentTS() {
+#ifdef VCAS_TIMESTAMP_TSC
+    return clock_.current();
+#else
+    return timestamp;
+#endif
   }
 
   // Camera S;
@@ -98,7 +129,11 @@ class RQProvider {
   inline void initTS(T node) {
     if (node->ts == TBD) {
       // node->ts = 0;
-      long long curTS = timestamp;
+#ifdef VCAS_TIMESTAMP_TSC
+      timestamp_t curTS = clock_.next_update_ts(0 /* unused */);
+#else
+      timestamp_t curTS = timestamp;
+#endif
       CAS(&(node->ts), TBD, curTS);
     }
   }
@@ -110,12 +145,94 @@ class RQProvider {
     }
   }
 
+#ifdef NVCAS_OPTIMIZATION
+  // Returns a timestamp no newer than that of any ongoing or future range
+  // query. The timestamp is read before the announcements, and a range query
+  // announces a timestamp before reading its own, so a range query that is
+  // missed by the scan reads a newer timestamp. The result is recomputed
+  // every VCAS_HORIZON_REFRESH calls, since an older horizon is still safe.
+  inline timestamp_t getHorizon(const int tid) {
+    __rq_thread_data* const data = &threadData[tid];
+    if (++data->updates_since_refresh < VCAS_HORIZON_REFRESH) {
+      return data->horizon;
+    }
+    data->updates_since_refresh = 0;
+    timestamp_t horizon = currentTS();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (int i = 0; i < NUM_PROCESSES; ++i) {
+      timestamp_t ts = threadData[i].rq_lin_time;
+      if (ts != TIMESTAMP_NOT_SET && ts < horizon) horizon = ts;
+    }
+    data->horizon = horizon;
+    return horizon;
+  }
+
+  // Retires the versions from v onward. Their links are left intact, since
+  // range queries that started earlier may still be walking them.
+  template <typename T>
+  inline void retireVersions(const int tid, vcas_obj_t<T>* v) {
+    while (v != nullptr) {
+      vcas_obj_t<T>* next = v->nextv;
+      recmgr->retire(tid, v);
+      v = next;
+    }
+  }
+
+  // Cuts the chain of head after the newest version that every range query
+  // can use, i.e., the first whose timestamp is not newer than the horizon,
+  // and retires the versions behind it. Range queries stop at or before the
+  // cut, so they never follow the link that is cleared. The data structures
+  // serialize the updates of a field with the lock of its node, so no other
+  // thread truncates the same chain concurrently.
+  template <typename T>
+  inline void truncate(const int tid, vcas_obj_t<T>* head) {
+    const timestamp_t horizon = getHorizon(tid);
+    vcas_obj_t<T>* v = head;
+    while (v != nullptr) {
+      initTS(v);
+      if (v->ts <= horizon) break;
+      v = v->nextv;
+    }
+    if (v == nullptr || v->nextv == nullptr) return;
+    vcas_obj_t<T>* suffix = v->nextv;
+    v->nextv = nullptr;
+    retireVersions(tid, suffix);
+  }
+
+  // Installs a new version of val on top of the chain at lin_vcas_obj, which
+  // must currently hold lin_oldval.
+  template <typename T>
+  inline bool pushVersion(const int tid,
+                          vcas_obj_t<T>* volatile* const lin_vcas_obj,
+                          const T& lin_oldval, const T& lin_newval) {
+    vcas_obj_t<T>* head = *(lin_vcas_obj);
+    initTS(head);
+    if (head->val != lin_oldval) return false;
+    if (lin_newval == lin_oldval) return true;
+    vcas_obj_t<T>* new_head = new_vcas(tid, lin_newval);
+    new_head->nextv = head;
+    if (CAS(lin_vcas_obj, head, new_head)) {
+      initTS(new_head);
+      truncate(tid, new_head);
+      return true;
+    }
+    recmgr->deallocate(tid, new_head);
+    initTS(*lin_vcas_obj);
+    return false;
+  }
+#endif
+
  public:
-  static const int TBD = -1;
+  static const timestamp_t TBD = -1;
 
   RQProvider(const int numProcesses, DataStructure* ds, RecordManager* recmgr)
       : NUM_PROCESSES(numProcesses), ds(ds), recmgr(recmgr) {
     threadData = new __rq_thread_data[numProcesses];
+    for (int i = 0; i < numProcesses; ++i) {
+      threadData[i].rq_lin_time = TIMESTAMP_NOT_SET;
+      threadData[i].horizon = TIMESTAMP_NOT_SET;
+      threadData[i].updates_since_refresh = VCAS_HORIZON_REFRESH;
+    }
     DEBUG_INIT_RQPROVIDER(numProcesses);
   }
 
@@ -152,6 +269,35 @@ class RQProvider {
   // invoke whenever a new node is created/initialized
   inline void init_node(const int tid, NodeType* const node) {}
 
+  // allocates the vCAS object of a field of a new node, with initial value val
+  template <typename T>
+  inline vcas_obj_t<T>* new_vcas(const int tid, const T& val) {
+    vcas_obj_t<T>* obj = recmgr->template allocate<vcas_obj_t<T>>(tid);
+    obj->val = val;
+    obj->ts = TBD;
+    obj->nextv = nullptr;
+    return obj;
+  }
+
+  // retires every version of a field of a node that is being retired. Invoked
+  // through DataStructure::retireVersions() when the node is retired, so range
+  // queries that can still reach the node can also still read its versions.
+  template <typename T>
+  inline void retire_vcas(const int tid, vcas_obj_t<T>* const obj) {
+    retireVersions(tid, obj);
+  }
+
+  // frees every version of a field of a node that is being deallocated, when
+  // no other thread can access the data structure
+  template <typename T>
+  inline void deallocate_vcas(const int tid, vcas_obj_t<T>* obj) {
+    while (obj != nullptr) {
+      vcas_obj_t<T>* next = obj->nextv;
+      recmgr->deallocate(tid, obj);
+      obj = next;
+    }
+  }
+
   // for each address addr that is modified by rq_linearize_update_at_write
   // or rq_linearize_update_at_cas, you must replace any initialization of addr
   // with invocations of rq_write_addr
@@ -184,7 +330,7 @@ class RQProvider {
   // invocations of rq_read_addr
   template <typename T>
   inline T read_vcas(const int tid, vcas_obj_t<T> volatile* const vcas_obj,
-                     const int ts) {
+                     const timestamp_t ts) {
     vcas_obj_t<T> volatile* head = vcas_obj;
     initTS(head);
     while (head != nullptr && head->ts > ts) {
@@ -234,6 +380,9 @@ class RQProvider {
                                           NodeType* const* const deletedNodes) {
     int i;
     for (i = 0; deletedNodes[i]; ++i) {
+#ifdef NVCAS_OPTIMIZATION
+      ds->retireVersions(tid, deletedNodes[i]);
+#endif
       recmgr->retire(tid, deletedNodes[i]);
     }
   }
@@ -270,26 +419,7 @@ class RQProvider {
   template <typename T>
   inline bool cas_vcas(const int tid, vcas_obj_t<T>* volatile* const lin_vcas_obj,
                     const T& lin_oldval, const T& lin_newval) {
-    long long ts = 1;
-    bool res;
-    vcas_obj_t<T>* head = *(lin_vcas_obj);
-    initTS(head);
-    if (head->val != lin_oldval)
-      res = false;
-    else if (lin_newval == lin_oldval)
-      res = true;
-    else {
-      vcas_obj_t<T>* new_head = new vcas_obj_t<T>(lin_newval, head);
-      res = CAS(lin_vcas_obj, head, new_head);
-      if (res) {
-        initTS(new_head);
-      } else {
-        delete new_head;
-        initTS(*lin_vcas_obj);
-      }
-    }
-
-    return res;
+    return pushVersion(tid, lin_vcas_obj, lin_oldval, lin_newval);
   }
 
   // replace the linearization point of an update that inserts or deletes nodes
@@ -305,24 +435,7 @@ class RQProvider {
       announce_physical_deletion(tid, deletedNodes);
     }
 
-    long long ts = 1;
-    bool res;
-    vcas_obj_t<T>* head = *(lin_vcas_obj);
-    initTS(head);
-    if (head->val != lin_oldval)
-      res = false;
-    else if (lin_newval == lin_oldval)
-      res = true;
-    else {
-      vcas_obj_t<T>* new_head = new vcas_obj_t<T>(lin_newval, head);
-      res = CAS(lin_vcas_obj, head, new_head);
-      if (res) {
-        initTS(new_head);
-      } else {
-        delete new_head;
-        initTS(*lin_vcas_obj);
-      }
-    }
+    bool res = pushVersion(tid, lin_vcas_obj, lin_oldval, lin_newval);
 
     if (res) {
       if (!logicalDeletion) {
@@ -340,8 +453,12 @@ class RQProvider {
   }
 
   // invoke at the start of each traversal
-  inline int traversal_start(const int tid) {
+  inline timestamp_t traversal_start(const int tid) {
     // versionNodesTraversed = 0;
+    // Announce a lower bound on the snapshot's timestamp before taking it, so
+    // that updates do not truncate the versions it reads (see getHorizon).
+    threadData[tid].rq_lin_time = currentTS();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
     return takeSnapshot(tid);
   }
 
@@ -351,7 +468,7 @@ class RQProvider {
   inline void traversal_try_add(const int tid, NodeType* const node,
                                 K* const rqResultKeys, V* const rqResultValues,
                                 int* const startIndex, const K& lo, const K& hi,
-                                const int ts) {
+                                const timestamp_t ts) {
     int start = (*startIndex);
     int keysInNode = ds->getKeys(tid, node, rqResultKeys + start,
                                  rqResultValues + start, ts);
@@ -403,7 +520,8 @@ class RQProvider {
   // or rq_linearize_update_at_cas, you must replace any reads of addr with
   // invocations of rq_read_addr
   template <typename T>
-  inline T read_addr(const int tid, T volatile* const addr, const int ts) {
+  inline T read_addr(const int tid, T volatile* const addr,
+                     const timestamp_t ts) {
     T head = *addr;
     // if(head != NULL)
     //     std::cout << "ts: " << ts << ", node ts: " << head->ts << endl;
@@ -531,7 +649,7 @@ class RQProvider {
   }
 
   // invoke at the start of each traversal
-  inline int traversal_start(const int tid) {
+  inline timestamp_t traversal_start(const int tid) {
     // versionNodesTraversed = 0;
     return takeSnapshot(tid);
   }
@@ -542,7 +660,7 @@ class RQProvider {
   inline void traversal_try_add(const int tid, NodeType* const node,
                                 K* const rqResultKeys, V* const rqResultValues,
                                 int* const startIndex, const K& lo, const K& hi,
-                                const int ts) {
+                                const timestamp_t ts) {
     int start = (*startIndex);
     int keysInNode = ds->getKeys(tid, node, rqResultKeys + start,
                                  rqResultValues + start, ts);
@@ -574,6 +692,7 @@ class RQProvider {
     DEBUG_RECORD_RQ_SIZE(*startIndex);
     DEBUG_RECORD_RQ_CHECKSUM(tid, threadData[tid].rq_lin_time, rqResultKeys,
                              *startIndex);
+    threadData[tid].rq_lin_time = TIMESTAMP_NOT_SET;
   }
 };
 
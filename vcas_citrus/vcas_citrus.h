@@ -83,6 +83,8 @@ class citrustree {
     if (u->child[0]->val) dfsDeallocateBottomUp(u->child[0]->val, numNodes);
     if (u->child[1]->val) dfsDeallocateBottomUp(u->child[1]->val, numNodes);
     MEMORY_STATS++(*numNodes);
+    rqProvider->deallocate_vcas(0 /* tid */, u->child[0]);
+    rqProvider->deallocate_vcas(0 /* tid */, u->child[1]);
     recordmgr->deallocate(0 /* tid */, u);
   }
 
@@ -119,7 +121,7 @@ class citrustree {
   inline bool isLogicallyInserted(const int tid, nodeptr node) { return true; }
 
   inline int getKeys(const int tid, node_t<K, V>* node, K* const outputKeys,
-                     V* const outputValues, long long ts) {
+                     V* const outputValues, timestamp_t ts) {
     if (node->key >= NO_KEY) return 0;
     outputKeys[0] = node->key;
     outputValues[0] = node->value;
@@ -148,6 +150,12 @@ class citrustree {
 
   RecManager* const debugGetRecMgr() { return recordmgr; }
 
+  // Invoked by the RQProvider when node is retired.
+  void retireVersions(const int tid, nodeptr node) {
+    rqProvider->retire_vcas(tid, node->child[0]);
+    rqProvider->retire_vcas(tid, node->child[1]);
+  }
+
   long long getSizeInNodes(nodeptr const u) {
     if (u == NULL) return 0;
     return 1 + getSizeInNodes(u->child[0]->val) + getSizeInNodes(u->child[1]->val);
@@ -50,9 +50,9 @@ nodeptr citrustree<K, V, RecManager>::newNode(const int tid, K key, V value) {
   nnode->marked = false;
 
   // Init vcas objects.
-  nnode->child[0] = new vcas_obj_t<nodeptr>(nullptr, nullptr);
+  nnode->child[0] = rqProvider->new_vcas(tid, (nodeptr)NULL);
   rqProvider->write_vcas(tid, nnode->child[0], (nodeptr)NULL);
-  nnode->child[1] = new vcas_obj_t<nodeptr>(nullptr, nullptr);
+  nnode->child[1] = rqProvider->new_vcas(tid, (nodeptr)NULL);
   rqProvider->write_vcas(tid, nnode->child[1], (nodeptr)NULL);
 
   nnode->tag[0] = 0;
@@ -421,7 +421,7 @@ int citrustree<K, V, RecManager>::rangeQuery(const int tid, const K& lo,
                                              V* const resultValues) {
   block<node_t<K, V> > stack(NULL);
   recordmgr->leaveQuiescentState(tid, true);
-  long long ts = rqProvider->traversal_start(tid);
+  timestamp_t ts = rqProvider->traversal_start(tid);
 
   // depth first traversal (of interesting subtrees)
   int size = 0;
@@ -35,6 +35,11 @@ class lazylist {
 
   int validateLinks(const int tid, nodeptr pred, nodeptr curr);
   nodeptr new_node(const int tid, const K &key, const V &val, nodeptr next);
+  void deallocateNode(const int tid, nodeptr node) {
+    rqProvider->deallocate_vcas(tid, node->marked);
+    rqProvider->deallocate_vcas(tid, node->next);
+    recordmgr->deallocate(tid, node);
+  }
   long long debugKeySum(nodeptr head);
 
   V doInsert(const int tid, const K &key, const V &value, bool onlyIfAbsent);
@@ -103,9 +108,15 @@ class lazylist {
 
   RecManager *const debugGetRecMgr() { return recordmgr; }
 
+  // Invoked by the RQProvider when node is retired.
+  void retireVersions(const int tid, nodeptr node) {
+    rqProvider->retire_vcas(tid, node->marked);
+    rqProvider->retire_vcas(tid, node->next);
+  }
+
   //+ Integrate timestamp for vCAS
   inline int getKeys(const int tid, node_t<K, V> *node, K *const outputKeys,
-                     V *const outputValues, int ts) {
+                     V *const outputValues, timestamp_t ts) {
     // ignore marked
     outputKeys[0] = node->key;
     outputValues[0] = node->val;
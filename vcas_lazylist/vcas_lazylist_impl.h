@@ -80,10 +80,10 @@ lazylist<K, V, RecManager>::~lazylist() {
   nodeptr curr = head;
   while (curr->key < KEY_MAX) {
     nodeptr next = curr->next->val;
-    recordmgr->deallocate(dummyTid, curr);
+    deallocateNode(dummyTid, curr);
     curr = next;
   }
-  recordmgr->deallocate(dummyTid, curr);
+  deallocateNode(dummyTid, curr);
   delete rqProvider;
   delete recordmgr;
 #ifdef USE_DEBUGCOUNTERS
@@ -124,9 +124,9 @@ nodeptr lazylist<K, V, RecManager>::new_node(const int tid, const K &key,
   rqProvider->init_node(tid, nnode);
   nnode->key = key;
   nnode->val = val;
-  nnode->marked = new vcas_obj_t<long long>(0LL, nullptr);
+  nnode->marked = rqProvider->new_vcas(tid, 0LL);
   rqProvider->write_vcas(tid, nnode->marked, 0LL);
-  nnode->next = new vcas_obj_t<nodeptr>(nullptr, nullptr);
+  nnode->next = rqProvider->new_vcas(tid, (nodeptr) nullptr);
   rqProvider->write_vcas(tid, nnode->next, next);
   nnode->lock = false;
 #ifdef __HANDLE_STATS
@@ -287,7 +287,7 @@ int lazylist<K, V, RecManager>::rangeQuery(const int tid, const K &lo,
                                            const K &hi, K *const resultKeys,
                                            V *const resultValues) {
   recordmgr->leaveQuiescentState(tid, true);
-  int ts = rqProvider->traversal_start(tid);
+  timestamp_t ts = rqProvider->traversal_start(tid);
   int cnt = 0;
   nodeptr prev;
   nodeptr curr = rqProvider->read_vcas(tid, head->next, ts);
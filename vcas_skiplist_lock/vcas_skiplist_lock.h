@@ -151,8 +151,17 @@ class skiplist {
 
   RecManager* const debugGetRecMgr() { return recmgr; }
 
+  // Invoked by the RQProvider when node is retired.
+  void retireVersions(const int tid, nodeptr node) {
+    rqProvider->retire_vcas(tid, node->marked);
+    rqProvider->retire_vcas(tid, node->fullyLinked);
+    for (int level = 0; level <= node->topLevel; ++level) {
+      rqProvider->retire_vcas(tid, node->p_next[level]);
+    }
+  }
+
   inline int getKeys(const int tid, node_t<K, V>* node, K* const outputKeys,
-                     V* const outputValues, const int ts) {
+                     V* const outputValues, const timestamp_t ts) {
     outputKeys[0] = node->key;
     outputValues[0] = node->val;
     return 1;
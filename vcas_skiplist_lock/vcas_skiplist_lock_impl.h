@@ -82,12 +82,12 @@ void skiplist<K, V, RecordMgr>::initNode(const int tid, nodeptr p_node, K key,
   p_node->lock = 0;
 
   // Allocate initial vcas objects, but leave as TBD
-  p_node->marked = new vcas_obj_t<long long>(0, nullptr);
+  p_node->marked = rqProvider->new_vcas(tid, 0ll);
   rqProvider->write_vcas(tid, p_node->marked, 0ll);
-  p_node->fullyLinked = new vcas_obj_t<long long>(0, nullptr);
+  p_node->fullyLinked = rqProvider->new_vcas(tid, 0ll);
   rqProvider->write_vcas(tid, p_node->fullyLinked, 0ll);
   for (int level = 0; level <= height; ++level) {
-    p_node->p_next[level] = new vcas_obj_t<nodeptr>(nullptr, nullptr);
+    p_node->p_next[level] = rqProvider->new_vcas(tid, (nodeptr) nullptr);
   }
 }
 
@@ -175,8 +175,10 @@ skiplist<K, V, RecManager>::~skiplist() {
   while (curr->key < KEY_MAX) {
     auto tmp = curr;
     curr = rqProvider->read_vcas(dummyTid, curr->p_next[0]);
+    retireVersions(dummyTid, tmp);
     recmgr->retire(dummyTid, tmp);
   }
+  retireVersions(dummyTid, curr);
   recmgr->retire(dummyTid, curr);
   delete rqProvider;
   recmgr->printStatus();
@@ -480,7 +482,7 @@ int skiplist<K, V, RecManager>::rangeQuery(const int tid, const K& lo,
                                            V* const resultValues) {
   //    cout<<"rangeQuery(lo="<<lo<<" hi="<<hi<<")"<<endl;
   recmgr->leaveQuiescentState(tid, true);
-  int ts = rqProvider->traversal_start(tid);
+  timestamp_t ts = rqProvider->traversal_start(tid);
   int cnt = 0;
   // use the find function to find the low key
   //    int nodesSkipped = 0;